@@ -0,0 +1,159 @@
+//
+//  compact_json_io.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <string>
+
+#include "ait.h"
+
+namespace ait
+{
+
+// A compact JSON forest file only contains the nodes that can be reached from the root of each tree:
+//   {"forest": {"format": "compact", "version": 1, "trees": [
+//     {"depth": 3, "nodes": [
+//       {"id": 0, "index": 0, "left": 1, "right": 2, "split_point": {...}, "statistics": {...}},
+//       {"id": 1, "index": 1, "leaf": true, "statistics": {...}}, ...]}, ...]}}
+// Node ids are positions in the nodes array and the index is the position in the full (level-order) tree.
+// Statistics of internal nodes can be omitted.
+
+static const int COMPACT_JSON_FOREST_VERSION = 1;
+
+/// @brief Writes trees of image split points and histogram statistics to a compact JSON file one by one.
+template <typename TTree>
+class CompactJsonForestWriter
+{
+public:
+    CompactJsonForestWriter(const std::string& filename, bool write_internal_statistics = true)
+    : filename_(filename), output_(filename), write_internal_statistics_(write_internal_statistics), num_of_trees_(0)
+    {
+        if (!output_)
+        {
+            throw std::runtime_error("Unable to open compact JSON forest file '" + filename_ + "' for writing.");
+        }
+        output_.precision(std::numeric_limits<scalar_type>::max_digits10);
+        output_ << "{\n\"forest\": {\n\"format\": \"compact\",\n\"version\": " << COMPACT_JSON_FOREST_VERSION << ",\n\"trees\": [";
+        check_output();
+    }
+
+    ~CompactJsonForestWriter()
+    {
+        if (output_.is_open())
+        {
+            output_ << "\n]\n}\n}\n";
+        }
+    }
+
+    /// @brief Finish the JSON document and close the file.
+    void close()
+    {
+        output_ << "\n]\n}\n}\n";
+        check_output();
+        output_.close();
+    }
+
+    CompactJsonForestWriter(const CompactJsonForestWriter&) = delete;
+    CompactJsonForestWriter& operator=(const CompactJsonForestWriter&) = delete;
+
+    /// @brief Append a tree. Only nodes that are reachable from the root are written.
+    void write_tree(const TTree& tree)
+    {
+        if (num_of_trees_ > 0)
+        {
+            output_ << ",";
+        }
+        output_ << "\n{\"depth\": " << tree.depth() << ", \"nodes\": [";
+        // Nodes are written in breadth-first order. Children get their id when their parent is written.
+        std::deque<size_type> node_queue;
+        node_queue.push_back(0);
+        size_type next_id = 1;
+        size_type id = 0;
+        while (!node_queue.empty())
+        {
+            size_type node_index = node_queue.front();
+            node_queue.pop_front();
+            const auto& node_entry = tree.get_node(node_index);
+            const auto& node = node_entry.node;
+            if (id > 0)
+            {
+                output_ << ",";
+            }
+            output_ << "\n{\"id\": " << id << ", \"index\": " << node_index;
+            if (node_entry.is_leaf)
+            {
+                output_ << ", \"leaf\": true";
+            }
+            else
+            {
+                output_ << ", \"left\": " << next_id << ", \"right\": " << next_id + 1;
+                next_id += 2;
+                node_queue.push_back(2 * node_index + 1);
+                node_queue.push_back(2 * node_index + 2);
+                const auto& split_point = node.get_split_point();
+                output_ << ", \"split_point\": {\"offset_x1\": " << split_point.get_offset_x1()
+                        << ", \"offset_y1\": " << split_point.get_offset_y1()
+                        << ", \"offset_x2\": " << split_point.get_offset_x2()
+                        << ", \"offset_y2\": " << split_point.get_offset_y2()
+                        << ", \"threshold\": " << split_point.get_threshold() << "}";
+            }
+            const auto& statistics = node.get_statistics();
+            if ((node_entry.is_leaf || write_internal_statistics_) && statistics.num_of_bins() > 0)
+            {
+                output_ << ", \"statistics\": {\"histogram\": [";
+                const auto& histogram = statistics.get_histogram();
+                for (auto it = histogram.cbegin(); it != histogram.cend(); ++it)
+                {
+                    if (it != histogram.cbegin())
+                    {
+                        output_ << ", ";
+                    }
+                    output_ << *it;
+                }
+                output_ << "], \"num_of_samples\": " << statistics.num_of_samples() << "}";
+            }
+            output_ << "}";
+            ++id;
+        }
+        output_ << "\n]}";
+        check_output();
+        ++num_of_trees_;
+    }
+
+    /// @brief Append all trees of a forest.
+    template <typename TForest>
+    void write_forest(const TForest& forest)
+    {
+        for (auto tree_it = forest.cbegin(); tree_it != forest.cend(); ++tree_it)
+        {
+            write_tree(*tree_it);
+        }
+    }
+
+    size_type num_of_trees() const
+    {
+        return num_of_trees_;
+    }
+
+private:
+    void check_output()
+    {
+        if (!output_)
+        {
+            throw std::runtime_error("Unable to write to compact JSON forest file '" + filename_ + "'.");
+        }
+    }
+
+    std::string filename_;
+    std::ofstream output_;
+    bool write_internal_statistics_;
+    size_type num_of_trees_;
+};
+
+}
@@ -17,6 +17,10 @@
 #include "mpl_utils.h"
 
 #include <boost/iterator/iterator_facade.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 namespace ait
 {
@@ -46,6 +50,40 @@ inline std::string& trim(std::string& str)
     return trim_trailing(trim_leading(str));
 }
 
+/// @brief Trim leading and trailing whitespaces from a boost::string_ref.
+inline boost::string_ref trim(boost::string_ref str)
+{
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+    {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+    {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+/// @brief Return a filename as a path relative to a directory unless it is already absolute.
+inline std::string resolve_path(const std::string& directory, boost::string_ref filename)
+{
+    bool is_absolute = (!filename.empty() && (filename.front() == '/' || filename.front() == '\\'))
+        || (filename.size() > 1 && filename[1] == ':');
+    std::string path;
+    if (is_absolute || directory.empty())
+    {
+        path.assign(filename.begin(), filename.end());
+    }
+    else
+    {
+        path.reserve(directory.size() + 1 + filename.size());
+        path.append(directory);
+        path.push_back(boost::filesystem::path::preferred_separator);
+        path.append(filename.begin(), filename.end());
+    }
+    return path;
+}
+
 template <typename T>
 inline T convert_from_string(const std::string& str)
 {
@@ -138,4 +176,111 @@ private:
     std::istream& sin_;
 };
 
+/// @brief A CSV reader working on a memory-mapped file.
+///
+/// Each row is returned as a vector of trimmed string references into the mapped buffer.
+/// The row vector is reused so that no memory is allocated once the widest row has been seen.
+/// The string references are only valid as long as the reader exists.
+template <char delimiter = ','>
+class MappedCSVReader
+{
+    class CSVIterator
+    : public boost::iterator_facade<CSVIterator, const std::vector<boost::string_ref>, boost::forward_traversal_tag>
+    {
+		using IteratorFacadeType = boost::iterator_facade<CSVIterator, const std::vector<boost::string_ref>, boost::forward_traversal_tag>;
+
+        friend class MappedCSVReader;
+        friend class boost::iterator_core_access;
+
+        explicit CSVIterator()
+        : line_ptr_(nullptr), next_ptr_(nullptr), end_ptr_(nullptr)
+        {}
+
+        explicit CSVIterator(const char* begin_ptr, const char* end_ptr)
+        : line_ptr_(nullptr), next_ptr_(begin_ptr), end_ptr_(end_ptr)
+        {}
+
+        void read_next_line()
+        {
+            row_.clear();
+            line_ptr_ = next_ptr_;
+            if (next_ptr_ == end_ptr_)
+            {
+                return;
+            }
+            const char* line_end_ptr = std::find(next_ptr_, end_ptr_, '\n');
+            next_ptr_ = line_end_ptr == end_ptr_ ? end_ptr_ : line_end_ptr + 1;
+            if (line_ptr_ == line_end_ptr)
+            {
+                return;
+            }
+            const char* cell_ptr = line_ptr_;
+            while (true)
+            {
+                const char* cell_end_ptr = std::find(cell_ptr, line_end_ptr, delimiter);
+                row_.push_back(trim(boost::string_ref(cell_ptr, cell_end_ptr - cell_ptr)));
+                if (cell_end_ptr == line_end_ptr)
+                {
+                    break;
+                }
+                cell_ptr = cell_end_ptr + 1;
+            }
+        }
+
+        void increment()
+        {
+            read_next_line();
+            if (row_.size() == 0)
+            {
+                line_ptr_ = nullptr;
+            }
+        }
+
+        bool equal(const CSVIterator& other) const
+        {
+            return this->line_ptr_ == other.line_ptr_;
+        }
+
+        typename IteratorFacadeType::iterator_facade_::reference& dereference() const
+        {
+            return row_;
+        }
+
+        const char* line_ptr_;
+        const char* next_ptr_;
+        const char* end_ptr_;
+        typename IteratorFacadeType::iterator_facade_::value_type row_;
+    };
+
+public:
+    using iterator = CSVIterator;
+
+    explicit MappedCSVReader(const std::string& filename)
+    {
+        // Empty files cannot be mapped.
+        if (boost::filesystem::file_size(filename) > 0)
+        {
+            file_mapping_ = boost::interprocess::file_mapping(filename.c_str(), boost::interprocess::read_only);
+            mapped_region_ = boost::interprocess::mapped_region(file_mapping_, boost::interprocess::read_only);
+            mapped_region_.advise(boost::interprocess::mapped_region::advice_sequential);
+        }
+    }
+
+    iterator begin()
+    {
+        const char* begin_ptr = static_cast<const char*>(mapped_region_.get_address());
+        iterator it = iterator(begin_ptr, begin_ptr + mapped_region_.get_size());
+        return ++it;
+    }
+
+    iterator end()
+    {
+        return iterator();
+    }
+
+private:
+    boost::interprocess::file_mapping file_mapping_;
+    boost::interprocess::mapped_region mapped_region_;
+};
+
 }
@@ -0,0 +1,505 @@
+//
+//  dense_predictor.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#if AIT_MULTI_THREADING
+#include <thread>
+#endif
+
+#include "ait.h"
+#include "image_weak_learner.h"
+#include "forest.h"
+#include "evaluation_utils.h"
+#include "foreground_mask.h"
+
+namespace ait
+{
+
+/// @brief Per-pixel labels and (optionally) class posteriors of an image.
+///        Pixels are stored row by row, i.e. the label of pixel (x, y) is labels[y * width + x].
+///        Pixels outside of a foreground mask have the label num_of_classes and zero posteriors.
+struct DensePrediction
+{
+    size_type width = 0;
+    size_type height = 0;
+    size_type num_of_classes = 0;
+    std::vector<label_type> labels;
+    // Posterior of class c at pixel (x, y) is posteriors[(y * width + x) * num_of_classes + c] (empty if not requested).
+    std::vector<float> posteriors;
+    // Number of tree evaluations of all pixels (less than width * height * num_of_trees with early exit).
+    size_type num_of_evaluated_trees = 0;
+    // Number of pixels that the forest was evaluated on (less than width * height with a mask or coarse-to-fine prediction).
+    size_type num_of_evaluated_pixels = 0;
+
+    void resize(size_type width, size_type height, size_type num_of_classes, bool with_posteriors)
+    {
+        this->width = width;
+        this->height = height;
+        this->num_of_classes = num_of_classes;
+        labels.resize(width * height);
+        posteriors.resize(with_posteriors ? width * height * num_of_classes : 0);
+        num_of_evaluated_trees = 0;
+        num_of_evaluated_pixels = 0;
+    }
+
+    /// @brief Average number of trees that were evaluated per pixel.
+    scalar_type get_average_num_of_evaluated_trees() const
+    {
+        return labels.empty() ? 0 : num_of_evaluated_trees / static_cast<scalar_type>(labels.size());
+    }
+
+    bool has_posteriors() const
+    {
+        return !posteriors.empty();
+    }
+};
+
+/// @brief Predicts the labels of all pixels of images with a forest.
+///
+/// The posteriors of a pixel are the mean (or, with PosteriorAggregation::PRODUCT, the normalized product) of the
+/// normalized leaf histograms of all trees and the label is the class with the largest posterior
+/// (see ForestUtilities::compute_posteriors).
+/// With a shallow forest, the predictor is a cascade (see CascadeForestUtilities): the deep forest is only
+/// evaluated on pixels that the shallow forest is uncertain about.
+/// The rows of all images in a batch are distributed over the threads. Each thread evaluates its rows in blocks
+/// with its own scratch buffers, so no memory is allocated per pixel.
+template <typename TForest>
+class DenseForestPredictor
+{
+public:
+    using ForestT = TForest;
+    using ForestUtilsT = ForestUtilities<typename TForest::SplitPointT, typename TForest::StatisticsT>;
+    using CascadeForestUtilsT = CascadeForestUtilities<typename TForest::SplitPointT, typename TForest::StatisticsT>;
+
+    explicit DenseForestPredictor(const TForest& forest, int_type num_of_threads = -1,
+                                  PosteriorAggregation aggregation = PosteriorAggregation::SUM)
+    : forest_(forest), forest_utils_(new ForestUtilsT(forest, aggregation)), num_of_threads_(num_of_threads)
+    {
+        num_of_classes_ = forest_utils_->num_of_classes();
+        image_border_ = compute_max_split_point_offset(forest_);
+        init_num_of_threads();
+    }
+
+    /// @brief Create a cascade of a shallow and a deep forest.
+    /// @param entropy_threshold Pixels whose normalized posterior entropy in the shallow forest exceeds this value
+    ///                          are passed to the deep forest.
+    DenseForestPredictor(const TForest& shallow_forest, const TForest& forest, scalar_type entropy_threshold,
+                         int_type num_of_threads = -1, PosteriorAggregation aggregation = PosteriorAggregation::SUM)
+    : forest_(forest), cascade_forest_utils_(new CascadeForestUtilsT(shallow_forest, forest, entropy_threshold, aggregation)),
+      num_of_threads_(num_of_threads)
+    {
+        num_of_classes_ = cascade_forest_utils_->num_of_classes();
+        image_border_ = std::max(compute_max_split_point_offset(shallow_forest), compute_max_split_point_offset(forest_));
+        init_num_of_threads();
+    }
+
+    const TForest& get_forest() const
+    {
+        return forest_;
+    }
+
+    size_type num_of_classes() const
+    {
+        return num_of_classes_;
+    }
+
+    bool is_cascade() const
+    {
+        return static_cast<bool>(cascade_forest_utils_);
+    }
+
+    /// @brief Stop evaluating the trees of a pixel once its label is decided (see ForestUtilities::enable_early_exit).
+    ///        In a cascade, this applies to the deep forest.
+    void enable_early_exit(scalar_type confidence = 1)
+    {
+        if (is_cascade())
+        {
+            cascade_forest_utils_->enable_early_exit(confidence);
+        }
+        else
+        {
+            forest_utils_->enable_early_exit(confidence);
+        }
+    }
+
+    /// @brief Guard border that images need to have so that all split point offsets stay within the image data.
+    offset_type image_border() const
+    {
+        return image_border_;
+    }
+
+    /// @brief Predict all pixels of an image. The prediction has to be resized before (to request posteriors).
+    template <typename TPixel>
+    void predict(const Image<TPixel>& image, DensePrediction& prediction) const
+    {
+        std::vector<const Image<TPixel>*> images(1, &image);
+        std::vector<DensePrediction*> predictions(1, &prediction);
+        predict_batch(images, predictions);
+    }
+
+    /// @brief Predict the foreground pixels of an image (see ForegroundMask).
+    template <typename TPixel>
+    void predict(const Image<TPixel>& image, const ForegroundMask& mask, DensePrediction& prediction) const
+    {
+        std::vector<const Image<TPixel>*> images(1, &image);
+        std::vector<const ForegroundMask*> masks(1, &mask);
+        std::vector<DensePrediction*> predictions(1, &prediction);
+        predict_batch(images, masks, predictions);
+    }
+
+    /// @brief Predict all pixels of a batch of images.
+    template <typename TPixel>
+    void predict_batch(const std::vector<const Image<TPixel>*>& images, const std::vector<DensePrediction*>& predictions) const
+    {
+        std::vector<const ForegroundMask*> masks(images.size(), nullptr);
+        predict_batch(images, masks, predictions);
+    }
+
+    /// @brief Predict the pixels of a batch of images. Only the foreground pixels of images with a mask are evaluated.
+    /// @param masks Foreground mask of each image or nullptr to predict all pixels.
+    template <typename TPixel>
+    void predict_batch(const std::vector<const Image<TPixel>*>& images, const std::vector<const ForegroundMask*>& masks,
+                       const std::vector<DensePrediction*>& predictions) const
+    {
+        predict_batch(images, masks, predictions, true);
+    }
+
+    /// @brief Predict only the pixels of the mask and keep the labels and posteriors of all other pixels.
+    ///        The prediction has to be of the same image size (e.g. the prediction of a previous frame).
+    template <typename TPixel>
+    void update(const Image<TPixel>& image, const ForegroundMask& mask, DensePrediction& prediction) const
+    {
+        std::vector<const Image<TPixel>*> images(1, &image);
+        std::vector<const ForegroundMask*> masks(1, &mask);
+        std::vector<DensePrediction*> predictions(1, &prediction);
+        predict_batch(images, masks, predictions, false);
+    }
+
+    /// @brief Evaluate the forest only on a sub-grid of every stride-th pixel in x and y and upsample the labels.
+    ///
+    /// A pixel between the grid pixels takes the label and the posteriors of the grid pixels around it if they
+    /// all agree. Otherwise (i.e. at label boundaries) the pixel is evaluated at full resolution. The grid pixels and
+    /// the refined pixels have exactly the same predictions as without coarse-to-fine prediction.
+    /// A stride of 1 disables coarse-to-fine prediction.
+    void enable_coarse_to_fine(size_type stride)
+    {
+        if (stride < 1)
+        {
+            throw std::runtime_error("The coarse-to-fine stride must be at least 1.");
+        }
+        coarse_stride_ = stride;
+    }
+
+    size_type coarse_stride() const
+    {
+        return coarse_stride_;
+    }
+
+private:
+    /// @param fill_background_pixels Whether pixels outside of the masks are background or keep their prediction.
+    template <typename TPixel>
+    void predict_batch(const std::vector<const Image<TPixel>*>& images, const std::vector<const ForegroundMask*>& masks,
+                       const std::vector<DensePrediction*>& predictions, bool fill_background_pixels) const
+    {
+        check_batch(images, masks, predictions);
+        for (DensePrediction* prediction : predictions)
+        {
+            prediction->num_of_evaluated_trees = 0;
+            prediction->num_of_evaluated_pixels = 0;
+        }
+        // Each work item is one row of one image.
+        std::vector<std::pair<size_type, offset_type>> rows;
+        for (size_type i = 0; i < static_cast<size_type>(images.size()); ++i)
+        {
+            for (offset_type y = 0; y < images[i]->height(); ++y)
+            {
+                rows.push_back(std::make_pair(i, y));
+            }
+        }
+        if (coarse_stride_ <= 1)
+        {
+            process_rows<TPixel>(rows, predictions, [&] (size_type i, offset_type y, std::vector<ImageSample<TPixel>>& row_samples, PosteriorBuffer& buffer)
+            {
+                if (fill_background_pixels)
+                {
+                    fill_background_row(masks[i], y, *predictions[i]);
+                }
+                collect_row_samples(*images[i], masks[i], y, 1, row_samples);
+                predict_samples(row_samples, y, *predictions[i], nullptr, buffer);
+                return static_cast<size_type>(row_samples.size());
+            });
+            return;
+        }
+        // Coarse-to-fine: Evaluate the sub-grid first. The rows of the second pass read the grid pixels of the neighboring rows.
+        std::vector<std::vector<std::uint8_t>> evaluated(images.size());
+        std::vector<std::pair<size_type, offset_type>> grid_rows;
+        for (size_type i = 0; i < static_cast<size_type>(images.size()); ++i)
+        {
+            evaluated[i].assign(images[i]->width() * images[i]->height(), 0);
+            for (offset_type y = 0; y < images[i]->height(); y += coarse_stride_)
+            {
+                grid_rows.push_back(std::make_pair(i, y));
+            }
+        }
+        process_rows<TPixel>(grid_rows, predictions, [&] (size_type i, offset_type y, std::vector<ImageSample<TPixel>>& row_samples, PosteriorBuffer& buffer)
+        {
+            collect_row_samples(*images[i], masks[i], y, coarse_stride_, row_samples);
+            predict_samples(row_samples, y, *predictions[i], &evaluated[i][y * images[i]->width()], buffer);
+            return static_cast<size_type>(row_samples.size());
+        });
+        process_rows<TPixel>(rows, predictions, [&] (size_type i, offset_type y, std::vector<ImageSample<TPixel>>& row_samples, PosteriorBuffer& buffer)
+        {
+            if (fill_background_pixels)
+            {
+                fill_background_row(masks[i], y, *predictions[i]);
+            }
+            collect_row_samples(*images[i], masks[i], y, 1, row_samples);
+            upsample_row(evaluated[i], y, *predictions[i], row_samples);
+            predict_samples(row_samples, y, *predictions[i], nullptr, buffer);
+            return static_cast<size_type>(row_samples.size());
+        });
+    }
+
+    void init_num_of_threads()
+    {
+#if AIT_MULTI_THREADING
+        if (num_of_threads_ <= 0)
+        {
+            num_of_threads_ = std::thread::hardware_concurrency();
+        }
+#endif
+    }
+
+    template <typename TPixel>
+    void check_batch(const std::vector<const Image<TPixel>*>& images, const std::vector<const ForegroundMask*>& masks,
+                     const std::vector<DensePrediction*>& predictions) const
+    {
+        if (images.size() != predictions.size() || images.size() != masks.size())
+        {
+            throw std::runtime_error("The number of images, masks and predictions must be the same.");
+        }
+        for (size_type i = 0; i < static_cast<size_type>(images.size()); ++i)
+        {
+            if (images[i]->border() < image_border_)
+            {
+                throw std::runtime_error("The image border is too small for the split points of the forest.");
+            }
+            if (predictions[i]->width != images[i]->width() || predictions[i]->height != images[i]->height()
+                || predictions[i]->num_of_classes != num_of_classes_)
+            {
+                throw std::runtime_error("The prediction does not match the image and the forest.");
+            }
+            if (masks[i] != nullptr && (masks[i]->width() != images[i]->width() || masks[i]->height() != images[i]->height()))
+            {
+                throw std::runtime_error("The foreground mask does not match the image.");
+            }
+        }
+    }
+
+    /// @brief Distribute the rows over the threads and call process_row(image_index, y, row_samples, buffer) for each row.
+    ///        process_row returns the number of evaluated pixels. The counts are added to the predictions.
+    template <typename TPixel, typename TFunction>
+    void process_rows(const std::vector<std::pair<size_type, offset_type>>& rows, const std::vector<DensePrediction*>& predictions,
+                      TFunction process_row) const
+    {
+        std::atomic<size_type> next_row(0);
+        std::vector<size_type> row_evaluated_trees(rows.size(), 0);
+        std::vector<size_type> row_evaluated_pixels(rows.size(), 0);
+        auto process_rows_of_thread = [&] ()
+        {
+            PosteriorBuffer buffer(num_of_classes_);
+            // The sample vector keeps its capacity from the previous rows.
+            std::vector<ImageSample<TPixel>> row_samples;
+            for (size_type row = next_row++; row < static_cast<size_type>(rows.size()); row = next_row++)
+            {
+                buffer.reset_evaluated_trees();
+                row_evaluated_pixels[row] = process_row(rows[row].first, rows[row].second, row_samples, buffer);
+                row_evaluated_trees[row] = buffer.num_of_evaluated_trees();
+            }
+        };
+#if AIT_MULTI_THREADING
+        size_type num_of_threads = std::max<size_type>(1, std::min<size_type>(num_of_threads_, rows.size()));
+        std::vector<std::thread> threads;
+        for (size_type thread_index = 1; thread_index < num_of_threads; ++thread_index)
+        {
+            threads.push_back(std::thread(process_rows_of_thread));
+        }
+        process_rows_of_thread();
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+#else
+        process_rows_of_thread();
+#endif
+        for (size_type row = 0; row < static_cast<size_type>(rows.size()); ++row)
+        {
+            predictions[rows[row].first]->num_of_evaluated_trees += row_evaluated_trees[row];
+            predictions[rows[row].first]->num_of_evaluated_pixels += row_evaluated_pixels[row];
+        }
+    }
+
+    /// @brief Pixels outside of the mask are background. The pixels of the mask are not touched.
+    void fill_background_row(const ForegroundMask* mask, offset_type y, DensePrediction& prediction) const
+    {
+        if (mask == nullptr)
+        {
+            return;
+        }
+        offset_type x_begin = 0;
+        for (const ForegroundMask::Run* run = mask->row_begin(y); run != mask->row_end(y); ++run)
+        {
+            fill_background(y, x_begin, run->x_begin, prediction);
+            x_begin = run->x_end;
+        }
+        fill_background(y, x_begin, prediction.width, prediction);
+    }
+
+    void fill_background(offset_type y, offset_type x_begin, offset_type x_end, DensePrediction& prediction) const
+    {
+        size_type pixel_index = y * prediction.width;
+        std::fill(&prediction.labels[pixel_index + x_begin], &prediction.labels[pixel_index + x_end], static_cast<label_type>(num_of_classes_));
+        if (prediction.has_posteriors())
+        {
+            std::fill(&prediction.posteriors[(pixel_index + x_begin) * num_of_classes_], &prediction.posteriors[(pixel_index + x_end) * num_of_classes_], 0.0f);
+        }
+    }
+
+    /// @brief Collect every stride-th pixel of row y (within the mask if any).
+    template <typename TPixel>
+    void collect_row_samples(const Image<TPixel>& image, const ForegroundMask* mask, offset_type y, size_type stride,
+                             std::vector<ImageSample<TPixel>>& row_samples) const
+    {
+        row_samples.clear();
+        if (mask == nullptr)
+        {
+            for (offset_type x = 0; x < image.width(); x += stride)
+            {
+                row_samples.emplace_back(&image, x, y);
+            }
+            return;
+        }
+        for (const ForegroundMask::Run* run = mask->row_begin(y); run != mask->row_end(y); ++run)
+        {
+            // Round the start of the run up to the grid.
+            offset_type x_begin = (run->x_begin + stride - 1) / stride * stride;
+            for (offset_type x = x_begin; x < run->x_end; x += stride)
+            {
+                row_samples.emplace_back(&image, x, y);
+            }
+        }
+    }
+
+    /// @brief Take the prediction of the grid pixels around each sample of row y if their labels agree and
+    ///        remove these samples, so that only the grid pixels themselves and the samples at label boundaries remain.
+    template <typename TPixel>
+    void upsample_row(const std::vector<std::uint8_t>& evaluated, offset_type y, DensePrediction& prediction,
+                      std::vector<ImageSample<TPixel>>& row_samples) const
+    {
+        const size_type stride = coarse_stride_;
+        const offset_type y0 = y - y % stride;
+        std::size_t num_of_kept_samples = 0;
+        for (std::size_t i = 0; i < row_samples.size(); ++i)
+        {
+            const offset_type x = row_samples[i].get_x();
+            size_type pixel_index = y * prediction.width + x;
+            if (evaluated[pixel_index])
+            {
+                // Grid pixel that was evaluated in the coarse pass.
+                continue;
+            }
+            const offset_type x0 = x - x % stride;
+            size_type corner_indices[4] = {
+                y0 * prediction.width + x0, y0 * prediction.width + x0 + stride,
+                (y0 + stride) * prediction.width + x0, (y0 + stride) * prediction.width + x0 + stride
+            };
+            const bool corner_exists[4] = {
+                true, x0 + stride < prediction.width,
+                y0 + stride < prediction.height, x0 + stride < prediction.width && y0 + stride < prediction.height
+            };
+            size_type source_index = -1;
+            bool agree = true;
+            for (int c = 0; c < 4 && agree; ++c)
+            {
+                if (!corner_exists[c] || !evaluated[corner_indices[c]])
+                {
+                    continue;
+                }
+                if (source_index < 0)
+                {
+                    source_index = corner_indices[c];
+                }
+                else if (prediction.labels[corner_indices[c]] != prediction.labels[source_index])
+                {
+                    agree = false;
+                }
+            }
+            if (!agree || source_index < 0)
+            {
+                // Label boundary (or no grid pixel in the mask nearby): Evaluate at full resolution.
+                row_samples[num_of_kept_samples++] = row_samples[i];
+                continue;
+            }
+            prediction.labels[pixel_index] = prediction.labels[source_index];
+            if (prediction.has_posteriors())
+            {
+                std::copy(&prediction.posteriors[source_index * num_of_classes_], &prediction.posteriors[(source_index + 1) * num_of_classes_],
+                          &prediction.posteriors[pixel_index * num_of_classes_]);
+            }
+        }
+        row_samples.erase(row_samples.begin() + num_of_kept_samples, row_samples.end());
+    }
+
+    /// @brief Predict the samples of row y and optionally flag them as evaluated.
+    template <typename TPixel>
+    void predict_samples(const std::vector<ImageSample<TPixel>>& samples, offset_type y, DensePrediction& prediction,
+                         std::uint8_t* evaluated_row, PosteriorBuffer& buffer) const
+    {
+        if (is_cascade())
+        {
+            predict_samples(*cascade_forest_utils_, samples, y, prediction, evaluated_row, buffer);
+        }
+        else
+        {
+            predict_samples(*forest_utils_, samples, y, prediction, evaluated_row, buffer);
+        }
+    }
+
+    template <typename TForestUtils, typename TPixel>
+    void predict_samples(const TForestUtils& forest_utils, const std::vector<ImageSample<TPixel>>& samples, offset_type y,
+                         DensePrediction& prediction, std::uint8_t* evaluated_row, PosteriorBuffer& buffer) const
+    {
+        forest_utils.for_each_posteriors(samples.cbegin(), samples.cend(), buffer,
+                                         [&] (const ImageSample<TPixel>& sample, const float* posteriors)
+        {
+            size_type pixel_index = y * prediction.width + sample.get_x();
+            prediction.labels[pixel_index] = PosteriorBuffer::get_max_class(posteriors, num_of_classes_);
+            if (prediction.has_posteriors())
+            {
+                std::copy(posteriors, posteriors + num_of_classes_, &prediction.posteriors[pixel_index * num_of_classes_]);
+            }
+            if (evaluated_row != nullptr)
+            {
+                evaluated_row[sample.get_x()] = 1;
+            }
+        });
+    }
+
+    const TForest& forest_;
+    std::unique_ptr<ForestUtilsT> forest_utils_;
+    std::unique_ptr<CascadeForestUtilsT> cascade_forest_utils_;
+    int_type num_of_threads_;
+    size_type num_of_classes_;
+    offset_type image_border_;
+    size_type coarse_stride_ = 1;
+};
+
+}
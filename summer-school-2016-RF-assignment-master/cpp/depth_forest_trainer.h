@@ -9,6 +9,7 @@
 #pragma once
 #include <iostream>
 #include <sstream>
+#include <functional>
 #include <boost/foreach.hpp>
 
 #include "ait.h"
@@ -148,12 +149,22 @@ public:
     Forest<SplitPointT, StatisticsT> train_forest(SampleIteratorT samples_start, SampleIteratorT samples_end, RandomEngineT& rnd_engine) const
     {
         Forest<SplitPointT, StatisticsT> forest;
+        train_forest(samples_start, samples_end, rnd_engine, [&forest] (TreeT& tree)
+        {
+            forest.add_tree(tree);
+        });
+        return forest;
+    }
+
+    /// @brief Train a forest and pass each tree to tree_handler as soon as it is trained.
+    ///        The tree is released afterwards, so only one tree is kept in memory.
+    void train_forest(SampleIteratorT samples_start, SampleIteratorT samples_end, RandomEngineT& rnd_engine, const std::function<void(TreeT&)>& tree_handler) const
+    {
         for (int i=0; i < training_parameters_.num_of_trees; i++)
         {
             Tree<SplitPointT, StatisticsT> tree = train_tree(samples_start, samples_end, rnd_engine);
-            forest.add_tree(std::move(tree));
+            tree_handler(tree);
         }
-        return forest;
     }
     
     Forest<SplitPointT, StatisticsT> train_forest(SampleIteratorT samples_start, SampleIteratorT samples_end) const
@@ -15,15 +15,20 @@
 #include <chrono>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <cereal/archives/json.hpp>
 #include <cereal/archives/binary.hpp>
 #include <tclap/CmdLine.h>
 
 #include "ait.h"
 #include "depth_forest_trainer.h"
+#include "level_forest_trainer.h"
+#include "forest_stream_io.h"
+#include "compact_json_io.h"
 #include "histogram_statistics.h"
 #include "image_weak_learner.h"
 #include "csv_utils.h"
+#include "matlab_file_io.h"
 #include "evaluation_utils.h"
 
 
@@ -44,22 +49,34 @@ using BaggingWrapperT = ait::BaggingWrapper<ForestTrainerAliasT, SampleProviderT
 using SampleIteratorT = BaggingWrapperT::SampleIteratorT;
 using ForestTrainerT = BaggingWrapperT::ForestTrainerT;
 using WeakLearnerT = ForestTrainerT::WeakLearnerT;
+using LevelForestTrainerT = ait::LevelForestTrainer<WeakLearnerAliasT, SampleProviderT>;
 
 int main(int argc, const char* argv[]) {
     try {
         // Parse command line arguments.
         TCLAP::CmdLine cmd("Depth RF trainer", ' ', "0.3");
-        TCLAP::ValueArg<std::string> image_list_file_arg("f", "image-list-file", "File containing the names of image files", true, "", "string", cmd);
+        TCLAP::ValueArg<std::string> image_list_file_arg("f", "image-list-file", "File containing the names of image files", true, "", "string");
+        TCLAP::ValueArg<std::string> mat_file_arg("", "mat-file", "MAT-file containing the data and label images", true, "", "string");
+        TCLAP::ValueArg<std::string> mat_label_array_arg("", "mat-label-array", "Name of the label array in the MAT-file", false, "labels", "string", cmd);
         TCLAP::ValueArg<int> num_of_classes_arg("n", "num-of-classes", "Number of classes in the data", true, 1, "int", cmd);
         TCLAP::SwitchArg print_confusion_matrix_switch("m", "conf-matrix", "Print confusion matrix", cmd, true);
         TCLAP::ValueArg<int> background_label_arg("l", "background-label", "Lower bound of background labels to be ignored", false, -1, "int", cmd);
         TCLAP::ValueArg<std::string> json_forest_file_arg("j", "json-forest-file", "JSON file where the trained forest should be saved", false, "forest.json", "string");
         TCLAP::ValueArg<std::string> binary_forest_file_arg("b", "binary-forest-file", "Binary file where the trained forest should be saved", false, "forest.bin", "string");
         TCLAP::ValueArg<std::string> config_file_arg("c", "config", "YAML file with training parameters", false, "", "string", cmd);
+        TCLAP::ValueArg<int> num_of_batches_arg("", "num-of-batches", "Train out-of-core on a bootstrap bag of images per tree that is split into this number of batches (only one batch is kept in memory)", false, 1, "int", cmd);
+        TCLAP::ValueArg<std::string> checkpoint_prefix_arg("", "checkpoint-prefix", "Prefix of the checkpoint files that are written during training (selects out-of-core training, see --num-of-batches)", false, "", "string", cmd);
+        TCLAP::SwitchArg resume_switch("", "resume", "Continue training from the last checkpoint", cmd, false);
+        TCLAP::SwitchArg stream_forest_switch("", "stream-forest", "Write each tree to the binary forest file as soon as it is trained", cmd, false);
+        TCLAP::SwitchArg compact_json_switch("", "compact-json", "Write only the reachable nodes of each tree to the JSON forest file", cmd, false);
+        TCLAP::SwitchArg no_internal_statistics_switch("", "no-internal-statistics", "Omit the statistics of internal nodes from the compact JSON forest file", cmd, false);
+        TCLAP::ValueArg<int> cascade_depth_arg("", "cascade-depth", "Depth of the shallow forest of a cascade that is cut from the upper levels of the trained forest", false, 10, "int", cmd);
+        TCLAP::ValueArg<std::string> cascade_forest_file_arg("", "cascade-forest-file", "Binary file where the shallow forest of a cascade should be saved (see forest_predictor --cascade-forest-file)", false, "", "string", cmd);
 #if AIT_MULTI_THREADING
         TCLAP::ValueArg<int> num_of_threads_arg("t", "threads", "Number of threads to use", false, -1, "int", cmd);
 #endif
         cmd.xorAdd(json_forest_file_arg, binary_forest_file_arg);
+        cmd.xorAdd(image_list_file_arg, mat_file_arg);
         cmd.parse(argc, argv);
         
         const int num_of_classes = num_of_classes_arg.getValue();
@@ -84,36 +101,26 @@ int main(int argc, const char* argv[]) {
 #endif
 
         // Read image file list
-        ait::log_info(false) << "Reading image list ... " << std::flush;
         std::vector<std::tuple<std::string, std::string>> image_list;
-        std::ifstream ifile(image_list_file);
-        if (!ifile.good()) {
-            throw std::runtime_error("Unable to open image list file");
-        }
-        ait::CSVReader<std::string> csv_reader(ifile);
-        for (auto it = csv_reader.begin(); it != csv_reader.end(); ++it) {
-            if (it->size() != 2) {
-                cmd.getOutput()->usage(cmd);
-                ait::log_error() << "Image list file should contain two columns with the data and label filenames.";
-                exit(-1);
-            }
-            const std::string& data_filename = (*it)[0];
-            const std::string& label_filename = (*it)[1];
-            
-            boost::filesystem::path data_path = boost::filesystem::path(data_filename);
-            boost::filesystem::path label_path = boost::filesystem::path(label_filename);
-            if (!data_path.is_absolute()) {
-                data_path = boost::filesystem::path(image_list_file).parent_path();
-                data_path /= data_filename;
+        if (image_list_file_arg.isSet()) {
+            ait::log_info(false) << "Reading image list ... " << std::flush;
+            if (!boost::filesystem::exists(image_list_file)) {
+                throw std::runtime_error("Unable to open image list file");
             }
-            if (!label_path.is_absolute()) {
-                label_path = boost::filesystem::path(image_list_file).parent_path();
-                label_path /= label_filename;
+            const std::string image_list_directory = boost::filesystem::path(image_list_file).parent_path().string();
+            ait::MappedCSVReader<> csv_reader(image_list_file);
+            for (auto it = csv_reader.begin(); it != csv_reader.end(); ++it) {
+                if (it->size() != 2) {
+                    cmd.getOutput()->usage(cmd);
+                    ait::log_error() << "Image list file should contain two columns with the data and label filenames.";
+                    exit(-1);
+                }
+                std::string data_path = ait::resolve_path(image_list_directory, (*it)[0]);
+                std::string label_path = ait::resolve_path(image_list_directory, (*it)[1]);
+                image_list.push_back(std::make_tuple(std::move(data_path), std::move(label_path)));
             }
-            
-            image_list.push_back(std::make_tuple(data_path.string(), label_path.string()));
+            ait::log_info(false) << " Done." << std::endl;
         }
-        ait::log_info(false) << " Done." << std::endl;
         
         // TODO: Ensure that label images do not contain values > num_of_classes except for background pixels. Other approach: Test samples directly below.
         
@@ -125,12 +132,26 @@ int main(int argc, const char* argv[]) {
             background_label = num_of_classes;
         }
         weak_learner_parameters.background_label = background_label;
+        // Pad images so that all sampled feature offsets stay within the guard border.
+        weak_learner_parameters.image_border = weak_learner_parameters.compute_image_border();
+
+        // Optionally: Load all images from a MAT-file.
+        std::shared_ptr<const std::vector<ImageT>> images;
+        if (mat_file_arg.isSet()) {
+            ait::log_info(false) << "Reading MAT-file " << mat_file_arg.getValue() << " ... " << std::flush;
+            images = std::make_shared<const std::vector<ImageT>>(ait::load_images_from_matlab_file<ait::pixel_type>(
+                mat_file_arg.getValue(), "data", mat_label_array_arg.getValue(), weak_learner_parameters.image_border, weak_learner_parameters.background_value));
+            ait::log_info(false) << " Done." << std::endl;
+        }
+        auto make_sample_provider = [&image_list, &images] (const ait::ImageParameters& parameters) {
+            return images ? SampleProviderT(images, parameters) : SampleProviderT(image_list, parameters);
+        };
 
         // Create weak learner and trainer.
         StatisticsT::Factory statistics_factory(num_of_classes);
         WeakLearnerT iwl(weak_learner_parameters, statistics_factory);
         ForestTrainerT trainer(iwl, training_parameters);
-        SampleProviderT sample_provider(image_list, weak_learner_parameters);
+        SampleProviderT sample_provider = make_sample_provider(weak_learner_parameters);
         BaggingWrapperT bagging_wrapper(trainer, sample_provider);
 
 #ifdef AIT_TESTING
@@ -143,17 +164,81 @@ int main(int argc, const char* argv[]) {
 
         // Train a forest and time it.
         auto start_time = std::chrono::high_resolution_clock::now();
-        // TODO
-        //		ForestTrainerT::ForestT forest = bagging_wrapper.train_forest(rnd_engine);
-        // TODO: Testing all samples for comparison with depth_trainer
-        sample_provider.clear_samples();
-        for (int i = 0; i < image_list.size(); ++i) {
-            sample_provider.load_samples_from_image(i, rnd_engine);
+        ForestTrainerT::ForestT forest;
+        if (resume_switch.getValue() && !checkpoint_prefix_arg.isSet()) {
+            throw std::runtime_error("Resuming requires a checkpoint prefix.");
+        }
+        // Optionally: Append each tree to the binary forest file and release it.
+        const bool stream_forest = stream_forest_switch.getValue();
+        if (stream_forest && !binary_forest_file_arg.isSet()) {
+            throw std::runtime_error("Streaming the forest requires a binary forest file.");
+        }
+        if (compact_json_switch.getValue() && !json_forest_file_arg.isSet()) {
+            throw std::runtime_error("A compact forest requires a JSON forest file.");
+        }
+        if (no_internal_statistics_switch.getValue() && !compact_json_switch.getValue()) {
+            throw std::runtime_error("Omitting internal node statistics requires a compact JSON forest.");
+        }
+        if (stream_forest && checkpoint_prefix_arg.isSet()) {
+            throw std::runtime_error("Streaming the forest cannot be combined with checkpoints.");
+        }
+        if (cascade_depth_arg.isSet() && !cascade_forest_file_arg.isSet()) {
+            throw std::runtime_error("A cascade depth requires a cascade forest file.");
+        }
+        if (cascade_forest_file_arg.isSet() && stream_forest) {
+            throw std::runtime_error("A cascade forest cannot be combined with streaming the forest.");
+        }
+        if (cascade_forest_file_arg.isSet() && (cascade_depth_arg.getValue() < 1 || cascade_depth_arg.getValue() >= training_parameters.tree_depth)) {
+            throw std::runtime_error("The cascade depth must be between 1 and the tree depth.");
+        }
+        std::unique_ptr<ait::ForestStreamWriter<ForestTrainerT::TreeT>> forest_writer;
+        if (stream_forest) {
+            forest_writer.reset(new ait::ForestStreamWriter<ForestTrainerT::TreeT>(binary_forest_file_arg.getValue()));
+        }
+        auto write_tree = [&forest_writer] (ForestTrainerT::TreeT& tree) {
+            forest_writer->write_tree(tree);
+            ait::log_info() << "Wrote tree " << forest_writer->num_of_trees() << " to forest stream.";
+        };
+        if (num_of_batches_arg.getValue() < 1) {
+            throw std::runtime_error("The number of batches must be at least 1.");
+        }
+        if (num_of_batches_arg.isSet() || checkpoint_prefix_arg.isSet()) {
+            // Out-of-core training: Nodes are trained level by level while streaming over the image batches.
+            // Unlike in-memory training, which uses the samples of every image for all trees, each tree is trained
+            // on the samples of its own bootstrap bag of images (see ImageSampleProvider::compute_sample_bag_batches).
+            if (!num_of_batches_arg.isSet()) {
+                ait::log_warning() << "Checkpoints require out-of-core training, which trains each tree on a bootstrap bag of images instead of all images.";
+            }
+            ait::LevelTrainingParameters level_training_parameters(training_parameters);
+            level_training_parameters.num_of_sample_bag_batches = num_of_batches_arg.getValue();
+            if (checkpoint_prefix_arg.isSet()) {
+                level_training_parameters.temporary_binary_forest_file_prefix = checkpoint_prefix_arg.getValue() + "forest";
+                level_training_parameters.temporary_binary_tree_file_prefix = checkpoint_prefix_arg.getValue() + "tree";
+            }
+            LevelForestTrainerT level_trainer(iwl, level_training_parameters);
+            ait::log_info() << "Starting out-of-core training with " << level_training_parameters.num_of_sample_bag_batches << " batches ...";
+            if (stream_forest) {
+                level_trainer.train_forest(sample_provider, rnd_engine, write_tree);
+            } else {
+                forest = level_trainer.train_forest(sample_provider, rnd_engine, resume_switch.getValue());
+            }
+        } else {
+            // TODO
+            //		ForestTrainerT::ForestT forest = bagging_wrapper.train_forest(rnd_engine);
+            // TODO: Testing all samples for comparison with depth_trainer
+            sample_provider.clear_samples();
+            for (int i = 0; i < sample_provider.num_of_images(); ++i) {
+                sample_provider.load_samples_from_image(i, rnd_engine);
+            }
+            SampleIteratorT samples_start = sample_provider.get_samples_begin();
+            SampleIteratorT samples_end = sample_provider.get_samples_end();
+            ait::log_info() << "Starting training ...";
+            if (stream_forest) {
+                trainer.train_forest(samples_start, samples_end, rnd_engine, write_tree);
+            } else {
+                forest = trainer.train_forest(samples_start, samples_end, rnd_engine);
+            }
         }
-        SampleIteratorT samples_start = sample_provider.get_samples_begin();
-        SampleIteratorT samples_end = sample_provider.get_samples_end();
-        ait::log_info() << "Starting training ...";
-        ForestTrainerT::ForestT forest = trainer.train_forest(samples_start, samples_end, rnd_engine);
         auto stop_time = std::chrono::high_resolution_clock::now();
         auto duration = stop_time - start_time;
         auto period = std::chrono::high_resolution_clock::period();
@@ -162,7 +247,18 @@ int main(int argc, const char* argv[]) {
         ait::log_info() << "Running time: " << elapsed_seconds;
         
         // Optionally: Serialize forest to JSON file.
-        if (json_forest_file_arg.isSet()) {
+        if (stream_forest) {
+            // The trees have already been written during training.
+            forest_writer.reset();
+        } else if (json_forest_file_arg.isSet() && compact_json_switch.getValue()) {
+            {
+                ait::log_info(false) << "Writing compact json forest file " << json_forest_file_arg.getValue() << "... " << std::flush;
+                ait::CompactJsonForestWriter<ForestTrainerT::TreeT> forest_writer(json_forest_file_arg.getValue(), !no_internal_statistics_switch.getValue());
+                forest_writer.write_forest(forest);
+                forest_writer.close();
+                ait::log_info(false) << " Done." << std::endl;
+            }
+        } else if (json_forest_file_arg.isSet()) {
             {
                 ait::log_info(false) << "Writing json forest file " << json_forest_file_arg.getValue() << "... " << std::flush;
                 std::ofstream ofile(json_forest_file_arg.getValue());
@@ -183,11 +279,28 @@ int main(int argc, const char* argv[]) {
             throw("This should never happen. Either a JSON or a binary forest file have to be specified!");
         }
 
+        // Optionally: Cut the shallow forest of a cascade from the upper levels of the trained trees.
+        // The nodes keep the statistics of their training samples, so the shallow forest needs no training of its own.
+        if (cascade_forest_file_arg.isSet()) {
+            ait::log_info(false) << "Writing cascade forest file " << cascade_forest_file_arg.getValue() << " with depth " << cascade_depth_arg.getValue() << "... " << std::flush;
+            ForestTrainerT::ForestT cascade_forest = forest.get_truncated_forest(cascade_depth_arg.getValue());
+            std::ofstream ofile(cascade_forest_file_arg.getValue(), std::ios_base::binary);
+            cereal::BinaryOutputArchive oarchive(ofile);
+            oarchive(cereal::make_nvp("forest", cascade_forest));
+            ait::log_info(false) << " Done." << std::endl;
+        }
+
         // Optionally: Compute some stats and print them.
         if (print_confusion_matrix) {
+            if (stream_forest) {
+                ait::log_info(false) << "Reading forest stream " << binary_forest_file_arg.getValue() << " ... " << std::flush;
+                ait::ForestStreamReader<ForestTrainerT::TreeT> forest_reader(binary_forest_file_arg.getValue());
+                forest_reader.read_forest(forest);
+                ait::log_info(false) << " Done." << std::endl;
+            }
             ait::log_info(false) << "Creating samples for testing ... " << std::flush;
             sample_provider.clear_samples();
-            for (int i = 0; i < image_list.size(); ++i) {
+            for (int i = 0; i < sample_provider.num_of_images(); ++i) {
                 sample_provider.load_samples_from_image(i, rnd_engine);
             }
             SampleIteratorT samples_start = sample_provider.get_samples_begin();
@@ -230,7 +343,7 @@ int main(int argc, const char* argv[]) {
             
             // Compute confusion matrix.
             auto forest_utils = ait::make_forest_utils(forest);
-            auto confusion_matrix = forest_utils.compute_confusion_matrix(samples_start, samples_end);
+            auto confusion_matrix = ait::EvaluationUtils::compute_confusion_matrix_parallel(forest_utils, samples_start, samples_end, training_parameters.num_of_threads);
             ait::log_info() << "Confusion matrix:" << std::endl << confusion_matrix;
             auto norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(confusion_matrix);
             ait::log_info() << "Normalized confusion matrix:" << std::endl << norm_confusion_matrix;
@@ -239,19 +352,12 @@ int main(int argc, const char* argv[]) {
             // Computing per-frame confusion matrix
             ait::log_info() << "Computing per-frame confusion matrix.";
             using ConfusionMatrixType = typename decltype(forest_utils)::MatrixType;
-            ConfusionMatrixType per_frame_confusion_matrix(num_of_classes, num_of_classes);
-            per_frame_confusion_matrix.setZero();
             WeakLearnerT::ParametersT full_parameters(weak_learner_parameters);
             // Modify parameters to retrieve all pixels per sample
             full_parameters.samples_per_image_fraction = 1.0;
-            SampleProviderT full_sample_provider(image_list, full_parameters);
-            for (int i = 0; i < image_list.size(); ++i) {
-                full_sample_provider.clear_samples();
-                full_sample_provider.load_samples_from_image(i, rnd_engine);
-                samples_start = full_sample_provider.get_samples_begin();
-                samples_end = full_sample_provider.get_samples_end();
-                forest_utils.update_confusion_matrix(per_frame_confusion_matrix, samples_start, samples_end);
-            }
+            SampleProviderT full_sample_provider = make_sample_provider(full_parameters);
+            ConfusionMatrixType per_frame_confusion_matrix = ait::EvaluationUtils::compute_per_frame_confusion_matrix_parallel(
+                forest_utils, full_sample_provider, rnd_engine, training_parameters.num_of_threads);
             ait::log_info() << "Per-frame confusion matrix:" << std::endl << per_frame_confusion_matrix;
             ConfusionMatrixType per_frame_norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(per_frame_confusion_matrix);
             ait::log_info() << "Normalized per-frame confusion matrix:" << std::endl << per_frame_norm_confusion_matrix;
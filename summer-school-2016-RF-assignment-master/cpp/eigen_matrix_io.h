@@ -11,16 +11,58 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <new>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <Eigen/Dense>
 
 namespace ait
 {
 
-template <typename Scalar, int RowsAtCompileTime, int ColsAtCompileTime>
-std::unique_ptr<Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime>> load_matrix(const std::string& filename)
+// Matrix files consist of the number of rows and columns (both int) followed by the entries in row-major order.
+
+template <typename Scalar>
+using RowMajorMatrixType = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+template <typename TMatrix>
+void read_matrix_data(std::istream& input, TMatrix& matrix)
 {
-	using MatrixType = Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime>;
+	std::streamsize num_of_bytes = matrix.size() * sizeof(typename TMatrix::Scalar);
+	// Vectors and row-major matrices have the same memory layout as the file.
+	if (TMatrix::IsRowMajor || TMatrix::IsVectorAtCompileTime) {
+		input.read(reinterpret_cast<char*>(matrix.data()), num_of_bytes);
+		if (!input)
+			throw std::runtime_error("Could not read data.");
+	}
+	else {
+		RowMajorMatrixType<typename TMatrix::Scalar> row_major_matrix(matrix.rows(), matrix.cols());
+		input.read(reinterpret_cast<char*>(row_major_matrix.data()), num_of_bytes);
+		if (!input)
+			throw std::runtime_error("Could not read data.");
+		matrix = row_major_matrix;
+	}
+}
+
+template <typename TMatrix>
+void write_matrix_data(std::ostream& output, const TMatrix& matrix)
+{
+	std::streamsize num_of_bytes = matrix.size() * sizeof(typename TMatrix::Scalar);
+	if (TMatrix::IsRowMajor || TMatrix::IsVectorAtCompileTime) {
+		output.write(reinterpret_cast<const char*>(matrix.data()), num_of_bytes);
+	}
+	else {
+		RowMajorMatrixType<typename TMatrix::Scalar> row_major_matrix = matrix;
+		output.write(reinterpret_cast<const char*>(row_major_matrix.data()), num_of_bytes);
+	}
+	if (!output)
+		throw std::runtime_error("Could not write data.");
+}
+
+template <typename Scalar, int RowsAtCompileTime, int ColsAtCompileTime, int Options = Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime>::Options>
+std::unique_ptr<Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime, Options>> load_matrix(const std::string& filename)
+{
+	using MatrixType = Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime, Options>;
 
 	std::ifstream input(filename.c_str(), std::ios::binary);
 	if (input.fail()) {
@@ -38,28 +80,17 @@ std::unique_ptr<Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime>> loa
 		throw std::runtime_error("Invalid matrix input file. Number of columns is not specified.");
 
 	std::unique_ptr<MatrixType> m_ptr = std::unique_ptr<MatrixType>(new MatrixType(rows, cols));
-
-	for (int row = 0; row < rows; row++) {
-		for (int col = 0; col < cols; col++) {
-			Scalar value;
-			input.read(reinterpret_cast<char*>(&value), sizeof(Scalar));
-			/*if (!input)
-				throw std::runtime_error("Could not read data.");*/
-			(*m_ptr)(row, col) = value;
-		}
-	}
+	read_matrix_data(input, *m_ptr);
 
 	input.close();
 
-	return std::move(m_ptr);
+	return m_ptr;
 }
 
-template <typename Scalar, int RowsAtCompileTime, int ColsAtCompileTime>
-void save_matrix(const std::string& filename, const Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime>& matrix)
+template <typename Scalar, int RowsAtCompileTime, int ColsAtCompileTime, int Options>
+void save_matrix(const std::string& filename, const Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime, Options>& matrix)
 {
-	using MatrixType = Eigen::Matrix<Scalar, RowsAtCompileTime, ColsAtCompileTime>;
-
-	std::ofstream output(filename);
+	std::ofstream output(filename, std::ios::binary);
 	if (output.fail()) {
 		throw std::runtime_error("Cannot open matrix file '" + filename + "' for writing.");
 	}
@@ -74,18 +105,70 @@ void save_matrix(const std::string& filename, const Eigen::Matrix<Scalar, RowsAt
 	if (!output)
 		throw std::runtime_error("Cannot write to matrix file.");
 
-	std::unique_ptr<MatrixType> m_ptr = std::unique_ptr<MatrixType>(new MatrixType(rows, cols));
+	write_matrix_data(output, matrix);
+
+	output.close();
+}
 
-	for (int row = 0; row < rows; row++) {
-		for (int col = 0; col < cols; col++) {
-			Scalar value = (*m_ptr)(row, col);
-			output.write(reinterpret_cast<char*>(&value), sizeof(Scalar));
-			/*if (!output)
-				throw std::runtime_error("Could not write data.");*/
+/// @brief A read-only view of a memory-mapped matrix file.
+///
+/// The entries are not copied, pages are loaded on demand by the operating system.
+template <typename Scalar>
+class MappedMatrix
+{
+public:
+	using MapType = Eigen::Map<const RowMajorMatrixType<Scalar>>;
+
+	explicit MappedMatrix(const std::string& filename)
+	: map_(nullptr, 0, 0)
+	{
+		try {
+			file_mapping_ = boost::interprocess::file_mapping(filename.c_str(), boost::interprocess::read_only);
+			mapped_region_ = boost::interprocess::mapped_region(file_mapping_, boost::interprocess::read_only);
+		}
+		catch (const boost::interprocess::interprocess_exception& err) {
+			throw std::runtime_error("Cannot map matrix file '" + filename + "': " + err.what());
 		}
+		const char* ptr = static_cast<const char*>(mapped_region_.get_address());
+		std::size_t size = mapped_region_.get_size();
+		if (size < 2 * sizeof(int))
+			throw std::runtime_error("Invalid matrix input file. Number of rows or columns is not specified.");
+		int rows = *reinterpret_cast<const int*>(ptr);
+		int cols = *reinterpret_cast<const int*>(ptr + sizeof(int));
+		if (rows < 0 || cols < 0 || size < 2 * sizeof(int) + static_cast<std::size_t>(rows) * cols * sizeof(Scalar))
+			throw std::runtime_error("Invalid matrix input file. File is too small for the specified dimensions.");
+		// Re-initialize the map in place (Eigen::Map cannot be assigned).
+		new (&map_) MapType(reinterpret_cast<const Scalar*>(ptr + 2 * sizeof(int)), rows, cols);
 	}
 
-	output.close();
+	MappedMatrix(const MappedMatrix&) = delete;
+	MappedMatrix& operator=(const MappedMatrix&) = delete;
+
+	const MapType& get_map() const
+	{
+		return map_;
+	}
+
+	typename MapType::Index rows() const
+	{
+		return map_.rows();
+	}
+
+	typename MapType::Index cols() const
+	{
+		return map_.cols();
+	}
+
+private:
+	boost::interprocess::file_mapping file_mapping_;
+	boost::interprocess::mapped_region mapped_region_;
+	MapType map_;
+};
+
+template <typename Scalar>
+std::unique_ptr<MappedMatrix<Scalar>> load_mapped_matrix(const std::string& filename)
+{
+	return std::unique_ptr<MappedMatrix<Scalar>>(new MappedMatrix<Scalar>(filename));
 }
 
 }
@@ -8,8 +8,273 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <exception>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if AIT_MULTI_THREADING
+#include <thread>
+#endif
+
 namespace ait {
 
+/// @brief How the leaf posteriors of the trees are combined into the forest posteriors.
+enum class PosteriorAggregation
+{
+	// Mean of the leaf posteriors (sum-voting).
+	SUM,
+	// Normalized product of the leaf posteriors (product of experts), accumulated as a sum of log-probabilities.
+	PRODUCT,
+};
+
+/// @brief Smallest leaf probability used in products so that a single empty histogram bin does not veto a class.
+static const float MIN_LEAF_PROBABILITY = 1e-6f;
+
+inline float compute_leaf_log_probability(size_type count, size_type total)
+{
+	return std::log(std::max(count / static_cast<float>(total), MIN_LEAF_PROBABILITY));
+}
+
+/// @brief Add the (log-)posteriors of a leaf to the accumulated posteriors of a sample.
+///        The arrays are mapped to Eigen arrays so that the sum is vectorized.
+inline void add_leaf_posteriors(const float* leaf_posteriors, float* posteriors, size_type num_of_classes)
+{
+	Eigen::Map<Eigen::ArrayXf>(posteriors, num_of_classes) += Eigen::Map<const Eigen::ArrayXf>(leaf_posteriors, num_of_classes);
+}
+
+/// @brief Turn accumulated (log-)posteriors of num_of_trees leafs into normalized forest posteriors.
+inline void normalize_accumulated_posteriors(float* posteriors, size_type num_of_classes, size_type num_of_trees, PosteriorAggregation aggregation)
+{
+	Eigen::Map<Eigen::ArrayXf> posterior_array(posteriors, num_of_classes);
+	if (aggregation == PosteriorAggregation::PRODUCT) {
+		// Subtract the largest log-probability before exponentiating to avoid underflow.
+		posterior_array = (posterior_array - posterior_array.maxCoeff()).exp();
+		posterior_array /= posterior_array.sum();
+	}
+	else if (num_of_trees > 0) {
+		posterior_array /= static_cast<float>(num_of_trees);
+	}
+}
+
+/// @brief Entropy of normalized posteriors divided by its maximum log(num_of_classes), i.e. a value in [0, 1].
+inline scalar_type compute_normalized_entropy(const float* posteriors, size_type num_of_classes)
+{
+	if (num_of_classes < 2) {
+		return 0;
+	}
+	scalar_type entropy = 0;
+	for (size_type i = 0; i < num_of_classes; ++i) {
+		if (posteriors[i] > 0) {
+			entropy -= posteriors[i] * std::log(static_cast<scalar_type>(posteriors[i]));
+		}
+	}
+	return entropy / std::log(static_cast<scalar_type>(num_of_classes));
+}
+
+/// @brief Caller-provided scratch memory for the forest posteriors of a block of samples.
+///        Each thread needs its own buffer. It is allocated once and reused for all blocks.
+class PosteriorBuffer
+{
+	size_type num_of_classes_;
+	size_type block_size_;
+	std::vector<float> posteriors_;
+	size_type num_of_evaluated_trees_;
+
+public:
+	static const size_type DEFAULT_BLOCK_SIZE = 64;
+
+	PosteriorBuffer(size_type num_of_classes, size_type block_size = DEFAULT_BLOCK_SIZE)
+		: num_of_classes_(num_of_classes), block_size_(block_size), posteriors_(num_of_classes * block_size, 0.0f),
+		num_of_evaluated_trees_(0)
+	{
+	}
+
+	size_type num_of_classes() const
+	{
+		return num_of_classes_;
+	}
+
+	size_type block_size() const
+	{
+		return block_size_;
+	}
+
+	/// @brief Posteriors of the i-th sample of the current block (num_of_classes values).
+	float* get_posteriors(size_type i)
+	{
+		return &posteriors_[i * num_of_classes_];
+	}
+
+	const float* get_posteriors(size_type i) const
+	{
+		return &posteriors_[i * num_of_classes_];
+	}
+
+	void clear(size_type num_of_samples)
+	{
+		std::fill(posteriors_.begin(), posteriors_.begin() + num_of_samples * num_of_classes_, 0.0f);
+	}
+
+	/// @brief Number of tree evaluations of all samples computed with this buffer.
+	size_type num_of_evaluated_trees() const
+	{
+		return num_of_evaluated_trees_;
+	}
+
+	void add_evaluated_trees(size_type num_of_trees)
+	{
+		num_of_evaluated_trees_ += num_of_trees;
+	}
+
+	void reset_evaluated_trees()
+	{
+		num_of_evaluated_trees_ = 0;
+	}
+
+	/// @brief Return the class with the largest posterior.
+	static size_type get_max_class(const float* posteriors, size_type num_of_classes)
+	{
+		return std::max_element(posteriors, posteriors + num_of_classes) - posteriors;
+	}
+};
+
+/// @brief Evaluation metrics of a forest that are accumulated in a single pass over the samples of each frame:
+///        the accuracy of each tree, the confusion matrix of all samples and the per-frame confusion matrix.
+class ForestEvaluation {
+public:
+	using CountMatrixType = Eigen::Matrix<int_type, Eigen::Dynamic, Eigen::Dynamic>;
+
+	ForestEvaluation(size_type num_of_classes, size_type num_of_trees)
+		: num_of_classes_(num_of_classes), num_of_samples_(0), num_of_frames_(0),
+		tree_matches_(num_of_trees, 0), tree_votes_(num_of_trees, 0), class_counts_(num_of_classes, 0),
+		confusion_matrix_(CountMatrixType::Zero(num_of_classes, num_of_classes)),
+		per_frame_confusion_matrix_(CountMatrixType::Zero(num_of_classes, num_of_classes)),
+		frame_true_counts_(num_of_classes, 0), frame_vote_counts_(num_of_classes, 0)
+	{
+	}
+
+	void begin_frame()
+	{
+		std::fill(frame_true_counts_.begin(), frame_true_counts_.end(), 0);
+		std::fill(frame_vote_counts_.begin(), frame_vote_counts_.end(), 0);
+	}
+
+	/// @brief Add the vote of a single tree for a sample.
+	void add_tree_vote(size_type tree_index, size_type true_label, size_type tree_label)
+	{
+		if (tree_label == true_label) {
+			++tree_matches_[tree_index];
+		}
+		++tree_votes_[tree_index];
+		++frame_vote_counts_[tree_label];
+	}
+
+	/// @brief Add the prediction of the forest for a sample.
+	void add_sample(size_type true_label, size_type predicted_label)
+	{
+		++num_of_samples_;
+		++class_counts_[true_label];
+		++frame_true_counts_[true_label];
+		++confusion_matrix_(true_label, predicted_label);
+	}
+
+	/// @brief Compare the majority label of the frame with the majority of all tree votes (see ForestUtilities::update_confusion_matrix).
+	void end_frame()
+	{
+		size_type true_label = std::max_element(frame_true_counts_.cbegin(), frame_true_counts_.cend()) - frame_true_counts_.cbegin();
+		size_type predicted_label = std::max_element(frame_vote_counts_.cbegin(), frame_vote_counts_.cend()) - frame_vote_counts_.cbegin();
+		++per_frame_confusion_matrix_(true_label, predicted_label);
+		++num_of_frames_;
+	}
+
+	/// @brief Add the metrics of another evaluation (i.e. of another thread).
+	void merge(const ForestEvaluation& other)
+	{
+		num_of_samples_ += other.num_of_samples_;
+		num_of_frames_ += other.num_of_frames_;
+		for (size_type i = 0; i < static_cast<size_type>(tree_matches_.size()); ++i) {
+			tree_matches_[i] += other.tree_matches_[i];
+			tree_votes_[i] += other.tree_votes_[i];
+		}
+		for (size_type i = 0; i < num_of_classes_; ++i) {
+			class_counts_[i] += other.class_counts_[i];
+		}
+		confusion_matrix_ += other.confusion_matrix_;
+		per_frame_confusion_matrix_ += other.per_frame_confusion_matrix_;
+	}
+
+	size_type num_of_samples() const
+	{
+		return num_of_samples_;
+	}
+
+	size_type num_of_frames() const
+	{
+		return num_of_frames_;
+	}
+
+	size_type num_of_trees() const
+	{
+		return tree_matches_.size();
+	}
+
+	/// @brief Number of samples whose label is predicted correctly by the given tree alone.
+	size_type num_of_tree_matches(size_type tree_index) const
+	{
+		return tree_matches_[tree_index];
+	}
+
+	/// @brief Number of samples that the given tree was evaluated on (less than num_of_samples() with early exit).
+	size_type num_of_tree_votes(size_type tree_index) const
+	{
+		return tree_votes_[tree_index];
+	}
+
+	/// @brief Average number of trees that were evaluated per sample.
+	scalar_type get_average_num_of_evaluated_trees() const
+	{
+		if (num_of_samples_ == 0) {
+			return 0;
+		}
+		return std::accumulate(tree_votes_.cbegin(), tree_votes_.cend(), size_type(0)) / static_cast<scalar_type>(num_of_samples_);
+	}
+
+	const std::vector<size_type>& get_class_counts() const
+	{
+		return class_counts_;
+	}
+
+	template <typename TMatrix = Eigen::MatrixXd>
+	TMatrix get_confusion_matrix() const
+	{
+		return confusion_matrix_.cast<typename TMatrix::Scalar>();
+	}
+
+	template <typename TMatrix = Eigen::MatrixXd>
+	TMatrix get_per_frame_confusion_matrix() const
+	{
+		return per_frame_confusion_matrix_.cast<typename TMatrix::Scalar>();
+	}
+
+private:
+	size_type num_of_classes_;
+	size_type num_of_samples_;
+	size_type num_of_frames_;
+	std::vector<size_type> tree_matches_;
+	std::vector<size_type> tree_votes_;
+	std::vector<size_type> class_counts_;
+	CountMatrixType confusion_matrix_;
+	CountMatrixType per_frame_confusion_matrix_;
+	std::vector<size_type> frame_true_counts_;
+	std::vector<size_type> frame_vote_counts_;
+};
+
 class EvaluationUtils {
 public:
 	EvaluationUtils() = delete;
@@ -72,6 +337,157 @@ public:
 		return update_confusion_matrix(confusion_matrix, true_label, predicted_label);
 	}
 
+	/// @brief Integer matrix that each thread counts its predictions in before they are reduced.
+	using CountMatrixType = Eigen::Matrix<int_type, Eigen::Dynamic, Eigen::Dynamic>;
+
+	/// @brief Number of samples that a thread takes at a time in compute_confusion_matrix_parallel.
+	static const size_type PARALLEL_SAMPLE_CHUNK_SIZE = 4096;
+
+	/// @brief Call func(thread_index) on num_of_threads threads (or once without multi-threading)
+	///        and rethrow the first exception of any thread.
+	template <typename TFunction>
+	static void run_parallel(int_type num_of_threads, TFunction func)
+	{
+#if AIT_MULTI_THREADING
+		std::vector<std::exception_ptr> errors(num_of_threads);
+		std::vector<std::thread> threads;
+		for (int_type thread_index = 0; thread_index < num_of_threads; ++thread_index) {
+			threads.push_back(std::thread([&, thread_index] () {
+				try {
+					func(thread_index);
+				}
+				catch (...) {
+					errors[thread_index] = std::current_exception();
+				}
+			}));
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		for (const std::exception_ptr& error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+#else
+		func(0);
+#endif
+	}
+
+	static int_type get_num_of_threads(int_type num_of_threads, size_type num_of_work_items)
+	{
+#if AIT_MULTI_THREADING
+		if (num_of_threads <= 0) {
+			num_of_threads = std::thread::hardware_concurrency();
+		}
+		return std::max<int_type>(1, std::min<int_type>(num_of_threads, num_of_work_items));
+#else
+		return 1;
+#endif
+	}
+
+	/// @brief Compute the confusion matrix of the samples on multiple threads.
+	///
+	/// Each thread takes chunks of samples and counts its predictions in its own integer matrix.
+	/// The matrices are summed up at the end, so the result does not depend on the number of threads.
+	template <typename TForestUtils, typename TSampleIterator>
+	static typename TForestUtils::MatrixType compute_confusion_matrix_parallel(const TForestUtils& forest_utils,
+		const TSampleIterator& samples_start, const TSampleIterator& samples_end, int_type num_of_threads = -1)
+	{
+		size_type num_of_samples = samples_end - samples_start;
+		size_type num_of_chunks = (num_of_samples + PARALLEL_SAMPLE_CHUNK_SIZE - 1) / PARALLEL_SAMPLE_CHUNK_SIZE;
+		num_of_threads = get_num_of_threads(num_of_threads, num_of_chunks);
+		std::vector<CountMatrixType> thread_matrices(num_of_threads, CountMatrixType::Zero(forest_utils.num_of_classes(), forest_utils.num_of_classes()));
+		std::atomic<size_type> next_chunk(0);
+		run_parallel(num_of_threads, [&] (int_type thread_index) {
+			for (size_type chunk = next_chunk++; chunk < num_of_chunks; chunk = next_chunk++) {
+				TSampleIterator chunk_start = samples_start + chunk * PARALLEL_SAMPLE_CHUNK_SIZE;
+				TSampleIterator chunk_end = samples_start + std::min(num_of_samples, (chunk + 1) * PARALLEL_SAMPLE_CHUNK_SIZE);
+				forest_utils.accumulate_confusion_matrix(thread_matrices[thread_index], chunk_start, chunk_end);
+			}
+		});
+		return reduce_count_matrices<typename TForestUtils::MatrixType>(thread_matrices, forest_utils.num_of_classes());
+	}
+
+	/// @brief Compute the per-frame confusion matrix (see ForestUtilities::update_confusion_matrix) of all images
+	///        of a sample provider on multiple threads.
+	///
+	/// Each thread loads frames into its own copy of the sample provider. The random engine of each frame is
+	/// seeded in frame order, so the result does not depend on the number of threads.
+	template <typename TForestUtils, typename TSampleProvider, typename TRandomEngine>
+	static typename TForestUtils::MatrixType compute_per_frame_confusion_matrix_parallel(const TForestUtils& forest_utils,
+		const TSampleProvider& sample_provider, TRandomEngine& rnd_engine, int_type num_of_threads = -1)
+	{
+		size_type num_of_images = sample_provider.num_of_images();
+		std::vector<typename TRandomEngine::result_type> seeds(num_of_images);
+		for (size_type i = 0; i < num_of_images; ++i) {
+			seeds[i] = rnd_engine();
+		}
+		num_of_threads = get_num_of_threads(num_of_threads, num_of_images);
+		std::vector<CountMatrixType> thread_matrices(num_of_threads, CountMatrixType::Zero(forest_utils.num_of_classes(), forest_utils.num_of_classes()));
+		std::atomic<size_type> next_image(0);
+		run_parallel(num_of_threads, [&] (int_type thread_index) {
+			TSampleProvider thread_sample_provider(sample_provider);
+			thread_sample_provider.clear_samples();
+			thread_sample_provider.clear_image_cache();
+			for (size_type i = next_image++; i < num_of_images; i = next_image++) {
+				TRandomEngine frame_rnd_engine(seeds[i]);
+				thread_sample_provider.load_samples_from_image(i, frame_rnd_engine);
+				forest_utils.update_confusion_matrix(thread_matrices[thread_index],
+					thread_sample_provider.get_samples_begin(), thread_sample_provider.get_samples_end());
+				thread_sample_provider.clear_samples();
+				thread_sample_provider.clear_image_cache();
+			}
+		});
+		return reduce_count_matrices<typename TForestUtils::MatrixType>(thread_matrices, forest_utils.num_of_classes());
+	}
+
+	/// @brief Evaluate a forest on all pixels of all images of a sample provider in a single pass.
+	///
+	/// Each frame is loaded once and every tree is traversed once per pixel (see evaluate_frame of
+	/// ForestUtilities and MappedForestUtilities). The frames are distributed over the threads.
+	template <typename TForestUtils, typename TSampleProvider, typename TRandomEngine>
+	static ForestEvaluation evaluate_frames_parallel(const TForestUtils& forest_utils,
+		const TSampleProvider& sample_provider, TRandomEngine& rnd_engine, int_type num_of_threads = -1)
+	{
+		size_type num_of_images = sample_provider.num_of_images();
+		std::vector<typename TRandomEngine::result_type> seeds(num_of_images);
+		for (size_type i = 0; i < num_of_images; ++i) {
+			seeds[i] = rnd_engine();
+		}
+		num_of_threads = get_num_of_threads(num_of_threads, num_of_images);
+		std::vector<ForestEvaluation> thread_evaluations(num_of_threads, ForestEvaluation(forest_utils.num_of_classes(), forest_utils.num_of_trees()));
+		std::atomic<size_type> next_image(0);
+		run_parallel(num_of_threads, [&] (int_type thread_index) {
+			TSampleProvider thread_sample_provider(sample_provider);
+			thread_sample_provider.clear_samples();
+			thread_sample_provider.clear_image_cache();
+			PosteriorBuffer buffer(forest_utils.num_of_classes());
+			for (size_type i = next_image++; i < num_of_images; i = next_image++) {
+				TRandomEngine frame_rnd_engine(seeds[i]);
+				thread_sample_provider.load_samples_from_image(i, frame_rnd_engine);
+				forest_utils.evaluate_frame(thread_sample_provider.get_samples_begin(), thread_sample_provider.get_samples_end(),
+					thread_evaluations[thread_index], buffer);
+				thread_sample_provider.clear_samples();
+				thread_sample_provider.clear_image_cache();
+			}
+		});
+		for (size_type i = 1; i < static_cast<size_type>(thread_evaluations.size()); ++i) {
+			thread_evaluations.front().merge(thread_evaluations[i]);
+		}
+		return thread_evaluations.front();
+	}
+
+	template <typename TMatrix>
+	static TMatrix reduce_count_matrices(const std::vector<CountMatrixType>& count_matrices, size_type num_of_classes)
+	{
+		CountMatrixType count_matrix = CountMatrixType::Zero(num_of_classes, num_of_classes);
+		for (const CountMatrixType& thread_matrix : count_matrices) {
+			count_matrix += thread_matrix;
+		}
+		return count_matrix.template cast<typename TMatrix::Scalar>();
+	}
+
 	template <typename TMatrix>
     static TMatrix normalize_confusion_matrix(const TMatrix& confusion_matrix)
     {
@@ -126,21 +542,30 @@ public:
         return summed_statistics;
 	}
 
+	/// @brief Compute the logarithm of the product of the normalized leaf histograms of all samples.
+	///        The product is accumulated in log space so that it cannot overflow.
 	template <typename TSampleIterator>
-	TStatistics compute_multiplied_statistics(const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+	std::vector<scalar_type> compute_multiplied_log_posteriors(const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
 	{
-		TStatistics multiplied_statistics(num_of_classes_);
-		for (size_type i = 0; i < num_of_classes_; ++i) {
-			multiplied_statistics.get_histogram()[i] = 1;
-		}
+		std::vector<scalar_type> log_posteriors(num_of_classes_, 0);
         for (TSampleIterator sample_it = samples_start; sample_it != samples_end; ++sample_it) {
 			const TStatistics& node_statistics = compute_statistics(*sample_it);
 			assert(num_of_classes_ == node_statistics.num_of_bins());
-			for (size_type i = 0; i < num_of_classes_; ++i) {
-				multiplied_statistics.get_histogram()[i] *= node_statistics.get_histogram()[i];
+			add_log_posteriors(node_statistics, log_posteriors);
+		}
+		return log_posteriors;
+	}
+
+	/// @brief Add the log-probabilities of a normalized histogram.
+	static void add_log_posteriors(const TStatistics& statistics, std::vector<scalar_type>& log_posteriors)
+	{
+		const auto& histogram = statistics.get_histogram();
+		size_type total = std::accumulate(histogram.cbegin(), histogram.cend(), size_type(0));
+		if (total > 0) {
+			for (size_type i = 0; i < static_cast<size_type>(log_posteriors.size()); ++i) {
+				log_posteriors[i] += compute_leaf_log_probability(histogram[i], total);
 			}
 		}
-		return multiplied_statistics;
 	}
 
 	template <typename TSampleIterator>
@@ -185,18 +610,345 @@ class ForestUtilities
 	const ForestType& forest_;
 	std::vector<TreeUtilities<TSplitPoint, TStatistics, TMatrix>> tree_utils_vector_;
     size_type num_of_classes_;
+	PosteriorAggregation aggregation_;
+	// Normalized histograms (or their logarithms for PosteriorAggregation::PRODUCT) of all nodes,
+	// indexed by tree and then by node_index * num_of_classes_ + class.
+	std::vector<std::vector<float>> node_posteriors_;
+	// Class with the largest histogram bin of all nodes, indexed by tree and node.
+	std::vector<std::vector<label_type>> node_labels_;
+	// Trees ordered by decreasing training accuracy of their leafs (evaluation order for early exit).
+	std::vector<size_type> tree_order_;
+	bool early_exit_;
+	scalar_type early_exit_confidence_;
+
+	/// @brief Fraction of the training samples of a tree that its leafs classify correctly.
+	static scalar_type compute_leaf_accuracy(const typename ForestType::TreeT& tree)
+	{
+		size_type num_of_correct_samples = 0;
+		size_type num_of_samples = 0;
+		std::vector<size_type> node_stack(1, 0);
+		while (!node_stack.empty()) {
+			size_type node_index = node_stack.back();
+			node_stack.pop_back();
+			if (tree.get_node(node_index).is_leaf) {
+				const std::vector<size_type>& histogram = tree.get_node(node_index).node.get_statistics().get_histogram();
+				num_of_correct_samples += *std::max_element(histogram.cbegin(), histogram.cend());
+				num_of_samples += std::accumulate(histogram.cbegin(), histogram.cend(), size_type(0));
+			}
+			else {
+				node_stack.push_back(2 * node_index + 1);
+				node_stack.push_back(2 * node_index + 2);
+			}
+		}
+		return num_of_samples > 0 ? num_of_correct_samples / static_cast<scalar_type>(num_of_samples) : 0;
+	}
+
+	void compute_tree_order()
+	{
+		std::vector<scalar_type> leaf_accuracies;
+		for (auto tree_it = forest_.cbegin(); tree_it != forest_.cend(); ++tree_it) {
+			leaf_accuracies.push_back(compute_leaf_accuracy(*tree_it));
+		}
+		tree_order_.resize(forest_.size());
+		std::iota(tree_order_.begin(), tree_order_.end(), 0);
+		std::stable_sort(tree_order_.begin(), tree_order_.end(), [&leaf_accuracies] (size_type a, size_type b) {
+			return leaf_accuracies[a] > leaf_accuracies[b];
+		});
+	}
+
+	/// @brief Return whether the remaining trees can no longer change the predicted class
+	///        or the leading class already reaches the early exit confidence.
+	bool can_exit_early(const float* posteriors, size_type num_of_evaluated_trees) const
+	{
+		size_type num_of_remaining_trees = forest_.size() - num_of_evaluated_trees;
+		if (num_of_remaining_trees == 0) {
+			return true;
+		}
+		size_type max_class = PosteriorBuffer::get_max_class(posteriors, num_of_classes_);
+		float runner_up = -std::numeric_limits<float>::infinity();
+		for (size_type i = 0; i < num_of_classes_; ++i) {
+			if (i != max_class) {
+				runner_up = std::max(runner_up, posteriors[i]);
+			}
+		}
+		// Each tree can shift the difference of two classes by at most this amount.
+		const float max_tree_margin = aggregation_ == PosteriorAggregation::PRODUCT ? -std::log(MIN_LEAF_PROBABILITY) : 1.0f;
+		if (posteriors[max_class] - runner_up > num_of_remaining_trees * max_tree_margin) {
+			return true;
+		}
+		if (early_exit_confidence_ < 1) {
+			scalar_type confidence;
+			if (aggregation_ == PosteriorAggregation::PRODUCT) {
+				scalar_type normalization = 0;
+				for (size_type i = 0; i < num_of_classes_; ++i) {
+					normalization += std::exp(posteriors[i] - posteriors[max_class]);
+				}
+				confidence = 1 / normalization;
+			}
+			else {
+				confidence = posteriors[max_class] / num_of_evaluated_trees;
+			}
+			return confidence >= early_exit_confidence_;
+		}
+		return false;
+	}
+
+	/// @brief Evaluate the trees of a sample in tree_order_ until can_exit_early returns true.
+	///        The votes are added to the evaluation (if any) with the tree indices shifted by tree_offset.
+	/// @return The number of evaluated trees.
+	template <typename TSample>
+	size_type compute_posteriors_early_exit(const TSample& sample, float* posteriors, ForestEvaluation* evaluation, size_type tree_offset = 0) const
+	{
+		std::fill(posteriors, posteriors + num_of_classes_, 0.0f);
+		size_type num_of_evaluated_trees = 0;
+		while (num_of_evaluated_trees < forest_.size()) {
+			size_type tree_index = tree_order_[num_of_evaluated_trees];
+			size_type node_index = forest_.get_tree(tree_index).evaluate_to_iterator(sample).get_node_index();
+			if (evaluation != nullptr) {
+				evaluation->add_tree_vote(tree_offset + tree_index, sample.get_label(), node_labels_[tree_index][node_index]);
+			}
+			add_leaf_posteriors(&node_posteriors_[tree_index][node_index * num_of_classes_], posteriors, num_of_classes_);
+			++num_of_evaluated_trees;
+			if (can_exit_early(posteriors, num_of_evaluated_trees)) {
+				break;
+			}
+		}
+		normalize_accumulated_posteriors(posteriors, num_of_classes_, num_of_evaluated_trees, aggregation_);
+		return num_of_evaluated_trees;
+	}
+
+	void compute_node_posteriors()
+	{
+		for (auto tree_it = forest_.cbegin(); tree_it != forest_.cend(); ++tree_it) {
+			std::vector<float> tree_posteriors(tree_it->size() * num_of_classes_, 0.0f);
+			std::vector<label_type> tree_labels(tree_it->size(), 0);
+			for (size_type node_index = 0; node_index < tree_it->size(); ++node_index) {
+				const std::vector<size_type>& histogram = tree_it->get_node(node_index).node.get_statistics().get_histogram();
+				tree_labels[node_index] = std::max_element(histogram.cbegin(), histogram.cend()) - histogram.cbegin();
+				size_type total = std::accumulate(histogram.cbegin(), histogram.cend(), size_type(0));
+				if (total > 0) {
+					for (size_type i = 0; i < num_of_classes_; ++i) {
+						tree_posteriors[node_index * num_of_classes_ + i] = aggregation_ == PosteriorAggregation::PRODUCT
+							? compute_leaf_log_probability(histogram[i], total)
+							: histogram[i] / static_cast<float>(total);
+					}
+				}
+			}
+			node_posteriors_.push_back(std::move(tree_posteriors));
+			node_labels_.push_back(std::move(tree_labels));
+		}
+	}
 
 public:
 	using MatrixType = TMatrix;
 
-	ForestUtilities(const ForestType& forest)
-		: forest_(forest)
+	ForestUtilities(const ForestType& forest, PosteriorAggregation aggregation = PosteriorAggregation::SUM)
+		: forest_(forest), aggregation_(aggregation), early_exit_(false), early_exit_confidence_(1)
     {
         num_of_classes_ = forest_.cbegin()->get_root_iterator()->get_statistics().num_of_bins();
 		for (auto tree_it = forest_.cbegin(); tree_it != forest_.cend(); ++tree_it) {
 			TreeUtilities<TSplitPoint, TStatistics, TMatrix> tree_utils = TreeUtilities<TSplitPoint, TStatistics, TMatrix>(*tree_it);
 			tree_utils_vector_.push_back(tree_utils);
 		}
+		compute_node_posteriors();
+		compute_tree_order();
+	}
+
+	/// @brief Evaluate the trees of each sample only until the predicted class is decided.
+	///
+	/// The trees are evaluated in order of their training accuracy. Evaluation stops as soon as the remaining
+	/// trees cannot overturn the leading class, so the predicted labels stay the same. With a confidence below 1,
+	/// evaluation also stops once the posterior of the leading class reaches the confidence.
+	/// The posteriors are computed from the evaluated trees only.
+	/// A confidence below 1 has to be larger than 1 / num_of_classes, otherwise every pixel would stop after the first tree.
+	void enable_early_exit(scalar_type confidence = 1)
+	{
+		if (!(confidence <= 1) || (confidence < 1 && confidence <= 1.0 / num_of_classes_)) {
+			throw std::runtime_error("The early exit confidence must be within (1/" + std::to_string(num_of_classes_) + ", 1].");
+		}
+		early_exit_ = true;
+		early_exit_confidence_ = confidence;
+	}
+
+	void disable_early_exit()
+	{
+		early_exit_ = false;
+	}
+
+	bool is_early_exit_enabled() const
+	{
+		return early_exit_;
+	}
+
+	size_type num_of_classes() const
+	{
+		return num_of_classes_;
+	}
+
+	size_type num_of_trees() const
+	{
+		return forest_.size();
+	}
+
+	PosteriorAggregation aggregation() const
+	{
+		return aggregation_;
+	}
+
+	PosteriorBuffer make_posterior_buffer(size_type block_size = PosteriorBuffer::DEFAULT_BLOCK_SIZE) const
+	{
+		return PosteriorBuffer(num_of_classes_, block_size);
+	}
+
+	/// @brief Compute the forest posteriors of a sample, i.e. the mean (or the normalized product) of the
+	///        normalized leaf histograms of all trees.
+	/// @param posteriors Output array with num_of_classes values.
+	/// @return The number of evaluated trees.
+	template <typename TSample>
+	size_type compute_posteriors(const TSample& sample, float* posteriors) const
+	{
+		if (early_exit_) {
+			return compute_posteriors_early_exit(sample, posteriors, nullptr);
+		}
+		std::fill(posteriors, posteriors + num_of_classes_, 0.0f);
+		for (size_type tree_index = 0; tree_index < forest_.size(); ++tree_index) {
+			size_type node_index = forest_.get_tree(tree_index).evaluate_to_iterator(sample).get_node_index();
+			add_leaf_posteriors(&node_posteriors_[tree_index][node_index * num_of_classes_], posteriors, num_of_classes_);
+		}
+		normalize_accumulated_posteriors(posteriors, num_of_classes_, forest_.size(), aggregation_);
+		return forest_.size();
+	}
+
+	/// @brief Compute the forest posteriors of a sample and add the votes of the evaluated trees to an evaluation.
+	///        The tree indices of the votes are shifted by tree_offset (see CascadeForestUtilities).
+	/// @return The number of evaluated trees.
+	template <typename TSample>
+	size_type evaluate_sample(const TSample& sample, float* posteriors, ForestEvaluation& evaluation, size_type tree_offset = 0) const
+	{
+		if (early_exit_) {
+			return compute_posteriors_early_exit(sample, posteriors, &evaluation, tree_offset);
+		}
+		std::fill(posteriors, posteriors + num_of_classes_, 0.0f);
+		for (size_type tree_index = 0; tree_index < forest_.size(); ++tree_index) {
+			size_type node_index = forest_.get_tree(tree_index).evaluate_to_iterator(sample).get_node_index();
+			evaluation.add_tree_vote(tree_offset + tree_index, sample.get_label(), node_labels_[tree_index][node_index]);
+			add_leaf_posteriors(&node_posteriors_[tree_index][node_index * num_of_classes_], posteriors, num_of_classes_);
+		}
+		normalize_accumulated_posteriors(posteriors, num_of_classes_, forest_.size(), aggregation_);
+		return forest_.size();
+	}
+
+	/// @brief Compute the forest posteriors of a block of at most buffer.block_size() samples.
+	///        The trees are evaluated one after the other on the whole block so that each tree stays in the cache.
+	template <typename TSampleIterator>
+	void compute_posteriors(const TSampleIterator& block_start, const TSampleIterator& block_end, PosteriorBuffer& buffer) const
+	{
+		size_type num_of_samples = std::distance(block_start, block_end);
+		if (num_of_samples > buffer.block_size() || buffer.num_of_classes() != num_of_classes_) {
+			throw std::runtime_error("The posterior buffer does not fit the sample block.");
+		}
+		if (early_exit_) {
+			size_type i = 0;
+			for (TSampleIterator sample_it = block_start; sample_it != block_end; ++sample_it, ++i) {
+				buffer.add_evaluated_trees(compute_posteriors_early_exit(*sample_it, buffer.get_posteriors(i), nullptr));
+			}
+			return;
+		}
+		buffer.clear(num_of_samples);
+		buffer.add_evaluated_trees(num_of_samples * forest_.size());
+		for (size_type tree_index = 0; tree_index < forest_.size(); ++tree_index) {
+			const typename ForestType::TreeT& tree = forest_.get_tree(tree_index);
+			const float* tree_posteriors = node_posteriors_[tree_index].data();
+			size_type i = 0;
+			for (TSampleIterator sample_it = block_start; sample_it != block_end; ++sample_it, ++i) {
+				const float* node_posteriors = tree_posteriors + tree.evaluate_to_iterator(*sample_it).get_node_index() * num_of_classes_;
+				add_leaf_posteriors(node_posteriors, buffer.get_posteriors(i), num_of_classes_);
+			}
+		}
+		for (size_type i = 0; i < num_of_samples; ++i) {
+			normalize_accumulated_posteriors(buffer.get_posteriors(i), num_of_classes_, forest_.size(), aggregation_);
+		}
+	}
+
+	/// @brief Compute the forest posteriors of all samples block by block and call func(sample, posteriors) for each sample.
+	template <typename TSampleIterator, typename TFunction>
+	void for_each_posteriors(const TSampleIterator& samples_start, const TSampleIterator& samples_end, PosteriorBuffer& buffer, TFunction func) const
+	{
+		TSampleIterator block_start = samples_start;
+		while (block_start != samples_end) {
+			TSampleIterator block_end = block_start;
+			for (size_type n = 0; n < buffer.block_size() && block_end != samples_end; ++n) {
+				++block_end;
+			}
+			compute_posteriors(block_start, block_end, buffer);
+			size_type i = 0;
+			for (TSampleIterator sample_it = block_start; sample_it != block_end; ++sample_it, ++i) {
+				func(*sample_it, buffer.get_posteriors(i));
+			}
+			block_start = block_end;
+		}
+	}
+
+	/// @brief Add all samples of a frame to an evaluation. Each tree is traversed once per sample
+	///        and its leaf provides both the vote of the tree and its share of the forest posteriors.
+	template <typename TSampleIterator>
+	void evaluate_frame(const TSampleIterator& samples_start, const TSampleIterator& samples_end, ForestEvaluation& evaluation, PosteriorBuffer& buffer) const
+	{
+		evaluation.begin_frame();
+		if (early_exit_) {
+			float* posteriors = buffer.get_posteriors(0);
+			for (TSampleIterator sample_it = samples_start; sample_it != samples_end; ++sample_it) {
+				compute_posteriors_early_exit(*sample_it, posteriors, &evaluation);
+				evaluation.add_sample(sample_it->get_label(), PosteriorBuffer::get_max_class(posteriors, num_of_classes_));
+			}
+			evaluation.end_frame();
+			return;
+		}
+		TSampleIterator block_start = samples_start;
+		while (block_start != samples_end) {
+			TSampleIterator block_end = block_start;
+			size_type num_of_samples = 0;
+			for (; num_of_samples < buffer.block_size() && block_end != samples_end; ++num_of_samples) {
+				++block_end;
+			}
+			buffer.clear(num_of_samples);
+			for (size_type tree_index = 0; tree_index < forest_.size(); ++tree_index) {
+				const typename ForestType::TreeT& tree = forest_.get_tree(tree_index);
+				const float* tree_posteriors = node_posteriors_[tree_index].data();
+				const label_type* tree_labels = node_labels_[tree_index].data();
+				size_type i = 0;
+				for (TSampleIterator sample_it = block_start; sample_it != block_end; ++sample_it, ++i) {
+					size_type node_index = tree.evaluate_to_iterator(*sample_it).get_node_index();
+					evaluation.add_tree_vote(tree_index, sample_it->get_label(), tree_labels[node_index]);
+					add_leaf_posteriors(tree_posteriors + node_index * num_of_classes_, buffer.get_posteriors(i), num_of_classes_);
+				}
+			}
+			size_type i = 0;
+			for (TSampleIterator sample_it = block_start; sample_it != block_end; ++sample_it, ++i) {
+				evaluation.add_sample(sample_it->get_label(), PosteriorBuffer::get_max_class(buffer.get_posteriors(i), num_of_classes_));
+			}
+			block_start = block_end;
+		}
+		evaluation.end_frame();
+	}
+
+	template <typename TTMatrix, typename TSampleIterator>
+	TTMatrix& accumulate_confusion_matrix(TTMatrix& confusion_matrix, const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+	{
+		PosteriorBuffer buffer = make_posterior_buffer();
+		return accumulate_confusion_matrix(confusion_matrix, samples_start, samples_end, buffer);
+	}
+
+	/// @brief Add the predictions of all samples to a confusion matrix without allocating memory per sample.
+	template <typename TTMatrix, typename TSampleIterator>
+	TTMatrix& accumulate_confusion_matrix(TTMatrix& confusion_matrix, const TSampleIterator& samples_start, const TSampleIterator& samples_end, PosteriorBuffer& buffer) const
+	{
+		for_each_posteriors(samples_start, samples_end, buffer, [&] (const typename std::iterator_traits<TSampleIterator>::value_type& sample, const float* posteriors) {
+			size_type true_label = sample.get_label();
+			size_type predicted_label = PosteriorBuffer::get_max_class(posteriors, num_of_classes_);
+			EvaluationUtils::update_confusion_matrix(confusion_matrix, true_label, predicted_label);
+		});
+		return confusion_matrix;
 	}
 
 	template <typename TSample>
@@ -213,21 +965,18 @@ public:
 		return summed_statistics;
 	}
 
+	/// @brief Compute the logarithm of the product of the normalized leaf histograms of all trees
+	///        (see compute_posteriors with PosteriorAggregation::PRODUCT for the normalized posteriors).
 	template <typename TSample>
-	const TStatistics& compute_multiplied_statistics(const TSample& sample) const
+	std::vector<scalar_type> compute_multiplied_log_posteriors(const TSample& sample) const
 	{
-		TStatistics multiplied_statistics(num_of_classes_);
-		for (size_type i = 0; i < num_of_classes_; ++i) {
-			multiplied_statistics.get_histogram()[i] = 1;
-		}
+		std::vector<scalar_type> log_posteriors(num_of_classes_, 0);
 		for (auto tree_utils_it = tree_utils_vector_.cbegin(); tree_utils_it != tree_utils_vector_.cend(); ++tree_utils_it) {
 			const TStatistics& tree_statistics = tree_utils_it->compute_statistics(sample);
 			assert(num_of_classes_ == tree_statistics.num_of_bins());
-			for (size_type i = 0; i < num_of_classes_; ++i) {
-				multiplied_statistics.get_histogram()[i] *= tree_statistics.get_histogram()[i];
-			}
+			TreeUtilities<TSplitPoint, TStatistics, TMatrix>::add_log_posteriors(tree_statistics, log_posteriors);
 		}
-		return multiplied_statistics;
+		return log_posteriors;
 	}
 
 	template <typename TSampleIterator>
@@ -245,20 +994,16 @@ public:
 	}
 
 	template <typename TSampleIterator>
-	TStatistics compute_multiplied_statistics(const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+	std::vector<scalar_type> compute_multiplied_log_posteriors(const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
 	{
-		TStatistics multiplied_statistics(num_of_classes_);
-		for (size_type i = 0; i < num_of_classes_; ++i) {
-			multiplied_statistics.get_histogram()[i] = 1;
-		}
+		std::vector<scalar_type> log_posteriors(num_of_classes_, 0);
 		for (auto tree_utils_it = tree_utils_vector_.cbegin(); tree_utils_it != tree_utils_vector_.cend(); ++tree_utils_it) {
-			const TStatistics& tree_statistics = tree_utils_it->compute_multiplied_statistics(samples_start, samples_end);
-			assert(num_of_classes_ == tree_statistics.num_of_bins());
+			std::vector<scalar_type> tree_log_posteriors = tree_utils_it->compute_multiplied_log_posteriors(samples_start, samples_end);
 			for (size_type i = 0; i < num_of_classes_; ++i) {
-				multiplied_statistics.get_histogram()[i] *= tree_statistics.get_histogram()[i];
+				log_posteriors[i] += tree_log_posteriors[i];
 			}
 		}
-		return multiplied_statistics;
+		return log_posteriors;
 	}
 
 	template <typename TSampleIterator>
@@ -266,8 +1011,313 @@ public:
 	{
 		TMatrix confusion_matrix(num_of_classes_, num_of_classes_);
         confusion_matrix.setZero();
+		PosteriorBuffer buffer = make_posterior_buffer();
+		return accumulate_confusion_matrix(confusion_matrix, samples_start, samples_end, buffer);
+	}
+
+	template <typename TTMatrix, typename TSample>
+	TTMatrix& update_confusion_matrix(TTMatrix& confusion_matrix, const TSample& sample) const
+    {
+		PosteriorBuffer buffer(num_of_classes_, 1);
+		return update_confusion_matrix(confusion_matrix, sample, buffer);
+	}
+
+	template <typename TTMatrix, typename TSample>
+	TTMatrix& update_confusion_matrix(TTMatrix& confusion_matrix, const TSample& sample, PosteriorBuffer& buffer) const
+    {
+        size_type true_label = sample.get_label();
+		compute_posteriors(sample, buffer.get_posteriors(0));
+		size_type predicted_label = PosteriorBuffer::get_max_class(buffer.get_posteriors(0), num_of_classes_);
+		return EvaluationUtils::update_confusion_matrix(confusion_matrix, true_label, predicted_label);
+	}
+
+	template <typename TTMatrix, typename TSampleIterator>
+    TTMatrix& update_confusion_matrix(TTMatrix& confusion_matrix, const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+    {
+        TStatistics true_statistics = EvaluationUtils::compute_true_statistics<TStatistics>(num_of_classes_, samples_start, samples_end);
+		const TStatistics& predicted_statistics = compute_summed_statistics(samples_start, samples_end);
+		return EvaluationUtils::update_confusion_matrix(confusion_matrix, true_statistics, predicted_statistics);
+	}
+};
+
+template <typename TSplitPoint, typename TStatistics, typename TMatrix = Eigen::MatrixXd>
+ForestUtilities<TSplitPoint, TStatistics, TMatrix> make_forest_utils(const Forest<TSplitPoint, TStatistics>& forest,
+	PosteriorAggregation aggregation = PosteriorAggregation::SUM)
+{
+	return ForestUtilities<TSplitPoint, TStatistics, TMatrix>(forest, aggregation);
+}
+
+/// @brief Evaluation utilities for a cascade of a shallow and a deep forest.
+///
+/// The shallow forest computes the posteriors of all samples. Only samples whose normalized posterior entropy
+/// (see compute_normalized_entropy) exceeds the entropy threshold are passed to the deep forest, which then
+/// provides their posteriors. Provides the same interface as ForestUtilities. In a ForestEvaluation the trees of
+/// the shallow forest come first, followed by the trees of the deep forest.
+template <typename TSplitPoint, typename TStatistics, typename TMatrix = Eigen::MatrixXd>
+class CascadeForestUtilities
+{
+	using ForestType = Forest<TSplitPoint, TStatistics>;
+	using ForestUtilsType = ForestUtilities<TSplitPoint, TStatistics, TMatrix>;
+
+	ForestUtilsType shallow_forest_utils_;
+	ForestUtilsType deep_forest_utils_;
+	scalar_type entropy_threshold_;
+
+public:
+	using MatrixType = TMatrix;
+
+	CascadeForestUtilities(const ForestType& shallow_forest, const ForestType& deep_forest, scalar_type entropy_threshold,
+		PosteriorAggregation aggregation = PosteriorAggregation::SUM)
+		: shallow_forest_utils_(shallow_forest, aggregation), deep_forest_utils_(deep_forest, aggregation), entropy_threshold_(entropy_threshold)
+	{
+		if (shallow_forest_utils_.num_of_classes() != deep_forest_utils_.num_of_classes()) {
+			throw std::runtime_error("The shallow and the deep forest of a cascade must have the same number of classes.");
+		}
+	}
+
+	/// @brief Use early exit in the deep forest (see ForestUtilities::enable_early_exit).
+	void enable_early_exit(scalar_type confidence = 1)
+	{
+		deep_forest_utils_.enable_early_exit(confidence);
+	}
+
+	size_type num_of_classes() const
+	{
+		return shallow_forest_utils_.num_of_classes();
+	}
+
+	/// @brief Number of trees of both forests.
+	size_type num_of_trees() const
+	{
+		return shallow_forest_utils_.num_of_trees() + deep_forest_utils_.num_of_trees();
+	}
+
+	size_type num_of_shallow_trees() const
+	{
+		return shallow_forest_utils_.num_of_trees();
+	}
+
+	scalar_type entropy_threshold() const
+	{
+		return entropy_threshold_;
+	}
+
+	/// @brief Return whether the posteriors of the shallow forest are too uncertain and the deep forest has to be evaluated.
+	bool is_uncertain(const float* posteriors) const
+	{
+		return compute_normalized_entropy(posteriors, num_of_classes()) > entropy_threshold_;
+	}
+
+	PosteriorBuffer make_posterior_buffer(size_type block_size = PosteriorBuffer::DEFAULT_BLOCK_SIZE) const
+	{
+		return PosteriorBuffer(num_of_classes(), block_size);
+	}
+
+	/// @brief Compute the cascade posteriors of a sample.
+	/// @return The number of evaluated trees.
+	template <typename TSample>
+	size_type compute_posteriors(const TSample& sample, float* posteriors) const
+	{
+		size_type num_of_evaluated_trees = shallow_forest_utils_.compute_posteriors(sample, posteriors);
+		if (is_uncertain(posteriors)) {
+			num_of_evaluated_trees += deep_forest_utils_.compute_posteriors(sample, posteriors);
+		}
+		return num_of_evaluated_trees;
+	}
+
+	/// @brief Compute the cascade posteriors of a block of samples. The shallow forest is evaluated on the whole block
+	///        and the deep forest only on the uncertain samples.
+	template <typename TSampleIterator>
+	void compute_posteriors(const TSampleIterator& block_start, const TSampleIterator& block_end, PosteriorBuffer& buffer) const
+	{
+		shallow_forest_utils_.compute_posteriors(block_start, block_end, buffer);
+		size_type i = 0;
+		for (TSampleIterator sample_it = block_start; sample_it != block_end; ++sample_it, ++i) {
+			float* posteriors = buffer.get_posteriors(i);
+			if (is_uncertain(posteriors)) {
+				buffer.add_evaluated_trees(deep_forest_utils_.compute_posteriors(*sample_it, posteriors));
+			}
+		}
+	}
+
+	/// @brief Compute the cascade posteriors of all samples block by block and call func(sample, posteriors) for each sample.
+	template <typename TSampleIterator, typename TFunction>
+	void for_each_posteriors(const TSampleIterator& samples_start, const TSampleIterator& samples_end, PosteriorBuffer& buffer, TFunction func) const
+	{
+		TSampleIterator block_start = samples_start;
+		while (block_start != samples_end) {
+			TSampleIterator block_end = block_start;
+			for (size_type n = 0; n < buffer.block_size() && block_end != samples_end; ++n) {
+				++block_end;
+			}
+			compute_posteriors(block_start, block_end, buffer);
+			size_type i = 0;
+			for (TSampleIterator sample_it = block_start; sample_it != block_end; ++sample_it, ++i) {
+				func(*sample_it, buffer.get_posteriors(i));
+			}
+			block_start = block_end;
+		}
+	}
+
+	/// @brief Add all samples of a frame to an evaluation (see ForestUtilities::evaluate_frame).
+	template <typename TSampleIterator>
+	void evaluate_frame(const TSampleIterator& samples_start, const TSampleIterator& samples_end, ForestEvaluation& evaluation, PosteriorBuffer& buffer) const
+	{
+		evaluation.begin_frame();
+		float* posteriors = buffer.get_posteriors(0);
+		for (TSampleIterator sample_it = samples_start; sample_it != samples_end; ++sample_it) {
+			shallow_forest_utils_.evaluate_sample(*sample_it, posteriors, evaluation);
+			if (is_uncertain(posteriors)) {
+				deep_forest_utils_.evaluate_sample(*sample_it, posteriors, evaluation, num_of_shallow_trees());
+			}
+			evaluation.add_sample(sample_it->get_label(), PosteriorBuffer::get_max_class(posteriors, num_of_classes()));
+		}
+		evaluation.end_frame();
+	}
+
+	/// @brief Add the predictions of all samples to a confusion matrix without allocating memory per sample.
+	template <typename TTMatrix, typename TSampleIterator>
+	TTMatrix& accumulate_confusion_matrix(TTMatrix& confusion_matrix, const TSampleIterator& samples_start, const TSampleIterator& samples_end, PosteriorBuffer& buffer) const
+	{
+		for_each_posteriors(samples_start, samples_end, buffer, [&] (const typename std::iterator_traits<TSampleIterator>::value_type& sample, const float* posteriors) {
+			size_type true_label = sample.get_label();
+			size_type predicted_label = PosteriorBuffer::get_max_class(posteriors, num_of_classes());
+			EvaluationUtils::update_confusion_matrix(confusion_matrix, true_label, predicted_label);
+		});
+		return confusion_matrix;
+	}
+
+	template <typename TSampleIterator>
+	TMatrix compute_confusion_matrix(const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+	{
+		TMatrix confusion_matrix(num_of_classes(), num_of_classes());
+		confusion_matrix.setZero();
+		PosteriorBuffer buffer = make_posterior_buffer();
+		return accumulate_confusion_matrix(confusion_matrix, samples_start, samples_end, buffer);
+	}
+};
+
+template <typename TSplitPoint, typename TStatistics, typename TMatrix = Eigen::MatrixXd>
+CascadeForestUtilities<TSplitPoint, TStatistics, TMatrix> make_cascade_forest_utils(const Forest<TSplitPoint, TStatistics>& shallow_forest,
+	const Forest<TSplitPoint, TStatistics>& deep_forest, scalar_type entropy_threshold, PosteriorAggregation aggregation = PosteriorAggregation::SUM)
+{
+	return CascadeForestUtilities<TSplitPoint, TStatistics, TMatrix>(shallow_forest, deep_forest, entropy_threshold, aggregation);
+}
+
+/// @brief Evaluation utilities for a memory-mapped native forest (see MappedNativeForest) or a LazyForest.
+///        Provides the same interface as ForestUtilities.
+template <typename TMappedForest, typename TStatistics, typename TMatrix = Eigen::MatrixXd>
+class MappedForestUtilities
+{
+	const TMappedForest& forest_;
+    size_type num_of_classes_;
+	PosteriorAggregation aggregation_;
+
+	template <typename TCount>
+	void add_normalized_histogram(const TCount* histogram, float* posteriors) const
+	{
+		std::int64_t total = std::accumulate(histogram, histogram + num_of_classes_, std::int64_t(0));
+		if (total > 0) {
+			for (size_type i = 0; i < num_of_classes_; ++i) {
+				posteriors[i] += aggregation_ == PosteriorAggregation::PRODUCT
+					? compute_leaf_log_probability(histogram[i], total)
+					: histogram[i] / static_cast<float>(total);
+			}
+		}
+	}
+
+public:
+	using MatrixType = TMatrix;
+
+	MappedForestUtilities(const TMappedForest& forest, PosteriorAggregation aggregation = PosteriorAggregation::SUM)
+		: forest_(forest), num_of_classes_(forest.num_of_classes()), aggregation_(aggregation)
+    {
+	}
+
+	size_type num_of_classes() const
+	{
+		return num_of_classes_;
+	}
+
+	size_type num_of_trees() const
+	{
+		return forest_.num_of_trees();
+	}
+
+	/// @brief Compute the forest posteriors of a sample (see ForestUtilities::compute_posteriors).
+	template <typename TSample>
+	void compute_posteriors(const TSample& sample, float* posteriors) const
+	{
+		std::fill(posteriors, posteriors + num_of_classes_, 0.0f);
+		for (size_type tree_index = 0; tree_index < forest_.num_of_trees(); ++tree_index) {
+			const auto* tree_histogram = forest_.get_histogram(tree_index, forest_.evaluate(tree_index, sample));
+			add_normalized_histogram(tree_histogram, posteriors);
+		}
+		normalize_accumulated_posteriors(posteriors, num_of_classes_, forest_.num_of_trees(), aggregation_);
+	}
+
+	/// @brief Add all samples of a frame to an evaluation (see ForestUtilities::evaluate_frame).
+	template <typename TSampleIterator>
+	void evaluate_frame(const TSampleIterator& samples_start, const TSampleIterator& samples_end, ForestEvaluation& evaluation, PosteriorBuffer& buffer) const
+	{
+		evaluation.begin_frame();
+		float* posteriors = buffer.get_posteriors(0);
+		for (TSampleIterator sample_it = samples_start; sample_it != samples_end; ++sample_it) {
+			buffer.clear(1);
+			for (size_type tree_index = 0; tree_index < forest_.num_of_trees(); ++tree_index) {
+				const auto* tree_histogram = forest_.get_histogram(tree_index, forest_.evaluate(tree_index, *sample_it));
+				evaluation.add_tree_vote(tree_index, sample_it->get_label(), std::max_element(tree_histogram, tree_histogram + num_of_classes_) - tree_histogram);
+				add_normalized_histogram(tree_histogram, posteriors);
+			}
+			evaluation.add_sample(sample_it->get_label(), PosteriorBuffer::get_max_class(posteriors, num_of_classes_));
+		}
+		evaluation.end_frame();
+	}
+
+	template <typename TSample>
+	TStatistics compute_summed_statistics(const TSample& sample) const
+	{
+		std::vector<size_type> summed_histogram(num_of_classes_, 0);
+		for (size_type tree_index = 0; tree_index < forest_.num_of_trees(); ++tree_index) {
+			const auto* tree_histogram = forest_.get_histogram(tree_index, forest_.evaluate(tree_index, sample));
+			for (size_type i = 0; i < num_of_classes_; ++i) {
+				summed_histogram[i] += tree_histogram[i];
+			}
+		}
+		return TStatistics(summed_histogram);
+	}
+
+	template <typename TSampleIterator>
+	TStatistics compute_summed_statistics(const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+	{
+		TStatistics summed_statistics(num_of_classes_);
+		for (TSampleIterator sample_it = samples_start; sample_it != samples_end; ++sample_it) {
+			for (size_type tree_index = 0; tree_index < forest_.num_of_trees(); ++tree_index) {
+				const auto* tree_histogram = forest_.get_histogram(tree_index, forest_.evaluate(tree_index, *sample_it));
+				summed_statistics.lazy_accumulate(std::max_element(tree_histogram, tree_histogram + num_of_classes_) - tree_histogram);
+			}
+		}
+		summed_statistics.finish_lazy_accumulation();
+		return summed_statistics;
+	}
+
+	template <typename TSampleIterator>
+	TMatrix compute_confusion_matrix(const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+	{
+		TMatrix confusion_matrix(num_of_classes_, num_of_classes_);
+        confusion_matrix.setZero();
+		return accumulate_confusion_matrix(confusion_matrix, samples_start, samples_end);
+	}
+
+	template <typename TTMatrix, typename TSampleIterator>
+	TTMatrix& accumulate_confusion_matrix(TTMatrix& confusion_matrix, const TSampleIterator& samples_start, const TSampleIterator& samples_end) const
+	{
+		PosteriorBuffer buffer(num_of_classes_, 1);
         for (TSampleIterator sample_it = samples_start; sample_it != samples_end; ++sample_it) {
-            update_confusion_matrix(confusion_matrix, *sample_it);
+			size_type true_label = sample_it->get_label();
+			compute_posteriors(*sample_it, buffer.get_posteriors(0));
+			size_type predicted_label = PosteriorBuffer::get_max_class(buffer.get_posteriors(0), num_of_classes_);
+			EvaluationUtils::update_confusion_matrix(confusion_matrix, true_label, predicted_label);
         }
 		return confusion_matrix;
 	}
@@ -276,8 +1326,10 @@ public:
 	TTMatrix& update_confusion_matrix(TTMatrix& confusion_matrix, const TSample& sample) const
     {
         size_type true_label = sample.get_label();
-		const TStatistics& predicted_statistics = compute_summed_statistics(sample);
-		return EvaluationUtils::update_confusion_matrix(confusion_matrix, true_label, predicted_statistics);
+		PosteriorBuffer buffer(num_of_classes_, 1);
+		compute_posteriors(sample, buffer.get_posteriors(0));
+		size_type predicted_label = PosteriorBuffer::get_max_class(buffer.get_posteriors(0), num_of_classes_);
+		return EvaluationUtils::update_confusion_matrix(confusion_matrix, true_label, predicted_label);
 	}
 
 	template <typename TTMatrix, typename TSampleIterator>
@@ -289,10 +1341,11 @@ public:
 	}
 };
 
-template <typename TSplitPoint, typename TStatistics, typename TMatrix = Eigen::MatrixXd>
-ForestUtilities<TSplitPoint, TStatistics, TMatrix> make_forest_utils(const Forest<TSplitPoint, TStatistics>& forest)
+template <typename TStatistics, typename TMappedForest, typename TMatrix = Eigen::MatrixXd>
+MappedForestUtilities<TMappedForest, TStatistics, TMatrix> make_mapped_forest_utils(const TMappedForest& forest,
+	PosteriorAggregation aggregation = PosteriorAggregation::SUM)
 {
-	return ForestUtilities<TSplitPoint, TStatistics, TMatrix>(forest);
+	return MappedForestUtilities<TMappedForest, TStatistics, TMatrix>(forest, aggregation);
 }
 
 }
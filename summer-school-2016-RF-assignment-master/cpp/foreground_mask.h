@@ -0,0 +1,272 @@
+//
+//  foreground_mask.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include "ait.h"
+#include "image_weak_learner.h"
+
+namespace ait
+{
+
+/// @brief Parameters of the foreground mask that is derived from a depth image (see ForegroundMask::compute).
+struct ForegroundParameters
+{
+    // Pixels with the invalid depth or with a depth outside of [min_depth, max_depth] are background.
+    pixel_type invalid_depth = 0;
+    pixel_type min_depth = 1;
+    pixel_type max_depth = std::numeric_limits<pixel_type>::max();
+
+    // Keep only the connected foreground pixels around the pixel with the smallest depth (e.g. a hand in front of the body).
+    bool nearest_blob = false;
+    // Largest depth difference of two neighboring pixels of the nearest blob.
+    pixel_type max_blob_depth_step = 50;
+
+    // Evaluate all pixels within the bounding box of the mask instead of only the pixels of the mask.
+    bool bounding_box = false;
+};
+
+/// @brief Foreground pixels of an image stored as runs of consecutive pixels per row.
+///
+/// Only the foreground pixels are evaluated by DenseForestPredictor. The mask keeps its memory when it is
+/// computed again, so it can be reused for all frames of a stream.
+class ForegroundMask
+{
+public:
+    /// @brief Pixels [x_begin, x_end) of a row.
+    struct Run
+    {
+        offset_type x_begin;
+        offset_type x_end;
+    };
+
+    ForegroundMask()
+    : width_(0), height_(0), num_of_pixels_(0), x_min_(0), y_min_(0), x_max_(0), y_max_(0)
+    {}
+
+    /// @brief Compute the foreground mask of a depth image.
+    template <typename TPixel>
+    void compute(const Image<TPixel>& image, const ForegroundParameters& parameters)
+    {
+        width_ = image.width();
+        height_ = image.height();
+        flags_.assign(width_ * height_, 0);
+        size_type nearest_index = -1;
+        TPixel nearest_depth = 0;
+        for (offset_type y = 0; y < height_; ++y)
+        {
+            for (offset_type x = 0; x < width_; ++x)
+            {
+                TPixel depth = image.get_pixel(x, y);
+                if (depth != parameters.invalid_depth && depth >= parameters.min_depth && depth <= parameters.max_depth)
+                {
+                    size_type index = y * width_ + x;
+                    flags_[index] = IN_RANGE;
+                    if (nearest_index < 0 || depth < nearest_depth)
+                    {
+                        nearest_index = index;
+                        nearest_depth = depth;
+                    }
+                }
+            }
+        }
+        std::uint8_t foreground_flag = IN_RANGE;
+        if (parameters.nearest_blob)
+        {
+            foreground_flag = IN_BLOB;
+            if (nearest_index >= 0)
+            {
+                grow_blob(image, nearest_index, parameters.max_blob_depth_step);
+            }
+        }
+        compute_runs(foreground_flag, parameters.bounding_box);
+    }
+
+    /// @brief Compute the mask of all pixels with a non-zero flag. The flag of pixel (x, y) is flags[y * width + x].
+    void compute(const std::vector<std::uint8_t>& flags, size_type width, size_type height)
+    {
+        width_ = width;
+        height_ = height;
+        flags_.resize(width_ * height_);
+        for (size_type i = 0; i < width_ * height_; ++i)
+        {
+            flags_[i] = flags[i] != 0 ? IN_RANGE : 0;
+        }
+        compute_runs(IN_RANGE, false);
+    }
+
+    size_type width() const
+    {
+        return width_;
+    }
+
+    size_type height() const
+    {
+        return height_;
+    }
+
+    /// @brief Number of pixels that are covered by the runs.
+    size_type num_of_pixels() const
+    {
+        return num_of_pixels_;
+    }
+
+    bool empty() const
+    {
+        return num_of_pixels_ == 0;
+    }
+
+    /// @brief Runs of a row ordered by x.
+    const Run* row_begin(offset_type y) const
+    {
+        return runs_.data() + row_offsets_[y];
+    }
+
+    const Run* row_end(offset_type y) const
+    {
+        return runs_.data() + row_offsets_[y + 1];
+    }
+
+    /// @brief Bounding box [x_min, x_max) x [y_min, y_max) of the mask (empty if the mask is empty).
+    offset_type x_min() const
+    {
+        return x_min_;
+    }
+
+    offset_type y_min() const
+    {
+        return y_min_;
+    }
+
+    offset_type x_max() const
+    {
+        return x_max_;
+    }
+
+    offset_type y_max() const
+    {
+        return y_max_;
+    }
+
+private:
+    static const std::uint8_t IN_RANGE = 1;
+    static const std::uint8_t IN_BLOB = 2;
+
+    /// @brief Flood-fill the pixels in range that are connected to the seed pixel without a large depth step.
+    template <typename TPixel>
+    void grow_blob(const Image<TPixel>& image, size_type seed_index, pixel_type max_depth_step)
+    {
+        stack_.clear();
+        stack_.push_back(seed_index);
+        flags_[seed_index] = IN_BLOB;
+        while (!stack_.empty())
+        {
+            size_type index = stack_.back();
+            stack_.pop_back();
+            offset_type x = index % width_;
+            offset_type y = index / width_;
+            TPixel depth = image.get_pixel(x, y);
+            const offset_type neighbors[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+            for (const auto& neighbor : neighbors)
+            {
+                offset_type nx = x + neighbor[0];
+                offset_type ny = y + neighbor[1];
+                if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_)
+                {
+                    continue;
+                }
+                size_type neighbor_index = ny * width_ + nx;
+                if (flags_[neighbor_index] == IN_RANGE && std::abs(image.get_pixel(nx, ny) - depth) <= max_depth_step)
+                {
+                    flags_[neighbor_index] = IN_BLOB;
+                    stack_.push_back(neighbor_index);
+                }
+            }
+        }
+    }
+
+    void compute_runs(std::uint8_t foreground_flag, bool bounding_box)
+    {
+        runs_.clear();
+        row_offsets_.assign(height_ + 1, 0);
+        num_of_pixels_ = 0;
+        x_min_ = width_;
+        y_min_ = height_;
+        x_max_ = 0;
+        y_max_ = 0;
+        for (offset_type y = 0; y < height_; ++y)
+        {
+            row_offsets_[y] = runs_.size();
+            const std::uint8_t* row_flags = &flags_[y * width_];
+            offset_type x = 0;
+            while (x < width_)
+            {
+                if (row_flags[x] != foreground_flag)
+                {
+                    ++x;
+                    continue;
+                }
+                Run run;
+                run.x_begin = x;
+                while (x < width_ && row_flags[x] == foreground_flag)
+                {
+                    ++x;
+                }
+                run.x_end = x;
+                runs_.push_back(run);
+                num_of_pixels_ += run.x_end - run.x_begin;
+                x_min_ = std::min(x_min_, run.x_begin);
+                x_max_ = std::max(x_max_, run.x_end);
+                y_min_ = std::min<offset_type>(y_min_, y);
+                y_max_ = std::max<offset_type>(y_max_, y + 1);
+            }
+        }
+        row_offsets_[height_] = runs_.size();
+        if (num_of_pixels_ == 0)
+        {
+            x_min_ = y_min_ = x_max_ = y_max_ = 0;
+        }
+        else if (bounding_box)
+        {
+            // Replace the runs by a single run per row of the bounding box.
+            runs_.clear();
+            for (offset_type y = 0; y < height_; ++y)
+            {
+                row_offsets_[y] = runs_.size();
+                if (y >= y_min_ && y < y_max_)
+                {
+                    Run run;
+                    run.x_begin = x_min_;
+                    run.x_end = x_max_;
+                    runs_.push_back(run);
+                }
+            }
+            row_offsets_[height_] = runs_.size();
+            num_of_pixels_ = static_cast<size_type>(x_max_ - x_min_) * (y_max_ - y_min_);
+        }
+    }
+
+    size_type width_;
+    size_type height_;
+    size_type num_of_pixels_;
+    offset_type x_min_;
+    offset_type y_min_;
+    offset_type x_max_;
+    offset_type y_max_;
+    std::vector<Run> runs_;
+    // Runs of row y are runs_[row_offsets_[y]] to runs_[row_offsets_[y + 1] - 1].
+    std::vector<size_type> row_offsets_;
+    // Scratch memory for the computation of the mask.
+    std::vector<std::uint8_t> flags_;
+    std::vector<size_type> stack_;
+};
+
+}
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <functional>
@@ -32,6 +33,8 @@ namespace ait
 	class Forest
 	{
 	public:
+		using SplitPointT = TSplitPoint;
+		using StatisticsT = TStatistics;
 		using TreeT = Tree<TSplitPoint, TStatistics>;
 		using NodeT = typename TreeT::NodeT;
 
@@ -94,6 +97,29 @@ namespace ait
 			return trees_.size();
 		}
 
+		/// @brief Return a forest of the upper levels of all trees (see Tree::get_truncated_tree).
+		Forest get_truncated_forest(size_type depth) const
+		{
+			Forest forest;
+			for (const TreeT& tree : trees_)
+			{
+				TreeT truncated_tree = tree.get_truncated_tree(depth);
+				forest.add_tree(truncated_tree);
+			}
+			return forest;
+		}
+
+		/// @brief Return the largest depth of all trees.
+		size_type depth() const
+		{
+			size_type max_depth = 0;
+			for (const TreeT& tree : trees_)
+			{
+				max_depth = std::max(max_depth, tree.depth());
+			}
+			return max_depth;
+		}
+
 		// TODO: Think about evaluation methods
 		template <typename TSample>
 		void evaluate(const std::vector<TSample>& samples, const std::function<void(const TSample& sample, const typename TreeT::ConstNodeIterator&)>& func) const {
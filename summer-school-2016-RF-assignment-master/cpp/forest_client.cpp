@@ -0,0 +1,173 @@
+//
+//  forest_client.cpp
+//  DistRandomForest
+//
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <tclap/CmdLine.h>
+
+#include "ait.h"
+#include "logger.h"
+#include "csv_utils.h"
+#include "image_weak_learner.h"
+#include "prediction_protocol.h"
+
+using PixelT = ait::pixel_type;
+using ImageT = ait::Image<PixelT>;
+
+namespace
+{
+
+int connect_to_server(const std::string& socket_path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path '" + socket_path + "' is too long.");
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        throw std::runtime_error("Unable to connect to '" + socket_path + "': " + std::strerror(errno));
+    }
+    return fd;
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        // Parse command line arguments.
+        TCLAP::CmdLine cmd("Test client for the random forest prediction server", ' ', "0.3");
+        TCLAP::ValueArg<std::string> socket_arg("s", "socket", "Unix domain socket of the server", true, "", "string", cmd);
+        TCLAP::ValueArg<std::string> image_list_file_arg("f", "image-list-file", "File containing the names of image files", true, "", "string", cmd);
+        TCLAP::ValueArg<int> repetitions_arg("r", "repetitions", "Number of times each frame is sent", false, 1, "int", cmd);
+        TCLAP::SwitchArg posteriors_switch("p", "posteriors", "Request the class posteriors along with the labels", cmd, false);
+        cmd.parse(argc, argv);
+
+        const std::string image_list_file = image_list_file_arg.getValue();
+
+        // Read image file list
+        ait::log_info(false) << "Reading image list ... " << std::flush;
+        std::vector<std::tuple<std::string, std::string>> image_list;
+        if (!boost::filesystem::exists(image_list_file))
+        {
+            throw std::runtime_error("Unable to open image list file");
+        }
+        const std::string image_list_directory = boost::filesystem::path(image_list_file).parent_path().string();
+        ait::MappedCSVReader<> csv_reader(image_list_file);
+        for (auto it = csv_reader.begin(); it != csv_reader.end(); ++it)
+        {
+            if (it->size() != 2)
+            {
+                cmd.getOutput()->usage(cmd);
+                ait::log_error() << "Image list file should contain two columns with the data and label filenames.";
+                exit(-1);
+            }
+            std::string data_path = ait::resolve_path(image_list_directory, (*it)[0]);
+            std::string label_path = ait::resolve_path(image_list_directory, (*it)[1]);
+            image_list.push_back(std::make_tuple(std::move(data_path), std::move(label_path)));
+        }
+        ait::log_info(false) << " Done." << std::endl;
+
+        int fd = connect_to_server(socket_arg.getValue());
+        const std::uint32_t flags = posteriors_switch.getValue() ? ait::PREDICTION_FLAG_POSTERIORS : 0;
+        std::vector<PixelT> pixels;
+        std::vector<char> response;
+        ait::size_type num_of_frames = 0;
+        ait::size_type num_of_correct_pixels = 0;
+        ait::size_type num_of_labeled_pixels = 0;
+        double total_latency_ms = 0;
+        for (const auto& entry : image_list)
+        {
+            ImageT image = ImageT::load_from_files(std::get<0>(entry), std::get<1>(entry));
+            pixels.resize(image.width() * image.height());
+            for (ait::offset_type y = 0; y < image.height(); ++y)
+            {
+                for (ait::offset_type x = 0; x < image.width(); ++x)
+                {
+                    pixels[y * image.width() + x] = image.get_pixel(x, y);
+                }
+            }
+            for (int r = 0; r < repetitions_arg.getValue(); ++r)
+            {
+                auto start_time = std::chrono::steady_clock::now();
+                ait::write_message(fd, ait::encode_prediction_request(flags, image.width(), image.height(), pixels.data()));
+                if (!ait::read_message(fd, response))
+                {
+                    throw std::runtime_error("The server closed the connection.");
+                }
+                auto stop_time = std::chrono::steady_clock::now();
+                total_latency_ms += std::chrono::duration<double, std::milli>(stop_time - start_time).count();
+                ait::PredictionResponseHeader header;
+                const ait::label_type* labels = ait::decode_prediction_response(response, header);
+                // Pixels with a label outside of the classes of the forest are background.
+                ait::size_type num_of_frame_correct_pixels = 0;
+                ait::size_type num_of_frame_labeled_pixels = 0;
+                for (ait::offset_type y = 0; y < image.height(); ++y)
+                {
+                    for (ait::offset_type x = 0; x < image.width(); ++x)
+                    {
+                        ait::label_type true_label = image.get_label_matrix()(x, y);
+                        if (true_label >= 0 && true_label < static_cast<ait::label_type>(header.num_of_classes))
+                        {
+                            ++num_of_frame_labeled_pixels;
+                            if (labels[y * image.width() + x] == true_label)
+                            {
+                                ++num_of_frame_correct_pixels;
+                            }
+                        }
+                    }
+                }
+                if (r == 0)
+                {
+                    ait::log_info() << std::get<0>(entry) << ": " << num_of_frame_correct_pixels << " / " << num_of_frame_labeled_pixels << " pixels correct";
+                }
+                num_of_correct_pixels += num_of_frame_correct_pixels;
+                num_of_labeled_pixels += num_of_frame_labeled_pixels;
+                ++num_of_frames;
+            }
+        }
+        ::close(fd);
+
+        ait::log_info() << "Frames: " << num_of_frames;
+        if (num_of_labeled_pixels > 0)
+        {
+            ait::log_info() << "Pixel accuracy: " << num_of_correct_pixels / static_cast<double>(num_of_labeled_pixels);
+        }
+        if (num_of_frames > 0)
+        {
+            ait::log_info() << "Mean latency: " << total_latency_ms / num_of_frames << " ms";
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "Runtime exception occured" << std::endl;
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    catch (const TCLAP::ArgException &e)
+    {
+        ait::log_error() << "Error parsing command line: " << e.error() << " for arg " << e.argId();
+        return 1;
+    }
+
+    return 0;
+}
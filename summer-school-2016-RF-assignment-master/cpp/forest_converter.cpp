@@ -0,0 +1,154 @@
+//
+//  forest_converter.cpp
+//  DistRandomForest
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <chrono>
+
+#include <cereal/archives/json.hpp>
+#include <cereal/archives/binary.hpp>
+#include <tclap/CmdLine.h>
+
+#include "ait.h"
+#include "logger.h"
+#include "forest.h"
+#include "histogram_statistics.h"
+#include "image_weak_learner.h"
+#include "forest_stream_io.h"
+#include "native_forest_io.h"
+#include "indexed_forest_io.h"
+#include "compact_json_io.h"
+
+using PixelT = ait::pixel_type;
+using StatisticsT = ait::HistogramStatistics;
+using SplitPointT = ait::ImageSplitPoint<PixelT>;
+
+using ForestT = ait::Forest<SplitPointT, StatisticsT>;
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        // Parse command line arguments.
+        TCLAP::CmdLine cmd("Random forest converter (cereal to native, indexed or compact JSON forest file)", ' ', "0.3");
+        TCLAP::ValueArg<std::string> json_forest_file_arg("j", "json-forest-file", "JSON file of the forest to convert", false, "forest.json", "string");
+        TCLAP::ValueArg<std::string> binary_forest_file_arg("b", "binary-forest-file", "Binary or stream file of the forest to convert", false, "forest.bin", "string");
+        TCLAP::ValueArg<std::string> native_forest_file_arg("o", "native-forest-file", "Native forest file to write", false, "forest.native", "string");
+        TCLAP::ValueArg<std::string> indexed_forest_file_arg("x", "indexed-forest-file", "Indexed forest file to write (trees can be loaded in parallel)", false, "forest.idx", "string");
+        TCLAP::ValueArg<std::string> compact_json_forest_file_arg("", "compact-json-file", "Compact JSON forest file to write (only reachable nodes)", false, "forest_compact.json", "string");
+        TCLAP::ValueArg<std::string> shared_memory_name_arg("", "shared-memory-name", "Publish the native forest file to a POSIX shared memory object with this name", false, "", "string", cmd);
+        TCLAP::SwitchArg no_internal_statistics_switch("", "no-internal-statistics", "Omit the statistics of internal nodes from the compact JSON forest file", cmd, false);
+        TCLAP::SwitchArg verify_switch("", "verify", "Read the written forest file back and compare it with the converted forest", cmd, false);
+        cmd.xorAdd(json_forest_file_arg, binary_forest_file_arg);
+        std::vector<TCLAP::Arg*> output_args = {&native_forest_file_arg, &indexed_forest_file_arg, &compact_json_forest_file_arg};
+        cmd.xorAdd(output_args);
+        cmd.parse(argc, argv);
+
+        if (verify_switch.getValue() && compact_json_forest_file_arg.isSet())
+        {
+            throw std::runtime_error("Compact JSON forest files cannot be verified.");
+        }
+        if (shared_memory_name_arg.isSet() && !native_forest_file_arg.isSet())
+        {
+            throw std::runtime_error("Publishing to shared memory requires a native forest file.");
+        }
+        if (no_internal_statistics_switch.getValue() && !compact_json_forest_file_arg.isSet())
+        {
+            throw std::runtime_error("Omitting internal node statistics requires a compact JSON forest file.");
+        }
+
+        ForestT forest;
+        if (json_forest_file_arg.isSet())
+        {
+            ait::log_info(false) << "Reading json forest file " << json_forest_file_arg.getValue() << "... " << std::flush;
+            std::ifstream ifile(json_forest_file_arg.getValue());
+            cereal::JSONInputArchive iarchive(ifile);
+            iarchive(cereal::make_nvp("forest", forest));
+            ait::log_info(false) << " Done." << std::endl;
+        }
+        else if (ait::is_forest_stream_file(binary_forest_file_arg.getValue()))
+        {
+            ait::log_info(false) << "Reading forest stream file " << binary_forest_file_arg.getValue() << "... " << std::flush;
+            ait::ForestStreamReader<ForestT::TreeT> forest_reader(binary_forest_file_arg.getValue());
+            forest_reader.read_forest(forest);
+            ait::log_info(false) << " Done." << std::endl;
+        }
+        else
+        {
+            ait::log_info(false) << "Reading binary forest file " << binary_forest_file_arg.getValue() << "... " << std::flush;
+            std::ifstream ifile(binary_forest_file_arg.getValue(), std::ios_base::binary);
+            cereal::BinaryInputArchive iarchive(ifile);
+            iarchive(cereal::make_nvp("forest", forest));
+            ait::log_info(false) << " Done." << std::endl;
+        }
+
+        if (native_forest_file_arg.isSet())
+        {
+            ait::log_info(false) << "Writing native forest file " << native_forest_file_arg.getValue() << "... " << std::flush;
+            ait::write_native_forest(native_forest_file_arg.getValue(), forest);
+            ait::log_info(false) << " Done." << std::endl;
+            if (shared_memory_name_arg.isSet())
+            {
+                ait::log_info(false) << "Publishing native forest to shared memory " << shared_memory_name_arg.getValue() << "... " << std::flush;
+                ait::publish_native_forest_to_shared_memory(native_forest_file_arg.getValue(), shared_memory_name_arg.getValue());
+                ait::log_info(false) << " Done." << std::endl;
+            }
+        }
+        else if (compact_json_forest_file_arg.isSet())
+        {
+            ait::log_info(false) << "Writing compact json forest file " << compact_json_forest_file_arg.getValue() << "... " << std::flush;
+            ait::CompactJsonForestWriter<ForestT::TreeT> forest_writer(compact_json_forest_file_arg.getValue(), !no_internal_statistics_switch.getValue());
+            forest_writer.write_forest(forest);
+            forest_writer.close();
+            ait::log_info(false) << " Done." << std::endl;
+        }
+        else
+        {
+            ait::log_info(false) << "Writing indexed forest file " << indexed_forest_file_arg.getValue() << "... " << std::flush;
+            ait::write_indexed_forest(indexed_forest_file_arg.getValue(), forest);
+            ait::log_info(false) << " Done." << std::endl;
+        }
+
+        if (verify_switch.getValue())
+        {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            ForestT native_forest = native_forest_file_arg.isSet()
+                ? ait::read_native_forest<ForestT>(native_forest_file_arg.getValue())
+                : ait::read_indexed_forest<ForestT>(indexed_forest_file_arg.getValue());
+            auto stop_time = std::chrono::high_resolution_clock::now();
+            double elapsed_seconds = std::chrono::duration<double>(stop_time - start_time).count();
+            ait::log_info() << "Reading the written forest file took " << elapsed_seconds << " seconds.";
+            // Compare the cereal serializations of both forests.
+            std::ostringstream original_stream;
+            std::ostringstream native_stream;
+            {
+                cereal::BinaryOutputArchive original_archive(original_stream);
+                original_archive(forest);
+                cereal::BinaryOutputArchive native_archive(native_stream);
+                native_archive(native_forest);
+            }
+            if (original_stream.str() != native_stream.str())
+            {
+                throw std::runtime_error("The written forest file does not match the converted forest.");
+            }
+            ait::log_info() << "Written forest file verified.";
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "Runtime exception occured" << std::endl;
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    catch (const TCLAP::ArgException &e)
+    {
+        ait::log_error() << "Error parsing command line: " << e.error() << " for arg " << e.argId();
+        return 1;
+    }
+
+    return 0;
+}
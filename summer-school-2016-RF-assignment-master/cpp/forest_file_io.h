@@ -0,0 +1,68 @@
+//
+//  forest_file_io.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <fstream>
+#include <string>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <cereal/archives/json.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include "ait.h"
+#include "forest_stream_io.h"
+#include "native_forest_io.h"
+#include "indexed_forest_io.h"
+
+namespace ait
+{
+
+/// @brief Read a forest from a file in any of the supported formats.
+///
+/// Native, indexed and stream forest files are detected by their magic. Other files are read
+/// as cereal JSON if the filename ends with .json and as cereal binary otherwise.
+template <typename TForest>
+TForest read_forest_file(const std::string& filename)
+{
+    if (is_native_forest_file(filename))
+    {
+        return read_native_forest<TForest>(filename);
+    }
+    if (is_indexed_forest_file(filename))
+    {
+        return read_indexed_forest<TForest>(filename);
+    }
+    TForest forest;
+    if (is_forest_stream_file(filename))
+    {
+        ForestStreamReader<typename TForest::TreeT> forest_reader(filename);
+        forest_reader.read_forest(forest);
+        return forest;
+    }
+    if (boost::algorithm::iends_with(filename, ".json"))
+    {
+        std::ifstream ifile(filename);
+        if (!ifile)
+        {
+            throw std::runtime_error("Unable to open forest file '" + filename + "'.");
+        }
+        cereal::JSONInputArchive iarchive(ifile);
+        iarchive(cereal::make_nvp("forest", forest));
+    }
+    else
+    {
+        std::ifstream ifile(filename, std::ios_base::binary);
+        if (!ifile)
+        {
+            throw std::runtime_error("Unable to open forest file '" + filename + "'.");
+        }
+        cereal::BinaryInputArchive iarchive(ifile);
+        iarchive(cereal::make_nvp("forest", forest));
+    }
+    return forest;
+}
+
+}
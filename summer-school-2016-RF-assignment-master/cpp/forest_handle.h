@@ -0,0 +1,174 @@
+//
+//  forest_handle.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if AIT_MULTI_THREADING
+#include <chrono>
+#include <future>
+#endif
+
+#include "ait.h"
+#include "logger.h"
+
+namespace ait
+{
+
+/// @brief A thread-safe handle to a forest that can be replaced while it is being used.
+///
+/// Readers take a snapshot (a shared pointer to an immutable forest) and evaluate against it without further synchronization.
+/// Taking a snapshot is not lock-free: std::atomic_load on a shared pointer is implemented with a short critical section
+/// (libstdc++ uses a global pool of mutexes), so readers should take one snapshot per batch and not per sample.
+/// A new forest is loaded in the background and replaced with std::atomic_exchange. Readers that still hold a snapshot
+/// of the previous forest keep using it. A replaced forest is kept by the handle until no reader holds it anymore
+/// and is then released by a later publish() or release_unused_forests(), so readers never pay for its destruction.
+template <typename TForest>
+class ForestHandle
+{
+public:
+    using ForestT = TForest;
+    using SnapshotT = std::shared_ptr<const TForest>;
+    using LoaderT = std::function<TForest()>;
+
+    ForestHandle()
+    : generation_(0)
+    {}
+
+    explicit ForestHandle(SnapshotT forest)
+    : forest_(std::move(forest)), generation_(1)
+    {}
+
+    ForestHandle(const ForestHandle&) = delete;
+    ForestHandle& operator=(const ForestHandle&) = delete;
+
+    ~ForestHandle()
+    {
+        wait_for_reload();
+    }
+
+    /// @brief Return a snapshot of the current forest (null if no forest was published yet).
+    ///        This briefly locks a mutex of the standard library, so it should not be called per sample.
+    SnapshotT get() const
+    {
+        return std::atomic_load_explicit(&forest_, std::memory_order_acquire);
+    }
+
+    /// @brief Return the number of forests published so far.
+    size_type generation() const
+    {
+        return generation_.load(std::memory_order_acquire);
+    }
+
+    /// @brief Replace the current forest. Concurrent calls of get() return either the previous or the new forest.
+    void publish(SnapshotT forest)
+    {
+        SnapshotT previous_forest = std::atomic_exchange_explicit(&forest_, std::move(forest), std::memory_order_acq_rel);
+        ++generation_;
+        if (previous_forest)
+        {
+            std::lock_guard<std::mutex> lock(retired_mutex_);
+            retired_forests_.push_back(std::move(previous_forest));
+        }
+        release_unused_forests();
+    }
+
+    /// @brief Load a new forest in the background and publish it when it is loaded.
+    ///        A reload that is still in progress is finished first.
+    ///        If the loader fails, the error is logged and the current forest is kept.
+    void reload(const LoaderT& loader)
+    {
+        wait_for_reload();
+#if AIT_MULTI_THREADING
+        pending_reload_ = std::async(std::launch::async, [this, loader] ()
+        {
+            return load_and_publish(loader);
+        });
+#else
+        load_and_publish(loader);
+#endif
+    }
+
+    /// @brief Return whether a background reload is in progress.
+    bool is_reloading() const
+    {
+#if AIT_MULTI_THREADING
+        return pending_reload_.valid() && pending_reload_.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+#else
+        return false;
+#endif
+    }
+
+    /// @brief Wait for a background reload to finish.
+    /// @return False if the last reload failed (the previous forest is still published).
+    bool wait_for_reload()
+    {
+#if AIT_MULTI_THREADING
+        if (pending_reload_.valid())
+        {
+            last_reload_succeeded_ = pending_reload_.get();
+        }
+#endif
+        return last_reload_succeeded_;
+    }
+
+    /// @brief Release replaced forests that are not referenced by any reader anymore.
+    ///        Call this periodically (e.g. after a reader dropped an old snapshot).
+    /// @return True if all replaced forests were released.
+    bool release_unused_forests()
+    {
+        std::vector<SnapshotT> released_forests;
+        bool all_released;
+        {
+            std::lock_guard<std::mutex> lock(retired_mutex_);
+            for (auto it = retired_forests_.begin(); it != retired_forests_.end();)
+            {
+                if (it->use_count() == 1)
+                {
+                    released_forests.push_back(std::move(*it));
+                    it = retired_forests_.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            all_released = retired_forests_.empty();
+        }
+        // The forests are destroyed outside of the lock.
+        released_forests.clear();
+        return all_released;
+    }
+
+private:
+    bool load_and_publish(const LoaderT& loader)
+    {
+        try
+        {
+            publish(std::make_shared<const TForest>(loader()));
+            return true;
+        }
+        catch (const std::exception& err)
+        {
+            log_error() << "Reloading forest failed, keeping the current forest: " << err.what();
+            return false;
+        }
+    }
+
+    SnapshotT forest_;
+    std::atomic<size_type> generation_;
+    std::mutex retired_mutex_;
+    std::vector<SnapshotT> retired_forests_;
+    bool last_reload_succeeded_ = true;
+#if AIT_MULTI_THREADING
+    std::future<bool> pending_reload_;
+#endif
+};
+
+}
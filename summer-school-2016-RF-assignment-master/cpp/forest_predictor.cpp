@@ -13,6 +13,7 @@
 #include <map>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <cereal/archives/json.hpp>
 #include <cereal/archives/binary.hpp>
 #include <tclap/CmdLine.h>
@@ -23,7 +24,13 @@
 #include "bagging_wrapper.h"
 #include "image_weak_learner.h"
 #include "csv_utils.h"
+#include "matlab_file_io.h"
 #include "evaluation_utils.h"
+#include "native_forest_io.h"
+#include "lazy_forest.h"
+#include "forest_file_io.h"
+#include "dense_predictor.h"
+#include "temporal_predictor.h"
 
 using PixelT = ait::pixel_type;
 using ImageT = ait::Image<PixelT>;
@@ -33,65 +40,329 @@ using SplitPointT = ait::ImageSplitPoint<PixelT>;
 using RandomEngineT = std::mt19937_64;
 
 using ForestT = ait::Forest<SplitPointT, StatisticsT>;
+using MappedForestT = ait::MappedNativeForest<SplitPointT>;
+using LazyForestT = ait::LazyForest<SplitPointT, StatisticsT>;
 using SampleProviderT = ait::ImageSampleProvider<RandomEngineT>;
 using ParametersT = typename SampleProviderT::ParametersT;
 using SampleIteratorT = typename SampleProviderT::SampleIteratorT;
 
+/// @brief Print the per-tree accuracy, the confusion matrix of all pixels and the per-frame confusion matrix.
+void print_evaluation(const ait::ForestEvaluation& evaluation, int num_of_classes)
+{
+    auto logger = ait::log_info(true);
+    logger << "Pixel counts>> ";
+    for (int c = 0; c < num_of_classes; ++c)
+    {
+        if (c > 0)
+        {
+            logger << ", ";
+        }
+        logger << "class " << c << ": " << evaluation.get_class_counts()[c];
+    }
+    logger.close();
+    // Number of prediction matches of the individual trees.
+    ait::size_type match = 0;
+    ait::size_type num_of_votes = 0;
+    for (ait::size_type tree_index = 0; tree_index < evaluation.num_of_trees(); ++tree_index)
+    {
+        ait::size_type tree_match = evaluation.num_of_tree_matches(tree_index);
+        ait::size_type tree_votes = evaluation.num_of_tree_votes(tree_index);
+        ait::log_info() << "Tree " << tree_index << " accuracy: " << tree_match / static_cast<double>(tree_votes)
+            << " (evaluated on " << tree_votes << " pixels)";
+        match += tree_match;
+        num_of_votes += tree_votes;
+    }
+    ait::log_info() << "Match: " << match << ", no match: " << num_of_votes - match;
+    ait::log_info() << "Average number of evaluated trees per pixel: " << evaluation.get_average_num_of_evaluated_trees()
+        << " of " << evaluation.num_of_trees();
+
+    auto confusion_matrix = evaluation.get_confusion_matrix();
+    ait::log_info() << "Confusion matrix:" << std::endl << confusion_matrix;
+    auto norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(confusion_matrix);
+    ait::log_info() << "Normalized confusion matrix:" << std::endl << norm_confusion_matrix;
+    ait::log_info() << "Diagonal of normalized confusion matrix:" << std::endl << norm_confusion_matrix.diagonal();
+    ait::log_info() << "Mean of diagonal of normalized confusion matrix:" << std::endl << norm_confusion_matrix.diagonal().mean();
+
+    auto per_frame_confusion_matrix = evaluation.get_per_frame_confusion_matrix();
+    ait::log_info() << "Per-frame confusion matrix:" << std::endl << per_frame_confusion_matrix;
+    auto per_frame_norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(per_frame_confusion_matrix);
+    ait::log_info() << "Normalized per-frame confusion matrix:" << std::endl << per_frame_norm_confusion_matrix;
+    ait::log_info() << "Diagonal of normalized per-frame confusion matrix:" << std::endl << per_frame_norm_confusion_matrix.diagonal();
+    ait::log_info() << "Mean of diagonal of normalized per-frame confusion matrix:" << std::endl << per_frame_norm_confusion_matrix.diagonal().mean();
+}
+
+/// @brief Fraction of correctly labeled pixels.
+double compute_pixel_accuracy(const ait::ForestEvaluation& evaluation)
+{
+    auto confusion_matrix = evaluation.get_confusion_matrix();
+    return confusion_matrix.trace() / std::max(1.0, confusion_matrix.sum());
+}
+
+/// @brief Print how many pixels the deep forest of a cascade had to evaluate and the compute that the cascade saved.
+///        The shallow trees come first in the evaluation (see CascadeForestUtilities).
+///        Split tests are bounded by the depth of the trees, so their numbers are upper bounds.
+void print_cascade_report(const ait::ForestEvaluation& evaluation, const ForestT& shallow_forest, const ForestT& forest,
+                          double cascade_seconds)
+{
+    const double num_of_pixels = std::max<ait::size_type>(1, evaluation.num_of_samples());
+    ait::size_type num_of_deep_pixels = 0;
+    double cascade_split_tests = 0;
+    for (ait::size_type tree_index = 0; tree_index < evaluation.num_of_trees(); ++tree_index)
+    {
+        const bool is_shallow_tree = tree_index < shallow_forest.size();
+        const ForestT::TreeT& tree = is_shallow_tree ? shallow_forest.get_tree(tree_index) : forest.get_tree(tree_index - shallow_forest.size());
+        cascade_split_tests += evaluation.num_of_tree_votes(tree_index) * (tree.depth() - 1.0);
+        if (!is_shallow_tree)
+        {
+            // The first tree of the deep forest (in evaluation order) is evaluated on every pixel that is passed on.
+            num_of_deep_pixels = std::max(num_of_deep_pixels, evaluation.num_of_tree_votes(tree_index));
+        }
+    }
+    double deep_split_tests = 0;
+    for (auto tree_it = forest.cbegin(); tree_it != forest.cend(); ++tree_it)
+    {
+        deep_split_tests += tree_it->depth() - 1.0;
+    }
+    cascade_split_tests /= num_of_pixels;
+    ait::log_info() << "Cascade: " << shallow_forest.size() << " shallow trees of depth " << shallow_forest.depth()
+        << ", " << forest.size() << " deep trees of depth " << forest.depth();
+    ait::log_info() << "Pixels passed to the deep forest: " << num_of_deep_pixels << " of " << evaluation.num_of_samples()
+        << " (" << 100 * num_of_deep_pixels / num_of_pixels << "%)";
+    ait::log_info() << "Split tests per pixel (at most): " << cascade_split_tests << " with the cascade, "
+        << deep_split_tests << " with the deep forest only (" << 100 * (1 - cascade_split_tests / std::max(1.0, deep_split_tests)) << "% saved)";
+    ait::log_info() << "Pixel accuracy of the cascade: " << compute_pixel_accuracy(evaluation);
+    ait::log_info() << "Evaluation time of the cascade: " << cascade_seconds << " s";
+}
+
+/// @brief Add the labeled pixels (labels below num_of_classes) of a dense prediction to a confusion matrix.
+template <typename TMatrix>
+void update_dense_confusion_matrix(TMatrix& confusion_matrix, const ImageT& image, const ait::DensePrediction& prediction, int num_of_classes)
+{
+    for (ait::offset_type y = 0; y < image.height(); ++y)
+    {
+        for (ait::offset_type x = 0; x < image.width(); ++x)
+        {
+            ait::size_type true_label = image.get_label_matrix()(x, y);
+            if (true_label >= 0 && true_label < num_of_classes)
+            {
+                ait::size_type predicted_label = prediction.labels[y * image.width() + x];
+                ait::EvaluationUtils::update_confusion_matrix(confusion_matrix, true_label, predicted_label);
+            }
+        }
+    }
+}
+
+/// @brief Predict all frames at full resolution and coarse-to-fine and print the pixels, the time and the confusion
+///        matrices of both (see DenseForestPredictor::enable_coarse_to_fine).
+template <typename TLoadImage>
+void print_coarse_to_fine_report(ait::DenseForestPredictor<ForestT>& predictor, ait::size_type coarse_stride,
+                                 ait::size_type num_of_images, int num_of_classes, TLoadImage load_image)
+{
+    Eigen::MatrixXd confusion_matrix = Eigen::MatrixXd::Zero(num_of_classes, num_of_classes);
+    Eigen::MatrixXd coarse_confusion_matrix = Eigen::MatrixXd::Zero(num_of_classes, num_of_classes);
+    double seconds = 0;
+    double coarse_seconds = 0;
+    ait::size_type num_of_pixels = 0;
+    ait::size_type num_of_coarse_evaluated_pixels = 0;
+    ait::size_type num_of_identical_labels = 0;
+    ait::DensePrediction prediction;
+    ait::DensePrediction coarse_prediction;
+    for (ait::size_type i = 0; i < num_of_images; ++i)
+    {
+        ImageT image = load_image(i);
+        prediction.resize(image.width(), image.height(), predictor.num_of_classes(), false);
+        coarse_prediction.resize(image.width(), image.height(), predictor.num_of_classes(), false);
+        predictor.enable_coarse_to_fine(1);
+        auto start_time = std::chrono::steady_clock::now();
+        predictor.predict(image, prediction);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        predictor.enable_coarse_to_fine(coarse_stride);
+        start_time = std::chrono::steady_clock::now();
+        predictor.predict(image, coarse_prediction);
+        coarse_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        update_dense_confusion_matrix(confusion_matrix, image, prediction, num_of_classes);
+        update_dense_confusion_matrix(coarse_confusion_matrix, image, coarse_prediction, num_of_classes);
+        num_of_pixels += prediction.labels.size();
+        num_of_coarse_evaluated_pixels += coarse_prediction.num_of_evaluated_pixels;
+        for (std::size_t j = 0; j < prediction.labels.size(); ++j)
+        {
+            if (prediction.labels[j] == coarse_prediction.labels[j])
+            {
+                ++num_of_identical_labels;
+            }
+        }
+    }
+    const double max_num_of_pixels = std::max<ait::size_type>(1, num_of_pixels);
+    ait::log_info() << "Coarse-to-fine stride " << coarse_stride << ": evaluated " << num_of_coarse_evaluated_pixels << " of "
+        << num_of_pixels << " pixels (" << 100 * num_of_coarse_evaluated_pixels / max_num_of_pixels << "%)";
+    ait::log_info() << "Labels identical to full resolution: " << 100 * num_of_identical_labels / max_num_of_pixels << "%";
+    ait::log_info() << "Prediction time: " << seconds << " s at full resolution, " << coarse_seconds << " s coarse-to-fine (speedup: "
+        << seconds / std::max(coarse_seconds, 1e-9) << "x)";
+    auto norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(confusion_matrix);
+    auto coarse_norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(coarse_confusion_matrix);
+    ait::log_info() << "Normalized dense confusion matrix at full resolution:" << std::endl << norm_confusion_matrix;
+    ait::log_info() << "Normalized dense confusion matrix coarse-to-fine:" << std::endl << coarse_norm_confusion_matrix;
+    ait::log_info() << "Mean of diagonal of normalized dense confusion matrix: " << norm_confusion_matrix.diagonal().mean()
+        << " at full resolution, " << coarse_norm_confusion_matrix.diagonal().mean() << " coarse-to-fine";
+}
+
+/// @brief Predict the frames as a sequence with temporal re-use and each frame on its own and print the evaluated
+///        pixels, the time and the confusion matrices of both (see TemporalDensePredictor).
+template <typename TLoadImage>
+void print_temporal_report(const ait::DenseForestPredictor<ForestT>& predictor, PixelT depth_tolerance, ait::size_type keyframe_interval,
+                           ait::size_type num_of_images, int num_of_classes, TLoadImage load_image)
+{
+    ait::TemporalDensePredictor<ForestT, PixelT> temporal_predictor(predictor, depth_tolerance, keyframe_interval);
+    Eigen::MatrixXd confusion_matrix = Eigen::MatrixXd::Zero(num_of_classes, num_of_classes);
+    Eigen::MatrixXd temporal_confusion_matrix = Eigen::MatrixXd::Zero(num_of_classes, num_of_classes);
+    double seconds = 0;
+    double temporal_seconds = 0;
+    ait::size_type num_of_pixels = 0;
+    ait::size_type num_of_changed_pixels = 0;
+    ait::size_type num_of_temporal_evaluated_pixels = 0;
+    ait::size_type num_of_identical_labels = 0;
+    ait::size_type num_of_identical_frames = 0;
+    ait::DensePrediction prediction;
+    ait::DensePrediction temporal_prediction;
+    for (ait::size_type i = 0; i < num_of_images; ++i)
+    {
+        ImageT image = load_image(i);
+        prediction.resize(image.width(), image.height(), predictor.num_of_classes(), false);
+        temporal_prediction.resize(image.width(), image.height(), predictor.num_of_classes(), false);
+        auto start_time = std::chrono::steady_clock::now();
+        predictor.predict(image, prediction);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        start_time = std::chrono::steady_clock::now();
+        temporal_predictor.predict(image, temporal_prediction);
+        temporal_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        update_dense_confusion_matrix(confusion_matrix, image, prediction, num_of_classes);
+        update_dense_confusion_matrix(temporal_confusion_matrix, image, temporal_prediction, num_of_classes);
+        num_of_pixels += prediction.labels.size();
+        num_of_changed_pixels += temporal_predictor.num_of_changed_pixels();
+        num_of_temporal_evaluated_pixels += temporal_prediction.num_of_evaluated_pixels;
+        ait::size_type num_of_identical_frame_labels = 0;
+        for (std::size_t j = 0; j < prediction.labels.size(); ++j)
+        {
+            if (prediction.labels[j] == temporal_prediction.labels[j])
+            {
+                ++num_of_identical_frame_labels;
+            }
+        }
+        num_of_identical_labels += num_of_identical_frame_labels;
+        if (num_of_identical_frame_labels == static_cast<ait::size_type>(prediction.labels.size()))
+        {
+            ++num_of_identical_frames;
+        }
+    }
+    const double max_num_of_pixels = std::max<ait::size_type>(1, num_of_pixels);
+    ait::log_info() << "Temporal prediction with depth tolerance " << depth_tolerance << ": " << num_of_changed_pixels << " of "
+        << num_of_pixels << " pixels changed (" << 100 * num_of_changed_pixels / max_num_of_pixels << "%), evaluated "
+        << num_of_temporal_evaluated_pixels << " pixels (" << 100 * num_of_temporal_evaluated_pixels / max_num_of_pixels << "%)";
+    ait::log_info() << "Labels identical to per-frame prediction: " << 100 * num_of_identical_labels / max_num_of_pixels << "% ("
+        << num_of_identical_frames << " of " << num_of_images << " frames identical)";
+    ait::log_info() << "Prediction time: " << seconds << " s per frame, " << temporal_seconds << " s with temporal re-use (speedup: "
+        << seconds / std::max(temporal_seconds, 1e-9) << "x)";
+    auto norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(confusion_matrix);
+    auto temporal_norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(temporal_confusion_matrix);
+    ait::log_info() << "Normalized dense confusion matrix per frame:" << std::endl << norm_confusion_matrix;
+    ait::log_info() << "Normalized dense confusion matrix with temporal re-use:" << std::endl << temporal_norm_confusion_matrix;
+    ait::log_info() << "Mean of diagonal of normalized dense confusion matrix: " << norm_confusion_matrix.diagonal().mean()
+        << " per frame, " << temporal_norm_confusion_matrix.diagonal().mean() << " with temporal re-use";
+}
+
 int main(int argc, const char* argv[]) {
     try {
         // Parse command line arguments.
         TCLAP::CmdLine cmd("Random forest predictor", ' ', "0.3");
-        TCLAP::ValueArg<std::string> image_list_file_arg("f", "image-list-file", "File containing the names of image files", true, "", "string", cmd);
+        TCLAP::ValueArg<std::string> image_list_file_arg("f", "image-list-file", "File containing the names of image files", true, "", "string");
+        TCLAP::ValueArg<std::string> mat_file_arg("", "mat-file", "MAT-file containing the data and label images", true, "", "string");
+        TCLAP::ValueArg<std::string> mat_label_array_arg("", "mat-label-array", "Name of the label array in the MAT-file", false, "labels", "string", cmd);
         TCLAP::ValueArg<int> num_of_classes_arg("n", "num-of-classes", "Number of classes in the data", true, 1, "int", cmd);
         TCLAP::ValueArg<std::string> json_forest_file_arg("j", "json-forest-file", "JSON file of the forest to load", false, "forest.json", "string");
         TCLAP::ValueArg<std::string> binary_forest_file_arg("b", "binary-forest-file", "Binary file of the forest to load", false, "forest.bin", "string");
+        TCLAP::ValueArg<std::string> shared_forest_arg("", "shared-forest", "Name of a shared memory object with a native forest to map (see forest_converter --shared-memory-name)", false, "", "string");
+        TCLAP::ValueArg<std::string> lazy_forest_file_arg("", "lazy-forest-file", "Native forest file whose deep tree levels are loaded on demand during the evaluation", false, "", "string");
+        TCLAP::ValueArg<int> lazy_eager_depth_arg("", "lazy-eager-depth", "With --lazy-forest-file, number of tree levels that are loaded on startup", false, 8, "int", cmd);
+        TCLAP::SwitchArg lazy_load_all_switch("", "lazy-load-all", "With --lazy-forest-file, load all tree levels before the evaluation", cmd, false);
         TCLAP::ValueArg<int> background_label_arg("l", "background-label", "Lower bound of background labels to be ignored", false, -1, "int", cmd);
-        cmd.xorAdd(json_forest_file_arg, binary_forest_file_arg);
+        TCLAP::SwitchArg product_switch("", "product", "Combine the trees by the product of their posteriors instead of the mean", cmd, false);
+        TCLAP::SwitchArg early_exit_switch("", "early-exit", "Stop evaluating the trees of a pixel once its label is decided", cmd, false);
+        TCLAP::ValueArg<double> early_exit_confidence_arg("", "early-exit-confidence", "With --early-exit, also stop once the posterior of the leading class reaches this value (within (1/num-of-classes, 1))", false, 1.0, "double", cmd);
+        TCLAP::ValueArg<std::string> cascade_forest_file_arg("", "cascade-forest-file", "Binary file of a shallow forest that is evaluated first (see depth_forest_trainer --cascade-forest-file)", false, "", "string", cmd);
+        TCLAP::ValueArg<int> cascade_depth_arg("", "cascade-depth", "Use the upper levels of the forest up to this depth as the shallow forest of a cascade", false, 10, "int", cmd);
+        TCLAP::ValueArg<double> cascade_entropy_threshold_arg("", "cascade-entropy-threshold", "Pixels with a larger normalized posterior entropy in the shallow forest are passed to the deep forest", false, 0.5, "double", cmd);
+        TCLAP::SwitchArg cascade_baseline_switch("", "cascade-baseline", "Also evaluate the deep forest alone to compare its accuracy and running time with the cascade", cmd, false);
+        TCLAP::ValueArg<int> coarse_stride_arg("", "coarse-stride", "Also compare dense prediction at full resolution with coarse-to-fine prediction on every n-th pixel", false, 4, "int", cmd);
+        TCLAP::ValueArg<int> temporal_tolerance_arg("", "temporal-tolerance", "Also predict the images as a recorded sequence and only re-evaluate pixels near depth changes larger than this value", false, 0, "int", cmd);
+        TCLAP::ValueArg<int> temporal_keyframe_interval_arg("", "temporal-keyframe-interval", "With --temporal-tolerance, predict every n-th frame completely (0 for only the first frame)", false, 0, "int", cmd);
+#if AIT_MULTI_THREADING
+        TCLAP::ValueArg<int> num_of_threads_arg("t", "threads", "Number of threads to use for the evaluation", false, -1, "int", cmd);
+#endif
+        std::vector<TCLAP::Arg*> forest_args = {&json_forest_file_arg, &binary_forest_file_arg, &shared_forest_arg, &lazy_forest_file_arg};
+        cmd.xorAdd(forest_args);
+        cmd.xorAdd(image_list_file_arg, mat_file_arg);
         cmd.parse(argc, argv);
         
         const int num_of_classes = num_of_classes_arg.getValue();
+        int num_of_threads = -1;
+#if AIT_MULTI_THREADING
+        num_of_threads = num_of_threads_arg.getValue();
+#endif
         const std::string image_list_file = image_list_file_arg.getValue();
         
         // Read image file list
-        ait::log_info(false) << "Reading image list ... " << std::flush;
         std::vector<std::tuple<std::string, std::string>> image_list;
-        std::ifstream ifile(image_list_file);
-        if (!ifile.good())
-        {
-            throw std::runtime_error("Unable to open image list file");
-        }
-        ait::CSVReader<std::string> csv_reader(ifile);
-        for (auto it = csv_reader.begin(); it != csv_reader.end(); ++it)
+        if (image_list_file_arg.isSet())
         {
-            if (it->size() != 2)
-            {
-                cmd.getOutput()->usage(cmd);
-                ait::log_error() << "Image list file should contain two columns with the data and label filenames.";
-                exit(-1);
-            }
-            const std::string& data_filename = (*it)[0];
-            const std::string& label_filename = (*it)[1];
-            
-            boost::filesystem::path data_path = boost::filesystem::path(data_filename);
-            boost::filesystem::path label_path = boost::filesystem::path(label_filename);
-            if (!data_path.is_absolute())
+            ait::log_info(false) << "Reading image list ... " << std::flush;
+            if (!boost::filesystem::exists(image_list_file))
             {
-                data_path = boost::filesystem::path(image_list_file).parent_path();
-                data_path /= data_filename;
+                throw std::runtime_error("Unable to open image list file");
             }
-            if (!label_path.is_absolute())
+            const std::string image_list_directory = boost::filesystem::path(image_list_file).parent_path().string();
+            ait::MappedCSVReader<> csv_reader(image_list_file);
+            for (auto it = csv_reader.begin(); it != csv_reader.end(); ++it)
             {
-                label_path = boost::filesystem::path(image_list_file).parent_path();
-                label_path /= label_filename;
+                if (it->size() != 2)
+                {
+                    cmd.getOutput()->usage(cmd);
+                    ait::log_error() << "Image list file should contain two columns with the data and label filenames.";
+                    exit(-1);
+                }
+                std::string data_path = ait::resolve_path(image_list_directory, (*it)[0]);
+                std::string label_path = ait::resolve_path(image_list_directory, (*it)[1]);
+                image_list.push_back(std::make_tuple(std::move(data_path), std::move(label_path)));
             }
-            
-            image_list.push_back(std::make_tuple(data_path.string(), label_path.string()));
+            ait::log_info(false) << " Done." << std::endl;
         }
-        ait::log_info(false) << " Done." << std::endl;
 
         ForestT forest;
+        std::unique_ptr<MappedForestT> shared_forest;
+        std::unique_ptr<LazyForestT> lazy_forest;
+        // Map a native forest from shared memory (the forest is not copied into this process).
+        if (shared_forest_arg.isSet())
+        {
+            ait::log_info(false) << "Mapping shared forest " << shared_forest_arg.getValue() << "... " << std::flush;
+            shared_forest.reset(new MappedForestT(shared_forest_arg.getValue(), ait::NativeForestSource::SHARED_MEMORY));
+            ait::log_info(false) << " Done." << std::endl;
+        }
+        // Load the upper levels of a native forest file. The deeper levels are loaded in the background when they are reached.
+        else if (lazy_forest_file_arg.isSet())
+        {
+            ait::log_info(false) << "Loading lazy forest file " << lazy_forest_file_arg.getValue() << "... " << std::flush;
+            auto load_start_time = std::chrono::steady_clock::now();
+            lazy_forest.reset(new LazyForestT(lazy_forest_file_arg.getValue(), lazy_eager_depth_arg.getValue()));
+            if (lazy_load_all_switch.getValue())
+            {
+                lazy_forest->load_all();
+            }
+            double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start_time).count();
+            ait::log_info(false) << " Done." << std::endl;
+            ait::log_info() << "Loading time of the lazy forest: " << load_seconds << " s ("
+                << lazy_forest->num_of_loaded_subtrees() << " of " << lazy_forest->num_of_subtrees() << " subtrees loaded)";
+        }
         // Read forest from JSON file.
-        if (json_forest_file_arg.isSet())
+        else if (json_forest_file_arg.isSet())
         {
             {
                 ait::log_info(false) << "Reading json forest file " << json_forest_file_arg.getValue() << "... " << std::flush;
@@ -101,22 +372,44 @@ int main(int argc, const char* argv[]) {
                 ait::log_info(false) << " Done." << std::endl;
             }
         }
-        // Read forest from binary file.
+        // Read forest from a binary, native, indexed or stream forest file.
         else if (binary_forest_file_arg.isSet())
         {
-            {
-                ait::log_info(false) << "Reading binary forest file " << binary_forest_file_arg.getValue() << "... " << std::flush;
-                std::ifstream ifile(binary_forest_file_arg.getValue(), std::ios_base::binary);
-                cereal::BinaryInputArchive iarchive(ifile);
-                iarchive(cereal::make_nvp("forest", forest));
-                ait::log_info(false) << " Done." << std::endl;
-            }
+            ait::log_info(false) << "Reading binary forest file " << binary_forest_file_arg.getValue() << "... " << std::flush;
+            forest = ait::read_forest_file<ForestT>(binary_forest_file_arg.getValue());
+            ait::log_info(false) << " Done." << std::endl;
         }
         else
         {
             throw("This should never happen. Either a JSON or a binary forest file have to be specified!");
         }
 
+        // Optionally: Read or cut the shallow forest of a cascade.
+        const bool cascade = cascade_forest_file_arg.isSet() || cascade_depth_arg.isSet();
+        ForestT shallow_forest;
+        if (cascade && (shared_forest || lazy_forest))
+        {
+            throw std::runtime_error("A cascade is not supported for shared or lazy forests.");
+        }
+        if (cascade_forest_file_arg.isSet() && cascade_depth_arg.isSet())
+        {
+            throw std::runtime_error("Either a cascade forest file or a cascade depth can be specified.");
+        }
+        if (cascade_forest_file_arg.isSet())
+        {
+            ait::log_info(false) << "Reading cascade forest file " << cascade_forest_file_arg.getValue() << "... " << std::flush;
+            shallow_forest = ait::read_forest_file<ForestT>(cascade_forest_file_arg.getValue());
+            ait::log_info(false) << " Done." << std::endl;
+        }
+        else if (cascade_depth_arg.isSet())
+        {
+            if (cascade_depth_arg.getValue() < 1 || cascade_depth_arg.getValue() >= forest.depth())
+            {
+                throw std::runtime_error("The cascade depth must be between 1 and the tree depth.");
+            }
+            shallow_forest = forest.get_truncated_forest(cascade_depth_arg.getValue());
+        }
+
 
 #if AIT_TESTING
         RandomEngineT rnd_engine(11);
@@ -126,8 +419,6 @@ int main(int argc, const char* argv[]) {
         RandomEngineT rnd_engine(rnd_device());
 #endif
 
-        // Compute some stats and print them.
-        ait::log_info(false) << "Creating samples for testing ... " << std::flush;
         ParametersT parameters;
         ait::label_type background_label;
         if (background_label_arg.isSet())
@@ -139,54 +430,149 @@ int main(int argc, const char* argv[]) {
             background_label = num_of_classes;
         }
         parameters.background_label = background_label;
-        SampleProviderT sample_provider(image_list, parameters);
-        sample_provider.clear_samples();
-        for (int i = 0; i < image_list.size(); ++i)
+        // Pad images so that all feature offsets of the forest stay within the guard border.
+        if (shared_forest)
+        {
+            parameters.image_border = shared_forest->compute_max_split_point_offset();
+        }
+        else if (lazy_forest)
+        {
+            parameters.image_border = lazy_forest->compute_max_split_point_offset();
+        }
+        else
+        {
+            parameters.image_border = ait::compute_max_split_point_offset(forest);
+        }
+        if (cascade)
+        {
+            parameters.image_border = std::max(parameters.image_border, ait::compute_max_split_point_offset(shallow_forest));
+        }
+        // Evaluate all (non-background) pixels of each frame.
+        parameters.samples_per_image_fraction = 1.0;
+        // Optionally: Load all images from a MAT-file.
+        std::shared_ptr<const std::vector<ImageT>> images;
+        if (mat_file_arg.isSet())
+        {
+            images = std::make_shared<const std::vector<ImageT>>(ait::load_images_from_matlab_file<PixelT>(
+                mat_file_arg.getValue(), "data", mat_label_array_arg.getValue(), parameters.image_border, parameters.background_value));
+        }
+        SampleProviderT sample_provider = images ? SampleProviderT(images, parameters) : SampleProviderT(image_list, parameters);
+
+        // Compute the per-tree matches and the confusion matrices in a single pass over each frame.
+        ait::log_info(false) << "Evaluating forest on " << sample_provider.num_of_images() << " frames ... " << std::flush;
+        const ait::PosteriorAggregation aggregation = product_switch.getValue() ? ait::PosteriorAggregation::PRODUCT : ait::PosteriorAggregation::SUM;
+        std::unique_ptr<ait::ForestEvaluation> evaluation;
+        auto start_time = std::chrono::steady_clock::now();
+        if (shared_forest)
+        {
+            if (early_exit_switch.getValue())
+            {
+                ait::log_warning() << "Early exit is not supported for shared forests and is ignored.";
+            }
+            evaluation.reset(new ait::ForestEvaluation(ait::EvaluationUtils::evaluate_frames_parallel(
+                ait::make_mapped_forest_utils<StatisticsT>(*shared_forest, aggregation), sample_provider, rnd_engine, num_of_threads)));
+        }
+        else if (lazy_forest)
+        {
+            if (early_exit_switch.getValue())
+            {
+                ait::log_warning() << "Early exit is not supported for lazy forests and is ignored.";
+            }
+            evaluation.reset(new ait::ForestEvaluation(ait::EvaluationUtils::evaluate_frames_parallel(
+                ait::make_mapped_forest_utils<StatisticsT>(*lazy_forest, aggregation), sample_provider, rnd_engine, num_of_threads)));
+        }
+        else if (cascade)
+        {
+            auto cascade_forest_utils = ait::make_cascade_forest_utils(shallow_forest, forest, cascade_entropy_threshold_arg.getValue(), aggregation);
+            if (early_exit_switch.getValue())
+            {
+                cascade_forest_utils.enable_early_exit(early_exit_confidence_arg.getValue());
+            }
+            evaluation.reset(new ait::ForestEvaluation(ait::EvaluationUtils::evaluate_frames_parallel(
+                cascade_forest_utils, sample_provider, rnd_engine, num_of_threads)));
+        }
+        else
         {
-            sample_provider.load_samples_from_image(i, rnd_engine);
+            auto forest_utils = ait::make_forest_utils(forest, aggregation);
+            if (early_exit_switch.getValue())
+            {
+                forest_utils.enable_early_exit(early_exit_confidence_arg.getValue());
+            }
+            evaluation.reset(new ait::ForestEvaluation(ait::EvaluationUtils::evaluate_frames_parallel(
+                forest_utils, sample_provider, rnd_engine, num_of_threads)));
         }
-        SampleIteratorT samples_start = sample_provider.get_samples_begin();
-        SampleIteratorT samples_end = sample_provider.get_samples_end();
+        double elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
         ait::log_info(false) << " Done." << std::endl;
+        print_evaluation(*evaluation, num_of_classes);
+        if (lazy_forest)
+        {
+            // Pixels that reached a subtree before it was loaded were predicted from the node at the eager depth.
+            ait::log_info() << "Subtrees of the lazy forest loaded after the evaluation: "
+                << lazy_forest->num_of_loaded_subtrees() << " of " << lazy_forest->num_of_subtrees();
+        }
 
-        std::vector<ait::size_type> sample_counts(num_of_classes, 0);
-        for (auto sample_it = samples_start; sample_it != samples_end; sample_it++)
+        if (cascade)
         {
-            ++sample_counts[sample_it->get_label()];
+            print_cascade_report(*evaluation, shallow_forest, forest, elapsed_seconds);
         }
-        auto logger = ait::log_info(true);
-        logger << "Sample counts>> ";
-        for (int c = 0; c < num_of_classes; ++c)
+        // Optionally: Evaluate the deep forest alone to measure the speedup of the cascade.
+        if (cascade && cascade_baseline_switch.getValue())
         {
-            if (c > 0)
+            ait::log_info(false) << "Evaluating deep forest without cascade ... " << std::flush;
+            auto forest_utils = ait::make_forest_utils(forest, aggregation);
+            if (early_exit_switch.getValue())
             {
-                logger << ", ";
+                forest_utils.enable_early_exit(early_exit_confidence_arg.getValue());
             }
-            logger << "class " << c << ": " << sample_counts[c];
+            start_time = std::chrono::steady_clock::now();
+            ait::ForestEvaluation baseline_evaluation = ait::EvaluationUtils::evaluate_frames_parallel(
+                forest_utils, sample_provider, rnd_engine, num_of_threads);
+            double baseline_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            ait::log_info(false) << " Done." << std::endl;
+            ait::log_info() << "Pixel accuracy of the deep forest: " << compute_pixel_accuracy(baseline_evaluation);
+            ait::log_info() << "Evaluation time of the deep forest: " << baseline_seconds << " s (cascade speedup: "
+                << baseline_seconds / std::max(elapsed_seconds, 1e-9) << "x)";
         }
-        logger.close();
-        // For each tree extract leaf node indices for each sample.
-        std::vector<std::vector<ait::size_type>> forest_leaf_indices = forest.evaluate(samples_start, samples_end);
-        
-        // Compute number of prediction matches based on a majority vote among the forest.
-        int match = 0;
-        int no_match = 0;
-        for (auto tree_it = forest.cbegin(); tree_it != forest.cend(); ++tree_it)
+
+        // Optionally: Report the speed and accuracy of temporal re-use and of coarse-to-fine prediction.
+        if (coarse_stride_arg.isSet() || temporal_tolerance_arg.isSet())
         {
-            for (auto sample_it = samples_start; sample_it != samples_end; sample_it++)
+            if (shared_forest || lazy_forest)
+            {
+                throw std::runtime_error("Dense prediction is not supported for shared or lazy forests.");
+            }
+            std::unique_ptr<ait::DenseForestPredictor<ForestT>> predictor;
+            if (cascade)
+            {
+                predictor.reset(new ait::DenseForestPredictor<ForestT>(shallow_forest, forest, cascade_entropy_threshold_arg.getValue(), num_of_threads, aggregation));
+            }
+            else
             {
-                const auto &node_it = tree_it->cbegin() + (forest_leaf_indices[tree_it - forest.cbegin()][sample_it - samples_start]);
-                const auto &statistics = node_it->get_statistics();
-                auto max_it = std::max_element(statistics.get_histogram().cbegin(), statistics.get_histogram().cend());
-                auto label = max_it - statistics.get_histogram().cbegin();
-                if (label == sample_it->get_label())
-                    match++;
-                else
-                    no_match++;
+                predictor.reset(new ait::DenseForestPredictor<ForestT>(forest, num_of_threads, aggregation));
+            }
+            if (early_exit_switch.getValue())
+            {
+                predictor->enable_early_exit(early_exit_confidence_arg.getValue());
+            }
+            auto load_image = [&] (ait::size_type i)
+            {
+                if (images)
+                {
+                    return (*images)[i];
+                }
+                return ImageT::load_from_files(std::get<0>(image_list[i]), std::get<1>(image_list[i]), parameters.image_border, parameters.background_value);
+            };
+            if (temporal_tolerance_arg.isSet())
+            {
+                print_temporal_report(*predictor, temporal_tolerance_arg.getValue(), temporal_keyframe_interval_arg.getValue(),
+                                      sample_provider.num_of_images(), num_of_classes, load_image);
+            }
+            if (coarse_stride_arg.isSet())
+            {
+                print_coarse_to_fine_report(*predictor, coarse_stride_arg.getValue(), sample_provider.num_of_images(), num_of_classes, load_image);
             }
         }
-        ait::log_info() << "Match: " << match << ", no match: " << no_match;
-        
+
 //        // Compute single-tree confusion matrix.
 //        auto tree_utils = ait::make_tree_utils(*forest.begin());
 //        auto single_tree_confusion_matrix = tree_utils.compute_confusion_matrix(samples_start, samples_end);
@@ -195,15 +581,6 @@ int main(int argc, const char* argv[]) {
 //        ait::log_info() << "Single-tree normalized confusion matrix:" << std::endl << single_tree_norm_confusion_matrix;
 //        ait::log_info() << "Single-tree diagonal of normalized confusion matrix:" << std::endl << single_tree_norm_confusion_matrix.diagonal();
 
-        // Compute confusion matrix.
-        auto forest_utils = ait::make_forest_utils(forest);
-        auto confusion_matrix = forest_utils.compute_confusion_matrix(samples_start, samples_end);
-        ait::log_info() << "Confusion matrix:" << std::endl << confusion_matrix;
-        auto norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(confusion_matrix);
-        ait::log_info() << "Normalized confusion matrix:" << std::endl << norm_confusion_matrix;
-        ait::log_info() << "Diagonal of normalized confusion matrix:" << std::endl << norm_confusion_matrix.diagonal();
-        ait::log_info() << "Mean of diagonal of normalized confusion matrix:" << std::endl << norm_confusion_matrix.diagonal().mean();
-        
 //        using ConfusionMatrixType = typename decltype(tree_utils)::MatrixType;
 //        // Computing single-tree per-frame confusion matrix
 //        ait::log_info() << "Computing per-frame confusion matrix.";
@@ -227,30 +604,12 @@ int main(int argc, const char* argv[]) {
 //        ait::log_info() << "Single-tree normalized per-frame confusion matrix:" << std::endl << per_frame_single_tree_norm_confusion_matrix;
 //        ait::log_info() << "Single-tree diagonal of normalized per-frame confusion matrix:" << std::endl << per_frame_single_tree_norm_confusion_matrix.diagonal();
 //        ait::log_info() << "Single-tree mean of diagonal of normalized per-frame confusion matrix:" << std::endl << per_frame_single_tree_norm_confusion_matrix.diagonal().mean();
-        
-        using ConfusionMatrixType = typename decltype(forest_utils)::MatrixType;
-        // Computing per-frame confusion matrix
-        ait::log_info() << "Computing per-frame confusion matrix.";
-        ConfusionMatrixType per_frame_confusion_matrix(num_of_classes, num_of_classes);
-        per_frame_confusion_matrix.setZero();
-        // TODO: This should be configurable by input file
-        ParametersT full_parameters(parameters);
-        // Modify parameters to retrieve all pixels per sample
-        full_parameters.samples_per_image_fraction = 1.0;
-        SampleProviderT full_sample_provider(image_list, full_parameters);
-        for (int i = 0; i < image_list.size(); ++i)
-        {
-            full_sample_provider.clear_samples();
-            full_sample_provider.load_samples_from_image(i, rnd_engine);
-            samples_start = full_sample_provider.get_samples_begin();
-            samples_end = full_sample_provider.get_samples_end();
-            forest_utils.update_confusion_matrix(per_frame_confusion_matrix, samples_start, samples_end);
-        }
-        ait::log_info() << "Per-frame confusion matrix:" << std::endl << per_frame_confusion_matrix;
-        ConfusionMatrixType per_frame_norm_confusion_matrix = ait::EvaluationUtils::normalize_confusion_matrix(per_frame_confusion_matrix);
-        ait::log_info() << "Normalized per-frame confusion matrix:" << std::endl << per_frame_norm_confusion_matrix;
-        ait::log_info() << "Diagonal of normalized per-frame confusion matrix:" << std::endl << per_frame_norm_confusion_matrix.diagonal();
-        ait::log_info() << "Mean of diagonal of normalized per-frame confusion matrix:" << std::endl << per_frame_norm_confusion_matrix.diagonal().mean();
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "Runtime exception occured" << std::endl;
+        std::cerr << error.what() << std::endl;
+        return 1;
     }
     catch (const TCLAP::ArgException &e)
     {
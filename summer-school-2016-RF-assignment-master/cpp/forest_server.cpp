@@ -0,0 +1,607 @@
+//
+//  forest_server.cpp
+//  DistRandomForest
+//
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <tclap/CmdLine.h>
+
+#include "ait.h"
+#include "logger.h"
+#include "forest.h"
+#include "histogram_statistics.h"
+#include "image_weak_learner.h"
+#include "forest_file_io.h"
+#include "forest_handle.h"
+#include "dense_predictor.h"
+#include "foreground_mask.h"
+#include "prediction_protocol.h"
+
+using PixelT = ait::pixel_type;
+using ImageT = ait::Image<PixelT>;
+using StatisticsT = ait::HistogramStatistics;
+using SplitPointT = ait::ImageSplitPoint<PixelT>;
+using ForestT = ait::Forest<SplitPointT, StatisticsT>;
+using PredictorT = ait::DenseForestPredictor<ForestT>;
+
+namespace
+{
+
+/// @brief A forest together with its predictor. Both are built by the loader, so the dispatcher only swaps a pointer.
+struct ServedForest
+{
+    std::shared_ptr<const ForestT> forest;
+    // The predictor refers to the forest and is declared after it, so it is destroyed first.
+    std::shared_ptr<const PredictorT> predictor;
+};
+
+using ForestHandleT = ait::ForestHandle<ServedForest>;
+
+std::atomic<bool> stop_requested(false);
+std::atomic<bool> reload_requested(false);
+
+void handle_stop_signal(int)
+{
+    stop_requested = true;
+}
+
+void handle_reload_signal(int)
+{
+    reload_requested = true;
+}
+
+/// @brief Return the value of a depth option. Values that do not fit into a pixel are rejected instead of wrapping around.
+PixelT get_pixel_value(TCLAP::ValueArg<int>& arg)
+{
+    if (arg.getValue() < std::numeric_limits<PixelT>::min() || arg.getValue() > std::numeric_limits<PixelT>::max())
+    {
+        throw std::runtime_error("The value of --" + arg.getName() + " must be within [" + std::to_string(std::numeric_limits<PixelT>::min())
+                                 + ", " + std::to_string(std::numeric_limits<PixelT>::max()) + "].");
+    }
+    return static_cast<PixelT>(arg.getValue());
+}
+
+/// @brief Writes the responses of a client in a writer thread, so that a client that does not read its responses
+///        cannot stall the dispatcher. A client with too many unread responses is disconnected.
+///        The file descriptors of the client are closed when the writer is destroyed.
+class ResponseWriter
+{
+public:
+    ResponseWriter(int input_fd, int output_fd, std::size_t max_num_of_responses)
+    : input_fd_(input_fd), output_fd_(output_fd), max_num_of_responses_(max_num_of_responses), is_closed_(false), is_broken_(false)
+    {}
+
+    ~ResponseWriter()
+    {
+        ::close(input_fd_);
+        if (output_fd_ != input_fd_)
+        {
+            ::close(output_fd_);
+        }
+    }
+
+    int input_fd() const
+    {
+        return input_fd_;
+    }
+
+    /// @brief Queue a response. Never blocks.
+    void push(std::vector<char> message)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_broken_)
+        {
+            return;
+        }
+        if (responses_.size() >= max_num_of_responses_)
+        {
+            ait::log_warning() << "Closing connection: The client does not read its responses.";
+            break_connection();
+            return;
+        }
+        responses_.push_back(std::move(message));
+        condition_.notify_one();
+    }
+
+    /// @brief Let the writer thread finish once all queued responses are written.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_closed_ = true;
+        condition_.notify_one();
+    }
+
+    /// @brief Write the queued responses until the writer is closed or the connection fails.
+    void run()
+    {
+        while (true)
+        {
+            std::vector<char> message;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this] () { return !responses_.empty() || is_closed_ || is_broken_; });
+                if (is_broken_ || responses_.empty())
+                {
+                    return;
+                }
+                message = std::move(responses_.front());
+                responses_.pop_front();
+            }
+            try
+            {
+                ait::write_message(output_fd_, message);
+            }
+            catch (const std::runtime_error& error)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                // A write also fails after push() has shut the connection down.
+                if (!is_broken_)
+                {
+                    ait::log_warning() << "Closing connection: " << error.what();
+                    break_connection();
+                }
+                return;
+            }
+        }
+    }
+
+private:
+    /// @brief Drop all responses and shut the socket down, which also stops the reader and a blocked write.
+    void break_connection()
+    {
+        is_broken_ = true;
+        responses_.clear();
+        ::shutdown(input_fd_, SHUT_RDWR);
+        condition_.notify_one();
+    }
+
+    int input_fd_;
+    int output_fd_;
+    std::size_t max_num_of_responses_;
+    bool is_closed_;
+    bool is_broken_;
+    std::deque<std::vector<char>> responses_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+};
+
+void write_responses(std::shared_ptr<ResponseWriter> writer)
+{
+    writer->run();
+}
+
+/// @brief A client connection. Requests are read by a reader thread, responses are queued for the writer thread.
+///        The writer is closed when the last reference to the connection (reader or pending request) is dropped.
+class Connection
+{
+public:
+    explicit Connection(std::shared_ptr<ResponseWriter> writer)
+    : writer_(std::move(writer))
+    {}
+
+    ~Connection()
+    {
+        writer_->close();
+    }
+
+    int input_fd() const
+    {
+        return writer_->input_fd();
+    }
+
+    void write_response(std::vector<char> message)
+    {
+        writer_->push(std::move(message));
+    }
+
+private:
+    std::shared_ptr<ResponseWriter> writer_;
+};
+
+struct PendingRequest
+{
+    std::shared_ptr<Connection> connection;
+    std::vector<char> message;
+};
+
+/// @brief Requests of all clients wait here until the dispatcher takes them as a batch.
+class RequestQueue
+{
+public:
+    explicit RequestQueue(std::size_t max_size)
+    : max_size_(max_size), num_of_readers_(0)
+    {}
+
+    /// @brief Add a request. Blocks while the queue is full.
+    void push(PendingRequest request)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] () { return queue_.size() < max_size_ || stop_requested; });
+        queue_.push_back(std::move(request));
+        not_empty_.notify_one();
+    }
+
+    /// @brief Take up to max_batch_size requests. Returns an empty batch after the timeout.
+    std::vector<PendingRequest> pop_batch(std::size_t max_batch_size, std::chrono::milliseconds timeout)
+    {
+        std::vector<PendingRequest> batch;
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait_for(lock, timeout, [this] () { return !queue_.empty(); });
+        while (!queue_.empty() && batch.size() < max_batch_size)
+        {
+            batch.push_back(std::move(queue_.front()));
+            queue_.pop_front();
+        }
+        not_full_.notify_all();
+        return batch;
+    }
+
+    void add_reader()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++num_of_readers_;
+    }
+
+    void remove_reader()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --num_of_readers_;
+        not_empty_.notify_one();
+    }
+
+    /// @brief Return whether all readers are finished and all requests were taken.
+    bool is_drained()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return num_of_readers_ == 0 && queue_.empty();
+    }
+
+private:
+    std::size_t max_size_;
+    int num_of_readers_;
+    std::deque<PendingRequest> queue_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+void read_requests(std::shared_ptr<Connection> connection, RequestQueue& queue)
+{
+    try
+    {
+        std::vector<char> message;
+        while (!stop_requested && ait::read_message(connection->input_fd(), message))
+        {
+            queue.push(PendingRequest{connection, std::move(message)});
+            message = std::vector<char>();
+        }
+    }
+    catch (const std::exception& error)
+    {
+        ait::log_warning() << "Closing connection: " << error.what();
+    }
+    queue.remove_reader();
+}
+
+void accept_connections(int server_fd, RequestQueue& queue, std::size_t max_num_of_responses)
+{
+    while (!stop_requested)
+    {
+        int client_fd = ::accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0)
+        {
+            if (errno != EINTR && !stop_requested)
+            {
+                ait::log_error() << "Accepting connection failed: " << std::strerror(errno);
+            }
+            continue;
+        }
+        auto writer = std::make_shared<ResponseWriter>(client_fd, client_fd, max_num_of_responses);
+        std::thread(write_responses, writer).detach();
+        auto connection = std::make_shared<Connection>(writer);
+        queue.add_reader();
+        std::thread(read_requests, connection, std::ref(queue)).detach();
+    }
+}
+
+int open_server_socket(const std::string& socket_path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path '" + socket_path + "' is too long.");
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    int server_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0)
+    {
+        throw std::runtime_error(std::string("Unable to create socket: ") + std::strerror(errno));
+    }
+    ::unlink(socket_path.c_str());
+    if (::bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(server_fd, 16) < 0)
+    {
+        ::close(server_fd);
+        throw std::runtime_error("Unable to listen on socket '" + socket_path + "': " + std::strerror(errno));
+    }
+    return server_fd;
+}
+
+/// @brief Predict a batch of requests with the current forest and send the responses.
+///        With foreground parameters, only the pixels of the foreground mask of each frame are predicted.
+///        The number of pixels, of foreground pixels and of evaluated trees is added to the counters.
+void process_batch(std::vector<PendingRequest>& batch, const PredictorT& predictor, PixelT background_value,
+                   const ait::ForegroundParameters* foreground_parameters,
+                   ait::size_type& num_of_pixels, ait::size_type& num_of_foreground_pixels, ait::size_type& num_of_evaluated_trees)
+{
+    std::vector<ImageT> images;
+    std::vector<ait::DensePrediction> predictions;
+    std::vector<std::size_t> batch_indices;
+    images.reserve(batch.size());
+    predictions.reserve(batch.size());
+    for (std::size_t i = 0; i < batch.size(); ++i)
+    {
+        try
+        {
+            ait::PredictionRequestHeader header;
+            const PixelT* pixels = ait::decode_prediction_request(batch[i].message, predictor.num_of_classes(), header);
+            const ait::size_type width = header.width;
+            const ait::size_type height = header.height;
+            ImageT image(width, height, predictor.image_border(), background_value);
+            for (ait::offset_type y = 0; y < height; ++y)
+            {
+                std::copy(pixels + y * width, pixels + (y + 1) * width, &image.get_pixel(0, y));
+            }
+            ait::DensePrediction prediction;
+            prediction.resize(width, height, predictor.num_of_classes(), (header.flags & ait::PREDICTION_FLAG_POSTERIORS) != 0);
+            images.push_back(std::move(image));
+            predictions.push_back(std::move(prediction));
+            batch_indices.push_back(i);
+        }
+        catch (const std::exception& error)
+        {
+            batch[i].connection->write_response(ait::encode_prediction_error(error.what()));
+        }
+    }
+
+    std::vector<ait::ForegroundMask> masks(foreground_parameters != nullptr ? images.size() : 0);
+    std::vector<const ImageT*> image_ptrs;
+    std::vector<const ait::ForegroundMask*> mask_ptrs;
+    std::vector<ait::DensePrediction*> prediction_ptrs;
+    for (std::size_t i = 0; i < images.size(); ++i)
+    {
+        image_ptrs.push_back(&images[i]);
+        prediction_ptrs.push_back(&predictions[i]);
+        if (foreground_parameters != nullptr)
+        {
+            masks[i].compute(images[i], *foreground_parameters);
+            mask_ptrs.push_back(&masks[i]);
+            num_of_foreground_pixels += masks[i].num_of_pixels();
+        }
+        else
+        {
+            mask_ptrs.push_back(nullptr);
+            num_of_foreground_pixels += images[i].width() * images[i].height();
+        }
+    }
+    predictor.predict_batch(image_ptrs, mask_ptrs, prediction_ptrs);
+
+    for (std::size_t i = 0; i < predictions.size(); ++i)
+    {
+        const ait::DensePrediction& prediction = predictions[i];
+        num_of_pixels += prediction.labels.size();
+        num_of_evaluated_trees += prediction.num_of_evaluated_trees;
+        batch[batch_indices[i]].connection->write_response(ait::encode_prediction_response(
+            prediction.width, prediction.height, prediction.num_of_classes,
+            prediction.labels.data(), prediction.has_posteriors() ? prediction.posteriors.data() : nullptr));
+    }
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        // Parse command line arguments.
+        TCLAP::CmdLine cmd("Random forest prediction server", ' ', "0.3");
+        TCLAP::ValueArg<std::string> forest_file_arg("f", "forest-file", "Forest file (JSON, binary, stream, native or indexed) to serve", true, "forest.bin", "string", cmd);
+        TCLAP::ValueArg<std::string> socket_arg("s", "socket", "Unix domain socket to listen on", false, "", "string");
+        TCLAP::SwitchArg stdio_switch("", "stdio", "Read requests from stdin and write responses to stdout (log output goes to stderr)", false);
+        TCLAP::ValueArg<int> max_batch_size_arg("", "max-batch-size", "Maximum number of frames that are predicted together (at least 1)", false, 16, "int", cmd);
+        TCLAP::ValueArg<int> max_queue_size_arg("", "max-queue-size", "Maximum number of frames waiting for prediction (also the number of unread responses after which a client is disconnected)", false, 64, "int", cmd);
+        TCLAP::ValueArg<int> background_value_arg("", "background-value", "Depth value outside of the frames", false, 0, "int", cmd);
+        TCLAP::SwitchArg product_switch("", "product", "Combine the trees by the product of their posteriors instead of the mean", cmd, false);
+        TCLAP::SwitchArg early_exit_switch("", "early-exit", "Stop evaluating the trees of a pixel once its label is decided", cmd, false);
+        TCLAP::ValueArg<double> early_exit_confidence_arg("", "early-exit-confidence", "With --early-exit, also stop once the posterior of the leading class reaches this value (within (1/num-of-classes, 1))", false, 1.0, "double", cmd);
+        TCLAP::SwitchArg foreground_switch("", "foreground", "Predict only the foreground pixels of each frame (pixels within the depth range); the other pixels get the label num-of-classes", cmd, false);
+        TCLAP::ValueArg<int> foreground_min_depth_arg("", "foreground-min-depth", "With --foreground, smallest depth of foreground pixels", false, 1, "int", cmd);
+        TCLAP::ValueArg<int> foreground_max_depth_arg("", "foreground-max-depth", "With --foreground, largest depth of foreground pixels", false, std::numeric_limits<PixelT>::max(), "int", cmd);
+        TCLAP::SwitchArg foreground_nearest_blob_switch("", "foreground-nearest-blob", "With --foreground, keep only the connected pixels around the nearest pixel", cmd, false);
+        TCLAP::ValueArg<int> foreground_blob_depth_step_arg("", "foreground-blob-depth-step", "With --foreground-nearest-blob, largest depth difference of neighboring blob pixels", false, 50, "int", cmd);
+        TCLAP::SwitchArg foreground_bounding_box_switch("", "foreground-bounding-box", "With --foreground, predict all pixels within the bounding box of the foreground", cmd, false);
+#if AIT_MULTI_THREADING
+        TCLAP::ValueArg<int> num_of_threads_arg("t", "threads", "Number of threads to use", false, -1, "int", cmd);
+#endif
+        cmd.xorAdd(socket_arg, stdio_switch);
+        cmd.parse(argc, argv);
+
+        if (max_batch_size_arg.getValue() < 1)
+        {
+            throw std::runtime_error("The value of --max-batch-size must be at least 1.");
+        }
+        const PixelT background_value = get_pixel_value(background_value_arg);
+        // Pixels with the background value (i.e. invalid depth) are never foreground.
+        ait::ForegroundParameters foreground_parameters;
+        foreground_parameters.invalid_depth = background_value;
+        foreground_parameters.min_depth = get_pixel_value(foreground_min_depth_arg);
+        foreground_parameters.max_depth = get_pixel_value(foreground_max_depth_arg);
+        foreground_parameters.nearest_blob = foreground_nearest_blob_switch.getValue();
+        foreground_parameters.max_blob_depth_step = get_pixel_value(foreground_blob_depth_step_arg);
+        foreground_parameters.bounding_box = foreground_bounding_box_switch.getValue();
+
+        int response_fd = STDOUT_FILENO;
+        if (stdio_switch.getValue())
+        {
+            // Keep stdout for the responses and send the log output to stderr.
+            response_fd = ::dup(STDOUT_FILENO);
+            ::dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+
+        std::signal(SIGPIPE, SIG_IGN);
+        std::signal(SIGINT, handle_stop_signal);
+        std::signal(SIGTERM, handle_stop_signal);
+        std::signal(SIGHUP, handle_reload_signal);
+
+        ait::int_type num_of_threads = -1;
+#if AIT_MULTI_THREADING
+        num_of_threads = num_of_threads_arg.getValue();
+#endif
+        const ait::PosteriorAggregation aggregation = product_switch.getValue() ? ait::PosteriorAggregation::PRODUCT : ait::PosteriorAggregation::SUM;
+        const std::string forest_file = forest_file_arg.getValue();
+        const bool early_exit = early_exit_switch.getValue();
+        const double early_exit_confidence = early_exit_confidence_arg.getValue();
+        auto load_forest = [forest_file, num_of_threads, aggregation, early_exit, early_exit_confidence] ()
+        {
+            ServedForest served_forest;
+            served_forest.forest = std::make_shared<const ForestT>(ait::read_forest_file<ForestT>(forest_file));
+            std::shared_ptr<PredictorT> predictor = std::make_shared<PredictorT>(*served_forest.forest, num_of_threads, aggregation);
+            if (early_exit)
+            {
+                predictor->enable_early_exit(early_exit_confidence);
+            }
+            served_forest.predictor = std::move(predictor);
+            return served_forest;
+        };
+        ForestHandleT forest_handle;
+        ait::log_info(false) << "Reading forest file " << forest_file << "... " << std::flush;
+        // The first forest is loaded synchronously, so that a bad forest file is reported at startup.
+        forest_handle.publish(std::make_shared<const ServedForest>(load_forest()));
+        ait::log_info(false) << " Done." << std::endl;
+
+        const std::size_t max_queue_size = std::max(1, max_queue_size_arg.getValue());
+        RequestQueue queue(max_queue_size);
+        // A client with more unread responses than the queue can hold is considered stuck.
+        const std::size_t max_num_of_responses = max_queue_size;
+        int server_fd = -1;
+        std::shared_ptr<ResponseWriter> stdio_writer;
+        std::thread stdio_writer_thread;
+        if (socket_arg.isSet())
+        {
+            server_fd = open_server_socket(socket_arg.getValue());
+            std::thread(accept_connections, server_fd, std::ref(queue), max_num_of_responses).detach();
+            ait::log_info() << "Listening on " << socket_arg.getValue() << " (send SIGHUP to reload the forest).";
+        }
+        else
+        {
+            stdio_writer = std::make_shared<ResponseWriter>(STDIN_FILENO, response_fd, max_num_of_responses);
+            stdio_writer_thread = std::thread(write_responses, stdio_writer);
+            auto connection = std::make_shared<Connection>(stdio_writer);
+            queue.add_reader();
+            std::thread(read_requests, connection, std::ref(queue)).detach();
+        }
+
+        ForestHandleT::SnapshotT served_forest;
+        // Replaced forests are destroyed in the background, so that a reload does not delay the next batch.
+        std::future<bool> pending_release;
+        ait::size_type num_of_frames = 0;
+        ait::size_type num_of_pixels = 0;
+        ait::size_type num_of_foreground_pixels = 0;
+        ait::size_type num_of_evaluated_trees = 0;
+        ait::size_type num_of_batches = 0;
+        while (!stop_requested)
+        {
+            if (reload_requested.exchange(false))
+            {
+                ait::log_info() << "Reloading forest file " << forest_file << " in the background.";
+                forest_handle.reload(load_forest);
+            }
+            std::vector<PendingRequest> batch = queue.pop_batch(max_batch_size_arg.getValue(), std::chrono::milliseconds(100));
+            if (batch.empty())
+            {
+                // In stdio mode the server exits when stdin is closed.
+                if (server_fd < 0 && queue.is_drained())
+                {
+                    break;
+                }
+                continue;
+            }
+            ForestHandleT::SnapshotT current_forest = forest_handle.get();
+            if (current_forest != served_forest)
+            {
+                served_forest = current_forest;
+                ait::log_info() << "Serving forest generation " << forest_handle.generation() << " with " << served_forest->forest->size() << " trees.";
+                // The dispatcher was the last reader of the previous forest. If a release is still running,
+                // the previous forest is released by the next reload instead.
+                if (!pending_release.valid() || pending_release.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                {
+                    pending_release = std::async(std::launch::async, [&forest_handle] ()
+                    {
+                        return forest_handle.release_unused_forests();
+                    });
+                }
+            }
+            process_batch(batch, *served_forest->predictor, background_value, foreground_switch.getValue() ? &foreground_parameters : nullptr,
+                          num_of_pixels, num_of_foreground_pixels, num_of_evaluated_trees);
+            num_of_frames += batch.size();
+            ++num_of_batches;
+        }
+        if (stdio_writer)
+        {
+            // All responses are written before the server exits.
+            stdio_writer->close();
+            stdio_writer_thread.join();
+        }
+        ait::log_info() << "Predicted " << num_of_frames << " frames in " << num_of_batches << " batches.";
+        if (num_of_pixels > 0)
+        {
+            ait::log_info() << "Predicted pixels: " << num_of_foreground_pixels << " of " << num_of_pixels
+                << " (" << 100.0 * num_of_foreground_pixels / num_of_pixels << "%)";
+            ait::log_info() << "Average number of evaluated trees per pixel: " << num_of_evaluated_trees / static_cast<double>(num_of_pixels);
+        }
+        if (server_fd >= 0)
+        {
+            ::close(server_fd);
+            ::unlink(socket_arg.getValue().c_str());
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "Runtime exception occured" << std::endl;
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    catch (const TCLAP::ArgException &e)
+    {
+        ait::log_error() << "Error parsing command line: " << e.error() << " for arg " << e.argId();
+        return 1;
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << "Exception occured" << std::endl;
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
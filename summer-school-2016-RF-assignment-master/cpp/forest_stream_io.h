@@ -0,0 +1,162 @@
+//
+//  forest_stream_io.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <cereal/archives/binary.hpp>
+
+#include "ait.h"
+
+namespace ait
+{
+
+// A forest stream file consists of a header (magic and version) followed by the trees.
+// Each tree is stored as its size in bytes (uint64) followed by the cereal binary serialization of the tree.
+// Trees can be appended as soon as they are trained and read one by one.
+
+static const char FOREST_STREAM_MAGIC[8] = {'A', 'I', 'T', 'F', 'S', 'T', 'R', 'M'};
+static const std::uint32_t FOREST_STREAM_VERSION = 1;
+
+/// @brief Return whether a file is a forest stream file (otherwise it is assumed to be a cereal forest file).
+inline bool is_forest_stream_file(const std::string& filename)
+{
+    std::ifstream input(filename, std::ios_base::binary);
+    char magic[sizeof(FOREST_STREAM_MAGIC)];
+    input.read(magic, sizeof(magic));
+    return input && std::memcmp(magic, FOREST_STREAM_MAGIC, sizeof(magic)) == 0;
+}
+
+/// @brief Appends trees to a forest stream file.
+template <typename TTree>
+class ForestStreamWriter
+{
+public:
+    explicit ForestStreamWriter(const std::string& filename)
+    : filename_(filename), output_(filename, std::ios_base::binary | std::ios_base::trunc), num_of_trees_(0)
+    {
+        if (!output_)
+        {
+            throw std::runtime_error("Unable to open forest stream file '" + filename_ + "' for writing.");
+        }
+        output_.write(FOREST_STREAM_MAGIC, sizeof(FOREST_STREAM_MAGIC));
+        output_.write(reinterpret_cast<const char*>(&FOREST_STREAM_VERSION), sizeof(FOREST_STREAM_VERSION));
+        check_output();
+    }
+
+    /// @brief Append a tree and flush it to disk.
+    void write_tree(const TTree& tree)
+    {
+        // The tree is serialized directly to the file and its size is filled in afterwards.
+        std::uint64_t tree_size = 0;
+        std::streampos size_pos = output_.tellp();
+        output_.write(reinterpret_cast<const char*>(&tree_size), sizeof(tree_size));
+        {
+            cereal::BinaryOutputArchive oarchive(output_);
+            oarchive(tree);
+        }
+        std::streampos end_pos = output_.tellp();
+        tree_size = static_cast<std::uint64_t>(end_pos - size_pos) - sizeof(tree_size);
+        output_.seekp(size_pos);
+        output_.write(reinterpret_cast<const char*>(&tree_size), sizeof(tree_size));
+        output_.seekp(end_pos);
+        output_.flush();
+        check_output();
+        ++num_of_trees_;
+    }
+
+    size_type num_of_trees() const
+    {
+        return num_of_trees_;
+    }
+
+private:
+    void check_output()
+    {
+        if (!output_)
+        {
+            throw std::runtime_error("Unable to write to forest stream file '" + filename_ + "'.");
+        }
+    }
+
+    std::string filename_;
+    std::ofstream output_;
+    size_type num_of_trees_;
+};
+
+/// @brief Reads the trees of a forest stream file one by one.
+template <typename TTree>
+class ForestStreamReader
+{
+public:
+    explicit ForestStreamReader(const std::string& filename)
+    : filename_(filename), input_(filename, std::ios_base::binary)
+    {
+        if (!input_)
+        {
+            throw std::runtime_error("Unable to open forest stream file '" + filename_ + "'.");
+        }
+        char magic[sizeof(FOREST_STREAM_MAGIC)];
+        input_.read(magic, sizeof(magic));
+        if (!input_ || std::memcmp(magic, FOREST_STREAM_MAGIC, sizeof(magic)) != 0)
+        {
+            throw std::runtime_error("File '" + filename_ + "' is not a forest stream file.");
+        }
+        std::uint32_t version;
+        input_.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!input_ || version != FOREST_STREAM_VERSION)
+        {
+            throw std::runtime_error("Unsupported forest stream version in '" + filename_ + "'.");
+        }
+    }
+
+    /// @brief Read the next tree.
+    /// @return False if there are no more trees.
+    bool read_tree(TTree& tree)
+    {
+        std::uint64_t tree_size;
+        input_.read(reinterpret_cast<char*>(&tree_size), sizeof(tree_size));
+        if (input_.gcount() == 0 && input_.eof())
+        {
+            return false;
+        }
+        if (!input_)
+        {
+            throw std::runtime_error("Truncated tree in forest stream file '" + filename_ + "'.");
+        }
+        std::streampos start_pos = input_.tellg();
+        {
+            cereal::BinaryInputArchive iarchive(input_);
+            iarchive(tree);
+        }
+        if (!input_ || static_cast<std::uint64_t>(input_.tellg() - start_pos) != tree_size)
+        {
+            throw std::runtime_error("Corrupt tree in forest stream file '" + filename_ + "'.");
+        }
+        return true;
+    }
+
+    /// @brief Read all remaining trees into a forest.
+    template <typename TForest>
+    void read_forest(TForest& forest)
+    {
+        TTree tree;
+        while (read_tree(tree))
+        {
+            forest.add_tree(tree);
+            tree = TTree();
+        }
+    }
+
+private:
+    std::string filename_;
+    std::ifstream input_;
+};
+
+}
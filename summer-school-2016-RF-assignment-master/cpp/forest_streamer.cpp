@@ -0,0 +1,642 @@
+//
+//  forest_streamer.cpp
+//  DistRandomForest
+//
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+#include <unistd.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <tclap/CmdLine.h>
+
+#include "ait.h"
+#include "logger.h"
+#include "forest.h"
+#include "histogram_statistics.h"
+#include "image_weak_learner.h"
+#include "csv_utils.h"
+#include "matlab_file_io.h"
+#include "png_image_io.h"
+#include "forest_file_io.h"
+#include "dense_predictor.h"
+#include "prediction_protocol.h"
+
+using PixelT = ait::pixel_type;
+using ImageT = ait::Image<PixelT>;
+using StatisticsT = ait::HistogramStatistics;
+using SplitPointT = ait::ImageSplitPoint<PixelT>;
+using ForestT = ait::Forest<SplitPointT, StatisticsT>;
+using PredictorT = ait::DenseForestPredictor<ForestT>;
+using ClockT = std::chrono::steady_clock;
+
+namespace
+{
+
+/// @brief A frame on its way through the pipeline.
+struct StreamFrame
+{
+    ait::size_type index;
+    // Time when the decode stage started reading the frame.
+    ClockT::time_point read_time;
+    ImageT image;
+    // A frame that could not be decoded is not predicted and is answered with this error.
+    std::string error;
+    ait::DensePrediction prediction;
+    double decode_seconds;
+    double predict_seconds;
+};
+
+using StreamFramePtr = std::unique_ptr<StreamFrame>;
+
+/// @brief A queue between two pipeline stages. Producers block while the queue is full.
+class FrameQueue
+{
+public:
+    explicit FrameQueue(std::size_t max_size)
+    : max_size_(max_size), closed_(false)
+    {}
+
+    /// @brief Add a frame. Blocks while the queue is full.
+    /// @return False if the queue was closed, i.e. the frame is dropped.
+    bool push(StreamFramePtr frame)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] () { return queue_.size() < max_size_ || closed_; });
+        if (closed_)
+        {
+            return false;
+        }
+        queue_.push_back(std::move(frame));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /// @brief Take the next frame. Blocks while the queue is empty.
+    /// @return False if the queue is closed and empty.
+    bool pop(StreamFramePtr& frame)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] () { return !queue_.empty() || closed_; });
+        if (queue_.empty())
+        {
+            return false;
+        }
+        frame = std::move(queue_.front());
+        queue_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    /// @brief No more frames are added. The remaining frames can still be taken.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    std::size_t max_size_;
+    bool closed_;
+    std::deque<StreamFramePtr> queue_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+/// @brief Limits the number of frames in the pipeline, i.e. from reading a frame until it was written.
+///
+/// The queues alone do not bound the frames in flight: If one frame is slow, the following frames wait in the
+/// reorder buffer of the write stage. So the decode stage acquires a slot for each frame and the write stage
+/// releases it once the frame was written.
+class FrameWindow
+{
+public:
+    explicit FrameWindow(std::size_t size)
+    : size_(size), num_of_frames_(0), closed_(false)
+    {}
+
+    /// @brief Acquire a slot for a frame. Blocks while the window is full.
+    /// @return False if the window was closed.
+    bool acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] () { return num_of_frames_ < size_ || closed_; });
+        if (closed_)
+        {
+            return false;
+        }
+        ++num_of_frames_;
+        return true;
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --num_of_frames_;
+        not_full_.notify_one();
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+    }
+
+private:
+    std::size_t size_;
+    std::size_t num_of_frames_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+};
+
+/// @brief Keeps the first error of all stages and closes the queues and the window so that the other stages stop.
+class PipelineErrors
+{
+public:
+    PipelineErrors(std::vector<FrameQueue*> queues, FrameWindow& window)
+    : queues_(queues), window_(window)
+    {}
+
+    void fail(std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)
+            {
+                error_ = error;
+            }
+        }
+        for (FrameQueue* queue : queues_)
+        {
+            queue->close();
+        }
+        window_.close();
+    }
+
+    /// @brief Rethrow the first error (if any).
+    void rethrow()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    std::vector<FrameQueue*> queues_;
+    FrameWindow& window_;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+};
+
+/// @brief Ordered source of depth frames: an image list, the frames of a MAT-file or raw frames from stdin.
+class FrameSource
+{
+public:
+    FrameSource(ait::offset_type border, PixelT background_value, ait::size_type num_of_classes)
+    : border_(border), background_value_(background_value), num_of_classes_(num_of_classes), next_index_(0)
+    {}
+
+    void set_image_list(std::vector<std::string> data_paths)
+    {
+        data_paths_ = std::move(data_paths);
+    }
+
+    /// @brief Stream the frames of the data array (height x width x num_of_frames) of a MAT-file.
+    void set_mat_file(const std::string& filename, const std::string& data_array_name)
+    {
+        ait::MatFileReader mat_reader(filename);
+        const ait::MatFileReader::VariableInfo& data_variable = mat_reader.get_variable(data_array_name);
+        if (data_variable.dimensions.size() < 2 || data_variable.dimensions.size() > 3)
+        {
+            throw std::runtime_error("Can only handle arrays with a dimension of 2 or 3.");
+        }
+        mat_height_ = data_variable.dimensions[0];
+        mat_width_ = data_variable.dimensions[1];
+        mat_num_of_frames_ = data_variable.dimensions.size() > 2 ? data_variable.dimensions[2] : 1;
+        mat_values_.reset(new ait::MatFileReader::ValueReader(mat_reader, data_variable));
+    }
+
+    void set_stdin(bool use_stdin)
+    {
+        use_stdin_ = use_stdin;
+    }
+
+    /// @brief Read the next frame.
+    ///        A malformed request from stdin does not end the stream, its error message is returned instead.
+    /// @return False at the end of the stream.
+    bool read(ImageT& image, bool& with_posteriors, std::string& error)
+    {
+        with_posteriors = false;
+        error.clear();
+        if (use_stdin_)
+        {
+            std::vector<char> message;
+            if (!ait::read_message(STDIN_FILENO, message))
+            {
+                return false;
+            }
+            try
+            {
+                ait::PredictionRequestHeader header;
+                const PixelT* pixels = ait::decode_prediction_request(message, num_of_classes_, header);
+                const ait::size_type width = header.width;
+                const ait::size_type height = header.height;
+                image = ImageT(width, height, border_, background_value_);
+                for (ait::offset_type y = 0; y < height; ++y)
+                {
+                    std::copy(pixels + y * width, pixels + (y + 1) * width, &image.get_pixel(0, y));
+                }
+                with_posteriors = (header.flags & ait::PREDICTION_FLAG_POSTERIORS) != 0;
+            }
+            catch (const std::runtime_error& decode_error)
+            {
+                image = ImageT();
+                error = decode_error.what();
+            }
+        }
+        else if (mat_values_)
+        {
+            if (next_index_ >= mat_num_of_frames_)
+            {
+                return false;
+            }
+            // MATLAB arrays are stored column by column.
+            mat_frame_.resize(mat_width_ * mat_height_);
+            if (mat_values_->read(mat_frame_.data(), mat_frame_.size()) != static_cast<ait::size_type>(mat_frame_.size()))
+            {
+                throw std::runtime_error("Unexpected end of the data array in the MAT-file.");
+            }
+            image = ImageT(mat_width_, mat_height_, border_, background_value_);
+            for (ait::size_type x = 0; x < mat_width_; ++x)
+            {
+                for (ait::size_type y = 0; y < mat_height_; ++y)
+                {
+                    image.get_pixel(x, y) = mat_frame_[x * mat_height_ + y];
+                }
+            }
+        }
+        else
+        {
+            if (next_index_ >= static_cast<ait::size_type>(data_paths_.size()))
+            {
+                return false;
+            }
+            image = ImageT::load_data_from_file(data_paths_[next_index_], border_, background_value_);
+        }
+        ++next_index_;
+        return true;
+    }
+
+private:
+    ait::offset_type border_;
+    PixelT background_value_;
+    ait::size_type num_of_classes_;
+    ait::size_type next_index_;
+    std::vector<std::string> data_paths_;
+    std::unique_ptr<ait::MatFileReader::ValueReader> mat_values_;
+    ait::size_type mat_width_ = 0;
+    ait::size_type mat_height_ = 0;
+    ait::size_type mat_num_of_frames_ = 0;
+    std::vector<PixelT> mat_frame_;
+    bool use_stdin_ = false;
+};
+
+/// @brief Writes the predictions in frame order as label images and posterior maps or as responses to stdout.
+class FrameWriter
+{
+public:
+    FrameWriter(const std::string& output_directory, int output_fd, bool write_posteriors)
+    : output_directory_(output_directory), output_fd_(output_fd), write_posteriors_(write_posteriors)
+    {}
+
+    void write(const StreamFrame& frame)
+    {
+        if (!frame.error.empty())
+        {
+            ait::log_warning() << "Frame " << frame.index << " was not predicted: " << frame.error;
+            if (output_fd_ >= 0)
+            {
+                ait::write_message(output_fd_, ait::encode_prediction_error(frame.error));
+            }
+            return;
+        }
+        const ait::DensePrediction& prediction = frame.prediction;
+        if (output_fd_ >= 0)
+        {
+            ait::write_message(output_fd_, ait::encode_prediction_response(
+                prediction.width, prediction.height, prediction.num_of_classes,
+                prediction.labels.data(), prediction.has_posteriors() ? prediction.posteriors.data() : nullptr));
+        }
+        if (output_directory_.empty())
+        {
+            return;
+        }
+        char filename[64];
+        std::snprintf(filename, sizeof(filename), "labels_%06lld.png", static_cast<long long>(frame.index));
+        // Labels are stored row by row, so the row stride is the width.
+        int bit_depth = prediction.num_of_classes < 255 ? 8 : 16;
+        ait::PngImageWriter label_writer((boost::filesystem::path(output_directory_) / filename).string(),
+                                         prediction.width, prediction.height, bit_depth);
+        label_writer.write_rows(prediction.labels.data(), prediction.width);
+        if (write_posteriors_ && prediction.has_posteriors())
+        {
+            std::snprintf(filename, sizeof(filename), "posteriors_%06lld.bin", static_cast<long long>(frame.index));
+            std::ofstream posterior_file((boost::filesystem::path(output_directory_) / filename).string(), std::ios_base::binary);
+            posterior_file.write(reinterpret_cast<const char*>(prediction.posteriors.data()), prediction.posteriors.size() * sizeof(float));
+            if (!posterior_file)
+            {
+                throw std::runtime_error("Unable to write posterior map " + std::string(filename) + ".");
+            }
+        }
+    }
+
+private:
+    std::string output_directory_;
+    int output_fd_;
+    bool write_posteriors_;
+};
+
+/// @brief Value below which the given fraction of the sorted values lie (nearest rank).
+double compute_percentile(const std::vector<double>& sorted_values, double fraction)
+{
+    if (sorted_values.empty())
+    {
+        return 0;
+    }
+    std::size_t rank = static_cast<std::size_t>(std::ceil(fraction * sorted_values.size()));
+    return sorted_values[std::min(sorted_values.size(), std::max<std::size_t>(rank, 1)) - 1];
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        // Parse command line arguments.
+        TCLAP::CmdLine cmd("Random forest stream predictor (decode, predict and write frames in a pipeline)", ' ', "0.3");
+        TCLAP::ValueArg<std::string> forest_file_arg("f", "forest-file", "Forest file (JSON, binary, stream, native or indexed) to predict with", true, "forest.bin", "string", cmd);
+        TCLAP::ValueArg<std::string> image_list_file_arg("i", "image-list-file", "File containing the names of the depth images of the frames in order (the first column is used)", true, "", "string");
+        TCLAP::ValueArg<std::string> mat_file_arg("", "mat-file", "MAT-file containing the frames", true, "", "string");
+        TCLAP::SwitchArg stdin_switch("", "stdin", "Read raw frames from stdin as prediction requests (see prediction_protocol.h)", false);
+        TCLAP::ValueArg<std::string> mat_data_array_arg("", "mat-data-array", "Name of the data array in the MAT-file", false, "data", "string", cmd);
+        TCLAP::ValueArg<std::string> output_directory_arg("o", "output-directory", "Directory to write the label images (and posterior maps) of the frames to", false, "", "string", cmd);
+        TCLAP::SwitchArg stdout_switch("", "stdout", "Write the predictions to stdout as prediction responses (log output goes to stderr)", cmd, false);
+        TCLAP::SwitchArg posteriors_switch("", "posteriors", "Also write the posterior maps (raw float values of all classes per pixel, row by row)", cmd, false);
+        TCLAP::ValueArg<int> background_value_arg("", "background-value", "Depth value outside of the frames", false, 0, "int", cmd);
+        TCLAP::ValueArg<int> queue_size_arg("", "queue-size", "Maximum number of frames waiting between two stages", false, 4, "int", cmd);
+        TCLAP::ValueArg<int> num_of_workers_arg("w", "workers", "Number of frames that are predicted concurrently", false, -1, "int", cmd);
+        TCLAP::ValueArg<int> threads_per_frame_arg("t", "threads-per-frame", "Number of threads to use for the prediction of each frame", false, 1, "int", cmd);
+        TCLAP::SwitchArg product_switch("", "product", "Combine the trees by the product of their posteriors instead of the mean", cmd, false);
+        TCLAP::SwitchArg early_exit_switch("", "early-exit", "Stop evaluating the trees of a pixel once its label is decided", cmd, false);
+        TCLAP::ValueArg<double> early_exit_confidence_arg("", "early-exit-confidence", "With --early-exit, also stop once the posterior of the leading class reaches this value (within (1/num-of-classes, 1))", false, 1.0, "double", cmd);
+        TCLAP::ValueArg<int> coarse_stride_arg("", "coarse-stride", "Predict coarse-to-fine on every n-th pixel (see DenseForestPredictor::enable_coarse_to_fine)", false, 1, "int", cmd);
+        std::vector<TCLAP::Arg*> source_args = {&image_list_file_arg, &mat_file_arg, &stdin_switch};
+        cmd.xorAdd(source_args);
+        cmd.parse(argc, argv);
+
+        int output_fd = -1;
+        if (stdout_switch.getValue())
+        {
+            // Keep stdout for the predictions and send the log output to stderr.
+            output_fd = ::dup(STDOUT_FILENO);
+            ::dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+        const std::string output_directory = output_directory_arg.getValue();
+        if (!output_directory.empty() && !boost::filesystem::is_directory(output_directory))
+        {
+            throw std::runtime_error("Output directory '" + output_directory + "' does not exist.");
+        }
+        if (background_value_arg.getValue() < std::numeric_limits<PixelT>::min() || background_value_arg.getValue() > std::numeric_limits<PixelT>::max())
+        {
+            throw std::runtime_error("The background value does not fit into a pixel.");
+        }
+        const PixelT background_value = static_cast<PixelT>(background_value_arg.getValue());
+
+        ait::log_info(false) << "Reading forest file " << forest_file_arg.getValue() << "... " << std::flush;
+        ForestT forest = ait::read_forest_file<ForestT>(forest_file_arg.getValue());
+        ait::log_info(false) << " Done." << std::endl;
+        const ait::PosteriorAggregation aggregation = product_switch.getValue() ? ait::PosteriorAggregation::PRODUCT : ait::PosteriorAggregation::SUM;
+        // The predictor is shared by all workers. Each worker predicts whole frames.
+        PredictorT predictor(forest, threads_per_frame_arg.getValue(), aggregation);
+        if (early_exit_switch.getValue())
+        {
+            predictor.enable_early_exit(early_exit_confidence_arg.getValue());
+        }
+        predictor.enable_coarse_to_fine(coarse_stride_arg.getValue());
+
+        FrameSource source(predictor.image_border(), background_value, predictor.num_of_classes());
+        if (image_list_file_arg.isSet())
+        {
+            const std::string image_list_file = image_list_file_arg.getValue();
+            if (!boost::filesystem::exists(image_list_file))
+            {
+                throw std::runtime_error("Unable to open image list file");
+            }
+            const std::string image_list_directory = boost::filesystem::path(image_list_file).parent_path().string();
+            std::vector<std::string> data_paths;
+            ait::MappedCSVReader<> csv_reader(image_list_file);
+            for (auto it = csv_reader.begin(); it != csv_reader.end(); ++it)
+            {
+                if (it->size() < 1)
+                {
+                    throw std::runtime_error("Image list file should contain the depth image filenames in the first column.");
+                }
+                data_paths.push_back(ait::resolve_path(image_list_directory, (*it)[0]));
+            }
+            source.set_image_list(std::move(data_paths));
+        }
+        else if (mat_file_arg.isSet())
+        {
+            // The decode stage reads the frames of the MAT-file one by one.
+            source.set_mat_file(mat_file_arg.getValue(), mat_data_array_arg.getValue());
+        }
+        else
+        {
+            source.set_stdin(true);
+        }
+        FrameWriter writer(output_directory, output_fd, posteriors_switch.getValue());
+
+        ait::size_type num_of_workers = num_of_workers_arg.getValue();
+        if (num_of_workers <= 0)
+        {
+            num_of_workers = std::max<ait::size_type>(1, std::thread::hardware_concurrency() / std::max(1, threads_per_frame_arg.getValue()));
+        }
+        const std::size_t queue_size = std::max(1, queue_size_arg.getValue());
+        FrameQueue decoded_frames(queue_size);
+        FrameQueue predicted_frames(queue_size);
+        // Enough frames to fill both queues and all workers.
+        const std::size_t window_size = 2 * queue_size + num_of_workers;
+        FrameWindow window(window_size);
+        PipelineErrors errors({&decoded_frames, &predicted_frames}, window);
+        ait::log_info() << "Streaming with " << num_of_workers << " prediction workers, queues of " << queue_size
+            << " frames and at most " << window_size << " frames in flight.";
+        const ClockT::time_point start_time = ClockT::now();
+
+        // Decode stage: Read the frames in order.
+        std::thread decode_thread([&] ()
+        {
+            try
+            {
+                for (ait::size_type index = 0; window.acquire(); ++index)
+                {
+                    StreamFramePtr frame(new StreamFrame());
+                    frame->index = index;
+                    frame->read_time = ClockT::now();
+                    bool with_posteriors;
+                    if (!source.read(frame->image, with_posteriors, frame->error))
+                    {
+                        window.release();
+                        break;
+                    }
+                    frame->prediction.resize(frame->image.width(), frame->image.height(), predictor.num_of_classes(),
+                                             with_posteriors || posteriors_switch.getValue());
+                    frame->decode_seconds = std::chrono::duration<double>(ClockT::now() - frame->read_time).count();
+                    if (!decoded_frames.push(std::move(frame)))
+                    {
+                        break;
+                    }
+                }
+                decoded_frames.close();
+            }
+            catch (...)
+            {
+                errors.fail(std::current_exception());
+            }
+        });
+
+        // Predict stage: A pool of workers predicts the frames (possibly out of order).
+        std::atomic<ait::size_type> num_of_running_workers(num_of_workers);
+        std::vector<std::thread> worker_threads;
+        for (ait::size_type worker = 0; worker < num_of_workers; ++worker)
+        {
+            worker_threads.push_back(std::thread([&] ()
+            {
+                try
+                {
+                    StreamFramePtr frame;
+                    while (decoded_frames.pop(frame))
+                    {
+                        ClockT::time_point predict_start_time = ClockT::now();
+                        if (frame->error.empty())
+                        {
+                            predictor.predict(frame->image, frame->prediction);
+                        }
+                        frame->predict_seconds = std::chrono::duration<double>(ClockT::now() - predict_start_time).count();
+                        if (!predicted_frames.push(std::move(frame)))
+                        {
+                            break;
+                        }
+                    }
+                }
+                catch (...)
+                {
+                    errors.fail(std::current_exception());
+                }
+                if (--num_of_running_workers == 0)
+                {
+                    predicted_frames.close();
+                }
+            }));
+        }
+
+        // Write stage: Restore the frame order and write the predictions.
+        std::vector<double> latencies;
+        double decode_seconds = 0;
+        double predict_seconds = 0;
+        double write_seconds = 0;
+        ait::size_type num_of_pixels = 0;
+        try
+        {
+            std::map<ait::size_type, StreamFramePtr> pending_frames;
+            ait::size_type next_index = 0;
+            StreamFramePtr frame;
+            while (predicted_frames.pop(frame))
+            {
+                ait::size_type index = frame->index;
+                pending_frames[index] = std::move(frame);
+                for (auto it = pending_frames.find(next_index); it != pending_frames.end(); it = pending_frames.find(next_index))
+                {
+                    const StreamFrame& next_frame = *it->second;
+                    ClockT::time_point write_start_time = ClockT::now();
+                    writer.write(next_frame);
+                    ClockT::time_point write_end_time = ClockT::now();
+                    write_seconds += std::chrono::duration<double>(write_end_time - write_start_time).count();
+                    decode_seconds += next_frame.decode_seconds;
+                    predict_seconds += next_frame.predict_seconds;
+                    latencies.push_back(std::chrono::duration<double>(write_end_time - next_frame.read_time).count());
+                    num_of_pixels += next_frame.prediction.labels.size();
+                    pending_frames.erase(it);
+                    window.release();
+                    ++next_index;
+                }
+            }
+        }
+        catch (...)
+        {
+            errors.fail(std::current_exception());
+        }
+        decode_thread.join();
+        for (std::thread& thread : worker_threads)
+        {
+            thread.join();
+        }
+        errors.rethrow();
+        const double elapsed_seconds = std::chrono::duration<double>(ClockT::now() - start_time).count();
+
+        const ait::size_type num_of_frames = latencies.size();
+        ait::log_info() << "Streamed " << num_of_frames << " frames (" << num_of_pixels << " pixels) in " << elapsed_seconds << " s.";
+        if (num_of_frames > 0)
+        {
+            ait::log_info() << "Throughput: " << num_of_frames / std::max(elapsed_seconds, 1e-9) << " frames/s, "
+                << num_of_pixels / std::max(elapsed_seconds, 1e-9) / 1e6 << " Mpixels/s";
+            std::sort(latencies.begin(), latencies.end());
+            ait::log_info() << "Frame latency (read to written) in ms: p50 " << 1e3 * compute_percentile(latencies, 0.5)
+                << ", p90 " << 1e3 * compute_percentile(latencies, 0.9) << ", p99 " << 1e3 * compute_percentile(latencies, 0.99)
+                << ", max " << 1e3 * latencies.back();
+            ait::log_info() << "Average stage time per frame in ms: decode " << 1e3 * decode_seconds / num_of_frames
+                << ", predict " << 1e3 * predict_seconds / num_of_frames << ", write " << 1e3 * write_seconds / num_of_frames;
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "Runtime exception occured" << std::endl;
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    catch (const TCLAP::ArgException &e)
+    {
+        ait::log_error() << "Error parsing command line: " << e.error() << " for arg " << e.argId();
+        return 1;
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << "Exception occured" << std::endl;
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -14,6 +14,8 @@
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <cctype>
+#include <memory>
 #if AIT_MULTI_THREADING
 #include <thread>
 #endif
@@ -28,6 +30,7 @@
 #include <CImg.h>
 
 #include "ait.h"
+#include "png_image_io.h"
 #include "logger.h"
 #include "node.h"
 #include "weak_learner.h"
@@ -54,6 +57,11 @@ struct ImageParameters
 
     // Lower bound of labels for background pixels
     label_type background_label = std::numeric_limits<label_type>::max();
+
+    // Width of the guard border around the data of each image and the value it is filled with.
+    // Pixel probes of features must stay within this border (see ImageWeakLearnerParameters::compute_image_border()).
+    offset_type image_border = 15;
+    pixel_type background_value = 0;
     
 private:
     friend class cereal::access;
@@ -94,6 +102,15 @@ struct ImageWeakLearnerParameters : public ImageParameters
     // For binary images only two thresholds will be generated (-0.5 and +0.5). The other parameters regarding thresholds will be ignored.
     bool binary_images = true;
 
+    /// @brief Return the guard border that is required for all offsets within the feature offset ranges.
+    offset_type compute_image_border() const
+    {
+        return static_cast<offset_type>(std::max({
+            std::abs(feature_offset_x_range_low), std::abs(feature_offset_x_range_high),
+            std::abs(feature_offset_y_range_low), std::abs(feature_offset_y_range_high)
+        }));
+    }
+
 private:
     friend class cereal::access;
     
@@ -113,6 +130,23 @@ private:
     }
 };
 
+/// @brief Write the parameters that determine the trained trees (e.g. to check that a checkpoint can be resumed).
+inline std::ostream& operator<<(std::ostream& stream, const ImageWeakLearnerParameters& parameters)
+{
+    return stream << "samples_per_image_fraction=" << parameters.samples_per_image_fraction
+        << " bagging_fraction=" << parameters.bagging_fraction
+        << " background_label=" << parameters.background_label
+        << " image_border=" << parameters.image_border
+        << " background_value=" << parameters.background_value
+        << " num_of_thresholds=" << parameters.num_of_thresholds
+        << " num_of_features=" << parameters.num_of_features
+        << " feature_offset_x_range=" << parameters.feature_offset_x_range_low << ":" << parameters.feature_offset_x_range_high
+        << " feature_offset_y_range=" << parameters.feature_offset_y_range_low << ":" << parameters.feature_offset_y_range_high
+        << " threshold_range=" << parameters.threshold_range_low << ":" << parameters.threshold_range_high
+        << " adaptive_threshold_range=" << parameters.adaptive_threshold_range
+        << " binary_images=" << parameters.binary_images;
+}
+
 template <typename TPixel = pixel_type>
 class Image
 {
@@ -120,10 +154,13 @@ public:
     using PixelT = TPixel;
     using DataMatrixType = Eigen::Matrix<TPixel, Eigen::Dynamic, Eigen::Dynamic>;
     using LabelMatrixType = Eigen::Matrix<TPixel, Eigen::Dynamic, Eigen::Dynamic>;
+    using ConstDataBlockType = Eigen::Block<const DataMatrixType>;
 
 private:
+    // The data matrix is surrounded by a guard border of border_ pixels on each side.
     DataMatrixType data_matrix_;
     LabelMatrixType label_matrix_;
+    offset_type border_;
 
     void check_equal_dimensions(const DataMatrixType& data_matrix, const LabelMatrixType& label_matrix) const
     {
@@ -131,24 +168,57 @@ private:
             throw std::runtime_error("The data and label matrix must have the same dimension.");
     }
 
+    void init_padded_data_matrix(const DataMatrixType& data_matrix, TPixel background_value)
+    {
+        data_matrix_.resize(data_matrix.rows() + 2 * border_, data_matrix.cols() + 2 * border_);
+        data_matrix_.setConstant(background_value);
+        data_matrix_.block(border_, border_, data_matrix.rows(), data_matrix.cols()) = data_matrix;
+    }
+
 public:
     explicit Image()
+    : border_(0)
     {
     }
 
-    explicit Image(const DataMatrixType& data_matrix, const LabelMatrixType& label_matrix)
-    : data_matrix_(data_matrix), label_matrix_(label_matrix)
+    /// @brief Create an image with background data and zero labels.
+    explicit Image(size_type width, size_type height, offset_type border = 0, TPixel background_value = 0)
+    : data_matrix_(width + 2 * border, height + 2 * border), label_matrix_(width, height), border_(border)
+    {
+        data_matrix_.setConstant(background_value);
+        label_matrix_.setZero();
+    }
+
+    explicit Image(const DataMatrixType& data_matrix, const LabelMatrixType& label_matrix, offset_type border = 0, TPixel background_value = 0)
+    : label_matrix_(label_matrix), border_(border)
     {
         check_equal_dimensions(data_matrix, label_matrix);
+        init_padded_data_matrix(data_matrix, background_value);
     }
 
-    explicit Image(DataMatrixType&& data_matrix, LabelMatrixType&& label_matrix)
-    : data_matrix_(std::move(data_matrix)), label_matrix_(std::move(label_matrix))
+    explicit Image(DataMatrixType&& data_matrix, LabelMatrixType&& label_matrix, offset_type border = 0, TPixel background_value = 0)
+    : border_(border)
     {
         check_equal_dimensions(data_matrix, label_matrix);
+        if (border_ == 0)
+        {
+            data_matrix_ = std::move(data_matrix);
+        }
+        else
+        {
+            init_padded_data_matrix(data_matrix, background_value);
+        }
+        label_matrix_ = std::move(label_matrix);
     }
 
-    const DataMatrixType& get_data_matrix() const
+    /// @brief Return the data matrix without the guard border.
+    ConstDataBlockType get_data_matrix() const
+    {
+        return data_matrix_.block(border_, border_, width(), height());
+    }
+
+    /// @brief Return the data matrix including the guard border.
+    const DataMatrixType& get_padded_data_matrix() const
     {
         return data_matrix_;
     }
@@ -157,18 +227,65 @@ public:
     {
         return label_matrix_;
     }
+
+    LabelMatrixType& get_label_matrix()
+    {
+        return label_matrix_;
+    }
+
+    /// @brief Return a data pixel. No range check is done, (x, y) may lie up to border() pixels outside of the image.
+    TPixel get_pixel(offset_type x, offset_type y) const
+    {
+        return data_matrix_(x + border_, y + border_);
+    }
+
+    TPixel& get_pixel(offset_type x, offset_type y)
+    {
+        return data_matrix_(x + border_, y + border_);
+    }
+
+    offset_type border() const
+    {
+        return border_;
+    }
     
     size_type width() const
     {
-        return data_matrix_.rows();
+        return label_matrix_.rows();
     }
 
     size_type height() const
     {
-        return data_matrix_.cols();
+        return label_matrix_.cols();
     }
 
-    static Image load_from_files(const std::string& data_filename, const std::string& label_filename)
+    static Image load_from_files(const std::string& data_filename, const std::string& label_filename, offset_type border = 0, TPixel background_value = 0)
+    {
+        if (has_png_extension(data_filename) && has_png_extension(label_filename))
+        {
+            return load_from_png_files(data_filename, label_filename, border, background_value);
+        }
+        return load_from_cimg_files(data_filename, label_filename, border, background_value);
+    }
+
+    /// @brief Decode PNG images directly into the padded data matrix and the label matrix.
+    ///
+    /// The matrices are column-major with x as the row index, so each image row is contiguous.
+    static Image load_from_png_files(const std::string& data_filename, const std::string& label_filename, offset_type border = 0, TPixel background_value = 0)
+    {
+        PngImageReader data_reader(data_filename);
+        PngImageReader label_reader(label_filename);
+        if (data_reader.width() != label_reader.width() || data_reader.height() != label_reader.height())
+        {
+            throw std::runtime_error("Data and label images need to have the same size");
+        }
+        Image image(data_reader.width(), data_reader.height(), border, background_value);
+        data_reader.read_rows(&image.get_pixel(0, 0), image.data_matrix_.rows());
+        label_reader.read_rows(image.label_matrix_.data(), image.label_matrix_.rows());
+        return image;
+    }
+
+    static Image load_from_cimg_files(const std::string& data_filename, const std::string& label_filename, offset_type border = 0, TPixel background_value = 0)
     {
         cimg_library::CImg<TPixel> data_image(data_filename.c_str());
         cimg_library::CImg<TPixel> label_image(label_filename.c_str());
@@ -194,17 +311,58 @@ public:
         {
             throw std::runtime_error("Images need to have a spectrum of 1 (CImg spectrum)");
         }
-        DataMatrixType data(width, height);
-        LabelMatrixType label(width, height);
+        Image image;
+        image.border_ = border;
+        image.data_matrix_.resize(width + 2 * border, height + 2 * border);
+        image.data_matrix_.setConstant(background_value);
+        image.label_matrix_.resize(width, height);
         for (int_type w = 0; w < width; ++w)
         {
             for (int_type h = 0; h < height; ++h)
             {
-                data(w, h) = data_image(w, h, 0, 0, 0, 0);
-                label(w, h) = label_image(w, h, 0, 0, 0, 0);
+                image.data_matrix_(w + border, h + border) = data_image(w, h, 0, 0, 0, 0);
+                image.label_matrix_(w, h) = label_image(w, h, 0, 0, 0, 0);
             }
         }
-        return Image(data, label);
+        return image;
+    }
+
+    /// @brief Load a depth image without a label image (e.g. a frame of a stream). All labels are zero.
+    static Image load_data_from_file(const std::string& data_filename, offset_type border = 0, TPixel background_value = 0)
+    {
+        if (has_png_extension(data_filename))
+        {
+            PngImageReader data_reader(data_filename);
+            Image image(data_reader.width(), data_reader.height(), border, background_value);
+            data_reader.read_rows(&image.get_pixel(0, 0), image.data_matrix_.rows());
+            return image;
+        }
+        cimg_library::CImg<TPixel> data_image(data_filename.c_str());
+        if (data_image.depth() != 1 || data_image.spectrum() != 1)
+        {
+            throw std::runtime_error("Images need to have a depth and a spectrum of 1 (CImg depth and spectrum)");
+        }
+        Image image(data_image.width(), data_image.height(), border, background_value);
+        for (int_type w = 0; w < data_image.width(); ++w)
+        {
+            for (int_type h = 0; h < data_image.height(); ++h)
+            {
+                image.data_matrix_(w + border, h + border) = data_image(w, h, 0, 0, 0, 0);
+            }
+        }
+        return image;
+    }
+
+private:
+    static bool has_png_extension(const std::string& filename)
+    {
+        if (filename.size() < 4)
+        {
+            return false;
+        }
+        std::string extension = filename.substr(filename.size() - 4);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return extension == ".png";
     }
 };
 
@@ -229,6 +387,8 @@ public:
     : image_ptr_(other.image_ptr_), x_(other.x_), y_(other.y_)
     {}
 
+    ImageSample& operator=(const ImageSample& other) = default;
+
     const label_type get_label() const
     {
         return image_ptr_->get_label_matrix()(x_, y_);
@@ -275,11 +435,25 @@ public:
         image_height_ = image.height();
     }
 
+    /// @brief Create a sample provider for images that have already been loaded (i.e. from a MAT-file).
+    explicit ImageSampleProvider(const std::shared_ptr<const std::vector<ImageT>>& images, const ImageParameters& parameters)
+    : images_(images), parameters_(parameters)
+    {
+        assert(images->size() > 0);
+        image_width_ = images->front().width();
+        image_height_ = images->front().height();
+    }
+
+    size_type num_of_images() const
+    {
+        return images_ ? images_->size() : image_list_.size();
+    }
+
     std::vector<SampleBagBatchT> compute_sample_bag_batches(size_type num_of_batches, TRandomEngine& rnd_engine) const
 	{
-        int_type num_of_images_per_bag = std::round(parameters_.bagging_fraction * image_list_.size());
+        int_type num_of_images_per_bag = std::round(parameters_.bagging_fraction * num_of_images());
         std::vector<size_type> image_indices(num_of_images_per_bag);
-        std::uniform_int_distribution<int_type> image_dist(0, image_list_.size() - 1);
+        std::uniform_int_distribution<int_type> image_dist(0, num_of_images() - 1);
 		for (size_type i = 0; i < num_of_images_per_bag; i++)
         {
 			int_type image_index = image_dist(rnd_engine);
@@ -308,7 +482,10 @@ public:
         for (auto it = split_sample_item.cbegin(); it != split_sample_item.cend(); ++it)
         {
             size_type image_index = *it;
-            ensure_image_is_loaded(image_index, old_image_map);
+            if (!images_)
+            {
+                ensure_image_is_loaded(image_index, old_image_map);
+            }
 			load_samples_from_image(image_index, rnd_engine);
         }
         log_info(true) << "Done";
@@ -316,8 +493,7 @@ public:
 
     void load_samples_from_image(size_type image_index, TRandomEngine& rnd_engine)
     {
-    	ensure_image_is_loaded(image_index);
-		const ImageT* image_ptr = &image_map_.at(image_index);
+		const ImageT* image_ptr = get_image_ptr(image_index);
 		if (parameters_.samples_per_image_fraction < 1.0)
 		{
 			size_type num_of_samples_per_image = std::round(parameters_.samples_per_image_fraction * image_width_ * image_height_);
@@ -396,6 +572,16 @@ public:
     }
 
 private:
+    const ImageT* get_image_ptr(size_type image_index)
+    {
+        if (images_)
+        {
+            return &(*images_)[image_index];
+        }
+        ensure_image_is_loaded(image_index);
+        return &image_map_.at(image_index);
+    }
+
     void ensure_image_is_loaded(size_type image_index)
     {
 		typename std::map<size_type, ImageT>::const_iterator image_it = image_map_.find(image_index);
@@ -432,7 +618,7 @@ private:
     {
         const std::string& data_path = std::get<0>(image_list_[image_index]);
         const std::string& label_path = std::get<1>(image_list_[image_index]);
-        ImageT image = ImageT::load_from_files(data_path, label_path);
+        ImageT image = ImageT::load_from_files(data_path, label_path, parameters_.image_border, parameters_.background_value);
         return image;
     }
 
@@ -444,6 +630,7 @@ private:
     size_type image_width_;
     size_type image_height_;
     const std::vector<std::tuple<std::string, std::string>> image_list_;
+    const std::shared_ptr<const std::vector<ImageT>> images_;
     const ImageParameters parameters_;
     std::map<size_type, ImageT> image_map_;
     std::vector<SampleT> samples_;
@@ -461,18 +648,17 @@ struct ImageFeature
 
     template <typename TPixel>
     scalar_type compute_pixel_difference(const ImageSample<TPixel>& sample) const {
-        
-        // TODO UIE A2: Compute pixel difference on two offsets.
-        TPixel pixel1_value = 0;
-        TPixel pixel2_value = 0;
+        TPixel pixel1_value = compute_pixel_value(sample, offset_x1, offset_y1);
+        TPixel pixel2_value = compute_pixel_value(sample, offset_x2, offset_y2);
         return pixel1_value - pixel2_value;
     }
     
     template <typename TPixel>
     scalar_type compute_pixel_value(const ImageSample<TPixel>& sample, offset_type offset_x, offset_type offset_y) const {
-        
-        // TODO UIE A2: Compute feature response. Hint: see Eq. 4 in Song et al.
-        TPixel pixel_value = 0;
+        // Probes outside of the image hit the guard border which holds the background value.
+        const Image<TPixel>& image = sample.get_image();
+        assert(std::abs(offset_x) <= image.border() && std::abs(offset_y) <= image.border());
+        TPixel pixel_value = image.get_pixel(sample.get_x() + offset_x, sample.get_y() + offset_y);
         return pixel_value;
     }
 
@@ -602,17 +788,16 @@ public:
 
 private:
     scalar_type compute_pixel_difference(const ImageSample<PixelT>& sample) const {
-        
-        // TODO UIE A2: Compute pixel difference on two offsets.
-        PixelT pixel1_value = 0;
-        PixelT pixel2_value = 0;
+        PixelT pixel1_value = compute_pixel_value(sample, offset_x1_, offset_y1_);
+        PixelT pixel2_value = compute_pixel_value(sample, offset_x2_, offset_y2_);
         return pixel1_value - pixel2_value;
     }
     
     scalar_type compute_pixel_value(const ImageSample<PixelT>& sample, offset_type offset_x, offset_type offset_y) const {
-        
-        // TODO UIE A2: Compute feature response. Hint: see Eq. 4 in Song et al.
-        TPixel pixel_value = 0;
+        // Probes outside of the image hit the guard border which holds the background value.
+        const Image<PixelT>& image = sample.get_image();
+        assert(std::abs(offset_x) <= image.border() && std::abs(offset_y) <= image.border());
+        PixelT pixel_value = image.get_pixel(sample.get_x() + offset_x, sample.get_y() + offset_y);
         return pixel_value;
     }
     
@@ -751,6 +936,59 @@ class ImageWeakLearner : public WeakLearner<ImageSplitPointCandidates<TPixel>, T
 
     const ImageWeakLearnerParameters parameters_;
 
+    offset_type clamp_offset(offset_type offset) const
+    {
+        return std::max<offset_type>(-parameters_.image_border, std::min<offset_type>(offset, parameters_.image_border));
+    }
+
+    /// @brief Sample an offset with a magnitude within [range_low, range_high] and a random sign.
+    ///        The offset is clamped to the guard border of the images so that pixel probes never leave the padded data matrix.
+    offset_type sample_offset(offset_type range_low, offset_type range_high, TRandomEngine& rnd_engine) const
+    {
+        std::uniform_int_distribution<offset_type> magnitude_distribution(range_low, range_high);
+        std::bernoulli_distribution sign_distribution(0.5);
+        offset_type offset = magnitude_distribution(rnd_engine);
+        if (sign_distribution(rnd_engine))
+        {
+            offset = -offset;
+        }
+        return clamp_offset(offset);
+    }
+
+    /// @brief Sample the thresholds of a feature uniformly from the threshold range.
+    ///        With an adaptive threshold range, the range of the feature responses of the samples is used.
+    std::vector<ImageThreshold> sample_thresholds(const ImageFeature& feature, TSampleIterator first_sample, TSampleIterator last_sample, TRandomEngine& rnd_engine) const
+    {
+        std::vector<ImageThreshold> thresholds;
+        if (parameters_.binary_images)
+        {
+            // The pixel differences of binary images are -1, 0 or 1.
+            thresholds.push_back(ImageThreshold(-0.5));
+            thresholds.push_back(ImageThreshold(+0.5));
+            return thresholds;
+        }
+        scalar_type range_low = parameters_.threshold_range_low;
+        scalar_type range_high = parameters_.threshold_range_high;
+        if (parameters_.adaptive_threshold_range && first_sample != last_sample)
+        {
+            range_low = std::numeric_limits<scalar_type>::max();
+            range_high = std::numeric_limits<scalar_type>::lowest();
+            for (TSampleIterator sample_it = first_sample; sample_it != last_sample; ++sample_it)
+            {
+                scalar_type value = feature.compute_pixel_difference(*sample_it);
+                range_low = std::min(range_low, value);
+                range_high = std::max(range_high, value);
+            }
+        }
+        std::uniform_real_distribution<scalar_type> threshold_distribution(range_low, range_high);
+        thresholds.reserve(parameters_.num_of_thresholds);
+        for (size_type i_t=0; i_t < parameters_.num_of_thresholds; i_t++)
+        {
+            thresholds.push_back(ImageThreshold(threshold_distribution(rnd_engine)));
+        }
+        return thresholds;
+    }
+
 public:
     using PixelT = TPixel;
     using ParametersT = ImageWeakLearnerParameters;
@@ -762,6 +1000,11 @@ public:
     : BaseT(statistics_factory), parameters_(parameters)
     {}
 
+    const ParametersT& get_parameters() const
+    {
+        return parameters_;
+    }
+
     virtual ~ImageWeakLearner() {}
 
     virtual SplitPointCandidatesT sample_split_points(TSampleIterator first_sample, TSampleIterator last_sample, TRandomEngine& rnd_engine) const override
@@ -770,19 +1013,13 @@ public:
 
         for (size_type i_f=0; i_f < parameters_.num_of_features; i_f++)
         {
-            offset_type offset_x1;
-            offset_type offset_y1;
-            offset_type offset_x2;
-            offset_type offset_y2;
-            // TODO UIE A2: Implement sampling of offsets to generate parameters_.num_of_features features.
-			// The features are pixel-comparisons relative to a pixel of interest, so two relative 2D-offsets have to be sampled (one 2D-offset for each pixel).
-            // Hint: Use the values in parameters_ to determine the offset ranges for the x and y dimension
-            // ...
+            // The features are pixel-comparisons relative to a pixel of interest, so two relative 2D-offsets are sampled.
+            offset_type offset_x1 = sample_offset(parameters_.feature_offset_x_range_low, parameters_.feature_offset_x_range_high, rnd_engine);
+            offset_type offset_y1 = sample_offset(parameters_.feature_offset_y_range_low, parameters_.feature_offset_y_range_high, rnd_engine);
+            offset_type offset_x2 = sample_offset(parameters_.feature_offset_x_range_low, parameters_.feature_offset_x_range_high, rnd_engine);
+            offset_type offset_y2 = sample_offset(parameters_.feature_offset_y_range_low, parameters_.feature_offset_y_range_high, rnd_engine);
             ImageFeature feature(offset_x1, offset_y1, offset_x2, offset_y2);
-            std::vector<ImageThreshold> thresholds;
-            // TODO UIE A2: Generate thresholds and add them to the vector
-            // Hint: We are dealing with binary images so there are only three possible comparison values (-1, 0, 1) and as such only two thresholds are necessary
-            // ...
+            std::vector<ImageThreshold> thresholds = sample_thresholds(feature, first_sample, last_sample, rnd_engine);
             split_points.add_feature_and_thresholds(feature, thresholds);
         }
 
@@ -881,4 +1118,31 @@ public:
 
 };
 
+/// @brief Return the largest absolute pixel offset used by the split points of a forest.
+///        Images have to be loaded with at least this guard border to evaluate the forest.
+template <typename TForest>
+offset_type compute_max_split_point_offset(const TForest& forest)
+{
+    offset_type max_offset = 0;
+    for (auto tree_it = forest.cbegin(); tree_it != forest.cend(); ++tree_it)
+    {
+        for (auto node_it = tree_it->cbegin(); node_it != tree_it->cend(); ++node_it)
+        {
+            if (node_it.is_leaf())
+            {
+                continue;
+            }
+            const auto& split_point = node_it->get_split_point();
+            max_offset = std::max({
+                max_offset,
+                static_cast<offset_type>(std::abs(split_point.get_offset_x1())),
+                static_cast<offset_type>(std::abs(split_point.get_offset_y1())),
+                static_cast<offset_type>(std::abs(split_point.get_offset_x2())),
+                static_cast<offset_type>(std::abs(split_point.get_offset_y2()))
+            });
+        }
+    }
+    return max_offset;
+}
+
 }
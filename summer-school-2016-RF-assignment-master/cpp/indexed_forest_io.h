@@ -0,0 +1,216 @@
+//
+//  indexed_forest_io.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if AIT_MULTI_THREADING
+#include <thread>
+#endif
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/streams/bufferstream.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include "ait.h"
+
+namespace ait
+{
+
+// An indexed forest file stores the trees of a forest as independent cereal binary blobs:
+//   magic, version (uint32), reserved (uint32), num_of_trees (uint64)
+//   std::uint64_t tree_offsets[num_of_trees + 1] (byte offsets from the start of the file, the last one is the file size)
+//   cereal binary serialization of each tree
+// The offset table allows to deserialize the trees concurrently.
+
+static const char INDEXED_FOREST_MAGIC[8] = {'A', 'I', 'T', 'F', 'I', 'D', 'X', 'D'};
+static const std::uint32_t INDEXED_FOREST_VERSION = 1;
+
+struct IndexedForestHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t num_of_trees;
+};
+
+/// @brief Return whether a file is an indexed forest file.
+inline bool is_indexed_forest_file(const std::string& filename)
+{
+    std::ifstream input(filename, std::ios_base::binary);
+    char magic[sizeof(INDEXED_FOREST_MAGIC)];
+    input.read(magic, sizeof(magic));
+    return input && std::memcmp(magic, INDEXED_FOREST_MAGIC, sizeof(magic)) == 0;
+}
+
+/// @brief Write a forest to an indexed forest file.
+template <typename TForest>
+void write_indexed_forest(const std::string& filename, const TForest& forest)
+{
+    // Serialize the trees first so that the offset table can be written up front.
+    std::vector<std::string> tree_buffers;
+    tree_buffers.reserve(forest.size());
+    for (auto tree_it = forest.cbegin(); tree_it != forest.cend(); ++tree_it)
+    {
+        std::ostringstream tree_stream;
+        {
+            cereal::BinaryOutputArchive oarchive(tree_stream);
+            oarchive(*tree_it);
+        }
+        tree_buffers.push_back(tree_stream.str());
+    }
+
+    IndexedForestHeader header;
+    std::memcpy(header.magic, INDEXED_FOREST_MAGIC, sizeof(header.magic));
+    header.version = INDEXED_FOREST_VERSION;
+    header.reserved = 0;
+    header.num_of_trees = tree_buffers.size();
+    std::vector<std::uint64_t> tree_offsets(tree_buffers.size() + 1);
+    tree_offsets[0] = sizeof(IndexedForestHeader) + tree_offsets.size() * sizeof(std::uint64_t);
+    for (std::size_t i = 0; i < tree_buffers.size(); ++i)
+    {
+        tree_offsets[i + 1] = tree_offsets[i] + tree_buffers[i].size();
+    }
+
+    std::ofstream output(filename, std::ios_base::binary);
+    if (!output)
+    {
+        throw std::runtime_error("Unable to open indexed forest file '" + filename + "' for writing.");
+    }
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(tree_offsets.data()), tree_offsets.size() * sizeof(std::uint64_t));
+    for (const std::string& tree_buffer : tree_buffers)
+    {
+        output.write(tree_buffer.data(), tree_buffer.size());
+    }
+    if (!output)
+    {
+        throw std::runtime_error("Unable to write indexed forest file '" + filename + "'.");
+    }
+}
+
+/// @brief Read a forest from an indexed forest file.
+///        The file is memory-mapped and the trees are deserialized concurrently on num_of_threads threads
+///        (all cores if num_of_threads <= 0).
+template <typename TForest>
+TForest read_indexed_forest(const std::string& filename, int_type num_of_threads = -1)
+{
+    using TreeT = typename TForest::TreeT;
+    boost::interprocess::file_mapping file_mapping;
+    boost::interprocess::mapped_region mapped_region;
+    try
+    {
+        file_mapping = boost::interprocess::file_mapping(filename.c_str(), boost::interprocess::read_only);
+        mapped_region = boost::interprocess::mapped_region(file_mapping, boost::interprocess::read_only);
+    }
+    catch (const boost::interprocess::interprocess_exception& err)
+    {
+        throw std::runtime_error("Cannot map indexed forest file '" + filename + "': " + err.what());
+    }
+    const char* data = static_cast<const char*>(mapped_region.get_address());
+    std::size_t size = mapped_region.get_size();
+    if (size < sizeof(IndexedForestHeader))
+    {
+        throw std::runtime_error("File '" + filename + "' is not an indexed forest file.");
+    }
+    const IndexedForestHeader* header = reinterpret_cast<const IndexedForestHeader*>(data);
+    if (std::memcmp(header->magic, INDEXED_FOREST_MAGIC, sizeof(header->magic)) != 0)
+    {
+        throw std::runtime_error("File '" + filename + "' is not an indexed forest file.");
+    }
+    if (header->version != INDEXED_FOREST_VERSION)
+    {
+        throw std::runtime_error("Unsupported indexed forest version in '" + filename + "'.");
+    }
+    size_type num_of_trees = header->num_of_trees;
+    if (size < sizeof(IndexedForestHeader) + (num_of_trees + 1) * sizeof(std::uint64_t))
+    {
+        throw std::runtime_error("Truncated indexed forest file '" + filename + "'.");
+    }
+    const std::uint64_t* tree_offsets = reinterpret_cast<const std::uint64_t*>(data + sizeof(IndexedForestHeader));
+    for (size_type i = 0; i < num_of_trees; ++i)
+    {
+        if (tree_offsets[i] > tree_offsets[i + 1] || tree_offsets[i + 1] > size)
+        {
+            throw std::runtime_error("Corrupt tree offsets in indexed forest file '" + filename + "'.");
+        }
+    }
+
+    std::vector<TreeT> trees(num_of_trees);
+    auto read_tree = [&] (size_type tree_index)
+    {
+        boost::interprocess::ibufferstream tree_stream(data + tree_offsets[tree_index], tree_offsets[tree_index + 1] - tree_offsets[tree_index]);
+        cereal::BinaryInputArchive iarchive(tree_stream);
+        iarchive(trees[tree_index]);
+        if (!tree_stream)
+        {
+            throw std::runtime_error("Corrupt tree in indexed forest file '" + filename + "'.");
+        }
+    };
+
+#if AIT_MULTI_THREADING
+    if (num_of_threads <= 0)
+    {
+        num_of_threads = std::thread::hardware_concurrency();
+    }
+    num_of_threads = std::max<int_type>(1, std::min<int_type>(num_of_threads, num_of_trees));
+    // Each thread picks the next tree to deserialize until all trees are read.
+    std::atomic<size_type> next_tree_index(0);
+    std::vector<std::exception_ptr> errors(num_of_threads);
+    std::vector<std::thread> threads;
+    for (int_type thread_index = 0; thread_index < num_of_threads; ++thread_index)
+    {
+        threads.push_back(std::thread([&, thread_index] ()
+        {
+            try
+            {
+                for (size_type tree_index = next_tree_index++; tree_index < num_of_trees; tree_index = next_tree_index++)
+                {
+                    read_tree(tree_index);
+                }
+            }
+            catch (...)
+            {
+                errors[thread_index] = std::current_exception();
+                next_tree_index = num_of_trees;
+            }
+        }));
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    for (const std::exception_ptr& error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+#else
+    for (size_type tree_index = 0; tree_index < num_of_trees; ++tree_index)
+    {
+        read_tree(tree_index);
+    }
+#endif
+
+    TForest forest;
+    for (TreeT& tree : trees)
+    {
+        forest.add_tree(tree);
+    }
+    return forest;
+}
+
+}
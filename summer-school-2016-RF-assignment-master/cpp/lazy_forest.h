@@ -0,0 +1,314 @@
+//
+//  lazy_forest.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <exception>
+#if AIT_MULTI_THREADING
+#include <thread>
+#endif
+
+#include "ait.h"
+#include "tree.h"
+#include "native_forest_io.h"
+
+namespace ait
+{
+
+/// @brief A forest that is loaded lazily from a memory-mapped native forest file.
+///
+/// The top eager_depth levels of each tree are loaded on construction. The subtrees below are
+/// loaded on first access (in a background thread if multi-threading is enabled). Until a subtree
+/// is available, evaluation stops at the deepest loaded level, i.e. at depth eager_depth.
+/// If a subtree cannot be loaded, the error is rethrown by the next call to evaluate() or load_all().
+template <typename TSplitPoint, typename TStatistics>
+class LazyForest
+{
+public:
+    using TreeT = Tree<TSplitPoint, TStatistics>;
+    using NodeT = typename TreeT::NodeT;
+
+    LazyForest(const std::string& filename, size_type eager_depth)
+    : mapped_forest_(filename), eager_depth_(std::max<size_type>(eager_depth, 1)), num_of_loaded_subtrees_(0), has_loader_error_(false), stop_loader_(false)
+    {
+        for (size_type tree_index = 0; tree_index < mapped_forest_.num_of_trees(); ++tree_index)
+        {
+            TreeState tree_state;
+            size_type tree_depth = mapped_forest_.tree_depth(tree_index);
+            size_type top_depth = std::min(eager_depth_, tree_depth);
+            tree_state.top_tree = TreeT(top_depth);
+            fill_tree_levels(tree_state.top_tree, tree_index, 1, 0);
+            // Each node on the last eager level is the root of a subtree that is loaded on demand.
+            size_type num_of_subtrees = top_depth < tree_depth ? (size_type(1) << (top_depth - 1)) : 0;
+            tree_state.subtrees.resize(num_of_subtrees);
+            tree_state.loaded_subtrees.reset(new std::atomic<const TreeT*>[num_of_subtrees]);
+            tree_state.requested_subtrees.reset(new std::atomic<bool>[num_of_subtrees]);
+            for (size_type i = 0; i < num_of_subtrees; ++i)
+            {
+                tree_state.loaded_subtrees[i] = nullptr;
+                tree_state.requested_subtrees[i] = false;
+            }
+            num_of_subtrees_ += num_of_subtrees;
+            trees_.push_back(std::move(tree_state));
+        }
+#if AIT_MULTI_THREADING
+        loader_thread_ = std::thread([this] ()
+        {
+            run_loader();
+        });
+#endif
+    }
+
+    ~LazyForest()
+    {
+#if AIT_MULTI_THREADING
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            stop_loader_ = true;
+        }
+        queue_condition_.notify_all();
+        loader_thread_.join();
+#endif
+    }
+
+    LazyForest(const LazyForest&) = delete;
+    LazyForest& operator=(const LazyForest&) = delete;
+
+    size_type size() const
+    {
+        return trees_.size();
+    }
+
+    size_type num_of_trees() const
+    {
+        return size();
+    }
+
+    size_type num_of_classes() const
+    {
+        return mapped_forest_.num_of_classes();
+    }
+
+    offset_type compute_max_split_point_offset() const
+    {
+        return mapped_forest_.compute_max_split_point_offset();
+    }
+
+    size_type num_of_subtrees() const
+    {
+        return num_of_subtrees_;
+    }
+
+    size_type num_of_loaded_subtrees() const
+    {
+        return num_of_loaded_subtrees_;
+    }
+
+    bool is_fully_loaded() const
+    {
+        return num_of_loaded_subtrees() == num_of_subtrees();
+    }
+
+    /// @brief Evaluate a sample on a tree and return the deepest available node.
+    ///
+    /// If the sample reaches a subtree that is not loaded yet, loading of the subtree is requested.
+    template <typename TSample>
+    const NodeT& evaluate(size_type tree_index, const TSample& sample) const
+    {
+        check_loader_error();
+        const TreeState& tree_state = trees_[tree_index];
+        auto node_iter = tree_state.top_tree.evaluate(sample, eager_depth_);
+        if (node_iter.is_leaf() || tree_state.subtrees.empty())
+        {
+            return *node_iter;
+        }
+        size_type subtree_index = node_iter.get_node_index() - ((size_type(1) << (eager_depth_ - 1)) - 1);
+        const TreeT* subtree = tree_state.loaded_subtrees[subtree_index].load(std::memory_order_acquire);
+        if (subtree == nullptr)
+        {
+            request_subtree(tree_index, subtree_index);
+            check_loader_error();
+            subtree = tree_state.loaded_subtrees[subtree_index].load(std::memory_order_acquire);
+            if (subtree == nullptr)
+            {
+                return *node_iter;
+            }
+        }
+        return *subtree->evaluate(sample);
+    }
+
+    /// @brief Return the class histogram of a node (see MappedNativeForest::get_histogram).
+    const size_type* get_histogram(size_type tree_index, const NodeT& node) const
+    {
+        return node.get_statistics().get_histogram().data();
+    }
+
+    /// @brief Evaluate a sample on all trees.
+    template <typename TSample>
+    void evaluate(const TSample& sample, const std::function<void(size_type, const NodeT&)>& func) const
+    {
+        for (size_type tree_index = 0; tree_index < size(); ++tree_index)
+        {
+            func(tree_index, evaluate(tree_index, sample));
+        }
+    }
+
+    /// @brief Load all remaining subtrees (blocking).
+    void load_all()
+    {
+        for (size_type tree_index = 0; tree_index < size(); ++tree_index)
+        {
+            for (size_type subtree_index = 0; subtree_index < static_cast<size_type>(trees_[tree_index].subtrees.size()); ++subtree_index)
+            {
+                if (!trees_[tree_index].requested_subtrees[subtree_index].exchange(true))
+                {
+                    load_subtree(tree_index, subtree_index);
+                }
+            }
+        }
+        // Subtrees that were requested earlier might still be loading in the background.
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        loaded_condition_.wait(lock, [this] () { return is_fully_loaded() || has_loader_error_; });
+        lock.unlock();
+        check_loader_error();
+    }
+
+private:
+    struct TreeState
+    {
+        TreeT top_tree;
+        mutable std::vector<std::unique_ptr<TreeT>> subtrees;
+        std::unique_ptr<std::atomic<const TreeT*>[]> loaded_subtrees;
+        std::unique_ptr<std::atomic<bool>[]> requested_subtrees;
+    };
+
+    /// @brief Copy the nodes of a (sub-)tree from the mapped file.
+    ///        The root of the copied tree is the node with index first_node_in_level on level first_level.
+    void fill_tree_levels(TreeT& tree, size_type tree_index, size_type first_level, size_type first_node_in_level) const
+    {
+        using NodeEntryT = typename TreeT::NodeEntry;
+        for (size_type level = 1; level <= tree.depth(); ++level)
+        {
+            size_type level_size = size_type(1) << (level - 1);
+            size_type source_level = first_level + level - 1;
+            size_type source_index = ((size_type(1) << (source_level - 1)) - 1) + first_node_in_level * level_size;
+            size_type target_index = level_size - 1;
+            for (size_type i = 0; i < level_size; ++i)
+            {
+                const NativeNodeRecord& record = mapped_forest_.get_node(tree_index, source_index + i);
+                NodeEntryT& node_entry = tree.get_node(target_index + i);
+                node_entry.is_leaf = mapped_forest_.is_leaf(tree_index, source_index + i);
+                node_entry.node.set_split_point(TSplitPoint(record.offset_x1, record.offset_y1, record.offset_x2, record.offset_y2, record.threshold));
+                if (record.has_statistics())
+                {
+                    const std::int64_t* histogram = mapped_forest_.get_histogram(tree_index, source_index + i);
+                    node_entry.node.set_statistics(TStatistics(std::vector<size_type>(histogram, histogram + mapped_forest_.num_of_classes())));
+                }
+            }
+        }
+    }
+
+    void request_subtree(size_type tree_index, size_type subtree_index) const
+    {
+        if (trees_[tree_index].requested_subtrees[subtree_index].exchange(true))
+        {
+            return;
+        }
+#if AIT_MULTI_THREADING
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            load_queue_.push_back(std::make_pair(tree_index, subtree_index));
+        }
+        queue_condition_.notify_one();
+#else
+        load_subtree(tree_index, subtree_index);
+#endif
+    }
+
+    /// @brief Load a subtree. Errors are stored and rethrown by check_loader_error() (also when loading on the loader thread).
+    void load_subtree(size_type tree_index, size_type subtree_index) const
+    {
+        const TreeState& tree_state = trees_[tree_index];
+        std::unique_ptr<TreeT> subtree;
+        try
+        {
+            size_type subtree_depth = mapped_forest_.tree_depth(tree_index) - eager_depth_ + 1;
+            subtree.reset(new TreeT(subtree_depth));
+            fill_tree_levels(*subtree, tree_index, eager_depth_, subtree_index);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            if (!loader_error_)
+            {
+                loader_error_ = std::current_exception();
+            }
+            has_loader_error_.store(true, std::memory_order_release);
+            loaded_condition_.notify_all();
+            return;
+        }
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        tree_state.loaded_subtrees[subtree_index].store(subtree.get(), std::memory_order_release);
+        tree_state.subtrees[subtree_index] = std::move(subtree);
+        ++num_of_loaded_subtrees_;
+        loaded_condition_.notify_all();
+    }
+
+    void check_loader_error() const
+    {
+        // The error is only written before the flag is set and never changes afterwards.
+        if (has_loader_error_.load(std::memory_order_acquire))
+        {
+            std::rethrow_exception(loader_error_);
+        }
+    }
+
+#if AIT_MULTI_THREADING
+    void run_loader()
+    {
+        while (true)
+        {
+            std::pair<size_type, size_type> request;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex_);
+                queue_condition_.wait(lock, [this] () { return stop_loader_ || !load_queue_.empty(); });
+                if (stop_loader_)
+                {
+                    return;
+                }
+                request = load_queue_.front();
+                load_queue_.pop_front();
+            }
+            load_subtree(request.first, request.second);
+        }
+    }
+#endif
+
+    MappedNativeForest<TSplitPoint> mapped_forest_;
+    const size_type eager_depth_;
+    std::vector<TreeState> trees_;
+    size_type num_of_subtrees_ = 0;
+    mutable std::atomic<size_type> num_of_loaded_subtrees_;
+    mutable std::exception_ptr loader_error_;
+    mutable std::atomic<bool> has_loader_error_;
+
+    mutable std::mutex queue_mutex_;
+    mutable std::condition_variable loaded_condition_;
+    mutable std::deque<std::pair<size_type, size_type>> load_queue_;
+    bool stop_loader_;
+#if AIT_MULTI_THREADING
+    mutable std::condition_variable queue_condition_;
+    std::thread loader_thread_;
+#endif
+};
+
+}
@@ -0,0 +1,426 @@
+//
+//  level_forest_trainer.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <sstream>
+
+#include "ait.h"
+#include "logger.h"
+#include "forest.h"
+#include "training.h"
+#include "weak_learner.h"
+#include "training_checkpoint.h"
+
+namespace ait
+{
+
+/// @brief A forest trainer that trains the trees level by level and streams the samples from a sample provider.
+///
+/// The sample bag of each tree is split into image batches and only one batch is loaded at a time.
+/// For each level all batches are passed and the statistics of the nodes are accumulated before
+/// the split points are chosen. Like this the training data does not need to fit into memory.
+template <template <typename> class TWeakLearner, typename TSampleProvider>
+class LevelForestTrainer
+{
+public:
+    using ParametersT = LevelTrainingParameters;
+
+    using SampleProviderT = TSampleProvider;
+    using SampleIteratorT = typename SampleProviderT::SampleIteratorT;
+    using SampleT = typename SampleProviderT::SampleT;
+    using SampleBagBatchT = typename SampleProviderT::SampleBagBatchT;
+
+    using WeakLearnerT = TWeakLearner<SampleIteratorT>;
+    using RandomEngineT = typename WeakLearnerT::RandomEngineT;
+
+    using StatisticsT = typename WeakLearnerT::StatisticsT;
+    using SplitPointT = typename WeakLearnerT::SplitPointT;
+    using SplitPointCandidatesT = typename WeakLearnerT::SplitPointCandidatesT;
+    using ForestT = Forest<SplitPointT, StatisticsT>;
+    using TreeT = Tree<SplitPointT, StatisticsT>;
+    using NodeIterator = typename TreeT::NodeIterator;
+
+private:
+    const WeakLearnerT weak_learner_;
+    const ParametersT training_parameters_;
+
+    /// @brief The state of a node that is trained in the current pass over the sample bag.
+    struct NodeTrainingState
+    {
+        size_type node_index;
+        // The split points are sampled from the samples of the node in the first batch that contains any.
+        bool has_split_points = false;
+        SplitPointCandidatesT split_points;
+        StatisticsT statistics;
+        SplitStatistics<StatisticsT> split_statistics;
+    };
+
+public:
+    LevelForestTrainer(const WeakLearnerT& weak_learner, const ParametersT& training_parameters)
+        : weak_learner_(weak_learner), training_parameters_(training_parameters)
+    {}
+
+    const ParametersT& get_parameters() const
+    {
+        return training_parameters_;
+    }
+
+    using TreeCheckpointT = TreeTrainingCheckpoint<TreeT, SampleBagBatchT>;
+    using ForestCheckpointT = ForestTrainingCheckpoint<ForestT>;
+
+    TreeT train_tree(SampleProviderT& provider, RandomEngineT& rnd_engine) const
+    {
+        TreeCheckpointT state = create_tree_state(0, provider, rnd_engine);
+        train_tree(state, provider, rnd_engine, nullptr);
+        return std::move(state.tree);
+    }
+
+    /// @brief Train a forest and optionally continue from the last checkpoint.
+    ///
+    /// Checkpoints are written if the temporary forest and tree file prefixes are set in the training parameters.
+    /// The forest checkpoint contains all finished trees and is written after each tree.
+    /// The tree checkpoint contains the partially trained tree and is written after each level.
+    ForestT train_forest(SampleProviderT& provider, RandomEngineT& rnd_engine, bool resume = false) const
+    {
+        ForestT forest;
+        std::unique_ptr<TreeCheckpointT> tree_checkpoint;
+        if (resume)
+        {
+            ForestCheckpointT forest_checkpoint;
+            if (read_checkpoint(forest_checkpoint, get_checkpoint_filename(training_parameters_.temporary_binary_forest_file_prefix, ".bin"),
+                                get_checkpoint_filename(training_parameters_.temporary_json_forest_file_prefix, ".json")))
+            {
+                validate_parameters(forest_checkpoint.parameters);
+                forest = std::move(forest_checkpoint.forest);
+                restore_rnd_engine_state(rnd_engine, forest_checkpoint.rnd_engine_state);
+                log_info() << "Resuming with " << forest.size() << " finished trees.";
+            }
+            tree_checkpoint.reset(new TreeCheckpointT());
+            if (read_checkpoint(*tree_checkpoint, get_checkpoint_filename(training_parameters_.temporary_binary_tree_file_prefix, ".bin"),
+                                get_checkpoint_filename(training_parameters_.temporary_json_tree_file_prefix, ".json"))
+                && tree_checkpoint->tree_index == static_cast<size_type>(forest.size()))
+            {
+                restore_rnd_engine_state(rnd_engine, tree_checkpoint->rnd_engine_state);
+                log_info() << "Resuming tree " << tree_checkpoint->tree_index << " at depth " << tree_checkpoint->current_depth << ".";
+            }
+            else
+            {
+                tree_checkpoint.reset();
+            }
+        }
+
+        AsyncCheckpointWriter checkpoint_writer;
+        for (size_type i = forest.size(); i < training_parameters_.num_of_trees; i++)
+        {
+            TreeCheckpointT state;
+            if (tree_checkpoint)
+            {
+                state = std::move(*tree_checkpoint);
+                tree_checkpoint.reset();
+                validate_tree_state(state, provider);
+            }
+            else
+            {
+                state = create_tree_state(i, provider, rnd_engine);
+            }
+            train_tree(state, provider, rnd_engine, &checkpoint_writer);
+            forest.add_tree(state.tree);
+            if (has_forest_checkpoint())
+            {
+                std::shared_ptr<ForestCheckpointT> forest_checkpoint = std::make_shared<ForestCheckpointT>();
+                forest_checkpoint->forest = forest;
+                forest_checkpoint->rnd_engine_state = save_rnd_engine_state(rnd_engine);
+                forest_checkpoint->parameters = describe_parameters();
+                checkpoint_writer.write<ForestCheckpointT>(forest_checkpoint,
+                        get_checkpoint_filename(training_parameters_.temporary_binary_forest_file_prefix, ".bin"),
+                        get_checkpoint_filename(training_parameters_.temporary_json_forest_file_prefix, ".json"));
+            }
+        }
+        checkpoint_writer.wait();
+        return forest;
+    }
+
+    /// @brief Train a forest and pass each tree to tree_handler as soon as it is trained.
+    ///        The tree is released afterwards, so only one tree is kept in memory. No checkpoints are written.
+    void train_forest(SampleProviderT& provider, RandomEngineT& rnd_engine, const std::function<void(TreeT&)>& tree_handler) const
+    {
+        for (size_type i = 0; i < training_parameters_.num_of_trees; i++)
+        {
+            TreeCheckpointT state = create_tree_state(i, provider, rnd_engine);
+            train_tree(state, provider, rnd_engine, nullptr);
+            tree_handler(state.tree);
+        }
+    }
+
+    ForestT train_forest(SampleProviderT& provider) const
+    {
+        RandomEngineT rnd_engine;
+        return train_forest(provider, rnd_engine);
+    }
+
+private:
+    static std::string get_checkpoint_filename(const std::string& prefix, const std::string& extension)
+    {
+        return prefix.empty() ? std::string() : prefix + extension;
+    }
+
+    bool has_forest_checkpoint() const
+    {
+        return !training_parameters_.temporary_binary_forest_file_prefix.empty() || !training_parameters_.temporary_json_forest_file_prefix.empty();
+    }
+
+    bool has_tree_checkpoint() const
+    {
+        return !training_parameters_.temporary_binary_tree_file_prefix.empty() || !training_parameters_.temporary_json_tree_file_prefix.empty();
+    }
+
+    TreeCheckpointT create_tree_state(size_type tree_index, SampleProviderT& provider, RandomEngineT& rnd_engine) const
+    {
+        TreeCheckpointT state;
+        state.tree_index = tree_index;
+        state.current_depth = 1;
+        state.current_level_nodes.assign(1, 0);
+        state.tree = TreeT(training_parameters_.tree_depth);
+        state.parameters = describe_parameters();
+        state.sample_bag_batches = provider.compute_sample_bag_batches(training_parameters_.num_of_sample_bag_batches, rnd_engine);
+        // Every batch is loaded once per pass, so the samples of a batch are drawn with a fixed seed.
+        state.batch_seeds.resize(state.sample_bag_batches.size());
+        for (auto& seed : state.batch_seeds)
+        {
+            seed = rnd_engine();
+        }
+        return state;
+    }
+
+    /// @brief Describe all parameters that influence the trained trees so that a checkpoint is only resumed with the same ones.
+    std::string describe_parameters() const
+    {
+        std::ostringstream stream;
+        stream.precision(17);
+        stream << training_parameters_ << " " << weak_learner_.get_parameters();
+        return stream.str();
+    }
+
+    void validate_parameters(const std::string& checkpoint_parameters) const
+    {
+        if (checkpoint_parameters != describe_parameters())
+        {
+            throw std::runtime_error("The checkpoint was written with different training parameters.");
+        }
+    }
+
+    void validate_tree_state(const TreeCheckpointT& state, const SampleProviderT& provider) const
+    {
+        validate_parameters(state.parameters);
+        if (state.tree.depth() != training_parameters_.tree_depth)
+        {
+            throw std::runtime_error("The tree depth of the checkpoint does not match the training parameters.");
+        }
+        for (const SampleBagBatchT& batch : state.sample_bag_batches)
+        {
+            for (size_type image_index : batch)
+            {
+                if (image_index >= provider.num_of_images())
+                {
+                    throw std::runtime_error("The checkpoint refers to images that are not available.");
+                }
+            }
+        }
+    }
+
+    /// @brief Train the remaining levels of a tree.
+    void train_tree(TreeCheckpointT& state, SampleProviderT& provider, RandomEngineT& rnd_engine, AsyncCheckpointWriter* checkpoint_writer) const
+    {
+        TreeT& tree = state.tree;
+        for (; state.current_depth <= training_parameters_.tree_depth && !state.current_level_nodes.empty(); ++state.current_depth)
+        {
+            const std::vector<size_type>& current_level_nodes = state.current_level_nodes;
+            size_type current_depth = state.current_depth;
+            log_info() << "depth: " << current_depth << ", nodes: " << current_level_nodes.size();
+            std::vector<size_type> next_level_nodes;
+            // Only level_part_size nodes are trained in one pass so that the memory for the split statistics stays bounded.
+            for (size_type part_start = 0; part_start < static_cast<size_type>(current_level_nodes.size()); part_start += training_parameters_.level_part_size)
+            {
+                size_type part_end = std::min(part_start + static_cast<size_type>(training_parameters_.level_part_size), static_cast<size_type>(current_level_nodes.size()));
+                std::vector<NodeTrainingState> node_states;
+                node_states.reserve(part_end - part_start);
+                for (size_type i = part_start; i < part_end; ++i)
+                {
+                    NodeTrainingState node_state;
+                    node_state.node_index = current_level_nodes[i];
+                    node_state.statistics = weak_learner_.create_statistics();
+                    node_states.push_back(std::move(node_state));
+                }
+                accumulate_node_statistics(tree, current_depth, node_states, provider, state.sample_bag_batches, state.batch_seeds, rnd_engine);
+                for (NodeTrainingState& node_state : node_states)
+                {
+                    if (split_node(tree, node_state))
+                    {
+                        NodeIterator node_iter = tree.get_node_iterator(node_state.node_index);
+                        next_level_nodes.push_back(node_iter.left_child().get_node_index());
+                        next_level_nodes.push_back(node_iter.right_child().get_node_index());
+                    }
+                }
+            }
+            state.current_level_nodes = std::move(next_level_nodes);
+            if (checkpoint_writer != nullptr && has_tree_checkpoint())
+            {
+                // The checkpoint is a copy of the state after this level, so training can continue while it is written.
+                std::shared_ptr<TreeCheckpointT> tree_checkpoint = std::make_shared<TreeCheckpointT>(state);
+                ++tree_checkpoint->current_depth;
+                tree_checkpoint->rnd_engine_state = save_rnd_engine_state(rnd_engine);
+                checkpoint_writer->write<TreeCheckpointT>(tree_checkpoint,
+                        get_checkpoint_filename(training_parameters_.temporary_binary_tree_file_prefix, ".bin"),
+                        get_checkpoint_filename(training_parameters_.temporary_json_tree_file_prefix, ".json"));
+            }
+        }
+        provider.clear_samples();
+        provider.clear_image_cache();
+    }
+
+    /// @brief Pass over all batches of the sample bag and accumulate the statistics of the given nodes.
+    ///
+    /// The split points of a node are sampled when the node first receives samples, so that sample dependent
+    /// choices of the weak learner (i.e. an adaptive threshold range) see the samples of the node. With more
+    /// than one batch, these are only the samples of the first batch that reaches the node.
+    void accumulate_node_statistics(TreeT& tree, size_type current_depth, std::vector<NodeTrainingState>& node_states, SampleProviderT& provider,
+                                    const std::vector<SampleBagBatchT>& sample_bag_batches, const std::vector<std::uint64_t>& batch_seeds,
+                                    RandomEngineT& rnd_engine) const
+    {
+        std::map<size_type, size_type> node_state_indices;
+        for (size_type i = 0; i < static_cast<size_type>(node_states.size()); ++i)
+        {
+            node_state_indices[node_states[i].node_index] = i;
+        }
+        std::vector<SampleT> node_samples;
+        std::vector<size_type> sample_node_state_indices;
+        std::vector<size_type> node_sample_offsets(node_states.size() + 1);
+        for (size_type batch_index = 0; batch_index < static_cast<size_type>(sample_bag_batches.size()); ++batch_index)
+        {
+            RandomEngineT batch_rnd_engine(batch_seeds[batch_index]);
+            provider.load_sample_batch(sample_bag_batches[batch_index], batch_rnd_engine);
+
+            // Group the samples of the batch by the node they reach on the current level (counting sort).
+            sample_node_state_indices.clear();
+            std::fill(node_sample_offsets.begin(), node_sample_offsets.end(), 0);
+            for (auto sample_it = provider.get_samples_cbegin(); sample_it != provider.get_samples_cend(); ++sample_it)
+            {
+                size_type node_index = tree.evaluate(*sample_it, current_depth).get_node_index();
+                auto state_it = node_state_indices.find(node_index);
+                size_type state_index = state_it != node_state_indices.cend() ? state_it->second : -1;
+                sample_node_state_indices.push_back(state_index);
+                if (state_index >= 0)
+                {
+                    ++node_sample_offsets[state_index + 1];
+                }
+            }
+            for (size_type i = 1; i < static_cast<size_type>(node_sample_offsets.size()); ++i)
+            {
+                node_sample_offsets[i] += node_sample_offsets[i - 1];
+            }
+            node_samples.clear();
+            if (node_sample_offsets.back() > 0)
+            {
+                node_samples.assign(node_sample_offsets.back(), *provider.get_samples_cbegin());
+            }
+            std::vector<size_type> insert_positions(node_sample_offsets.cbegin(), node_sample_offsets.cend() - 1);
+            for (auto sample_it = provider.get_samples_cbegin(); sample_it != provider.get_samples_cend(); ++sample_it)
+            {
+                size_type state_index = sample_node_state_indices[sample_it - provider.get_samples_cbegin()];
+                if (state_index >= 0)
+                {
+                    node_samples[insert_positions[state_index]++] = *sample_it;
+                }
+            }
+
+            for (size_type i = 0; i < static_cast<size_type>(node_states.size()); ++i)
+            {
+                SampleIteratorT samples_start = node_samples.begin() + node_sample_offsets[i];
+                SampleIteratorT samples_end = node_samples.begin() + node_sample_offsets[i + 1];
+                if (samples_start == samples_end)
+                {
+                    continue;
+                }
+                NodeTrainingState& node_state = node_states[i];
+                node_state.statistics.accumulate(weak_learner_.compute_statistics(samples_start, samples_end));
+                // Split statistics are not needed for nodes that become leaves because of their depth.
+                if (current_depth >= training_parameters_.tree_depth)
+                {
+                    continue;
+                }
+                if (!node_state.has_split_points)
+                {
+                    node_state.split_points = weak_learner_.sample_split_points(samples_start, samples_end, rnd_engine);
+                    node_state.has_split_points = true;
+                }
+                SplitStatistics<StatisticsT> split_statistics = compute_split_statistics(samples_start, samples_end, node_state.split_points);
+                if (node_state.split_statistics.size() == 0)
+                {
+                    node_state.split_statistics = std::move(split_statistics);
+                }
+                else
+                {
+                    node_state.split_statistics.accumulate(split_statistics);
+                }
+            }
+        }
+        provider.clear_samples();
+    }
+
+    SplitStatistics<StatisticsT> compute_split_statistics(SampleIteratorT samples_start, SampleIteratorT samples_end, const SplitPointCandidatesT& split_points) const
+    {
+#if AIT_MULTI_THREADING
+        if (training_parameters_.num_of_threads != 1)
+        {
+            return weak_learner_.compute_split_statistics_parallel(samples_start, samples_end, split_points, training_parameters_.num_of_threads);
+        }
+#endif
+        return weak_learner_.compute_split_statistics(samples_start, samples_end, split_points);
+    }
+
+    /// @brief Assign the accumulated statistics to a node and choose its split point.
+    /// @return True if the node was split, false if it became a leaf.
+    bool split_node(TreeT& tree, const NodeTrainingState& node_state) const
+    {
+        NodeIterator node_iter = tree.get_node_iterator(node_state.node_index);
+        node_iter->set_statistics(node_state.statistics);
+
+        // Stop splitting the node if the minimum number of samples has been reached
+        if (node_state.statistics.num_of_samples() < training_parameters_.minimum_num_of_samples || node_state.split_statistics.size() == 0)
+        {
+            node_iter.set_leaf();
+            return false;
+        }
+
+        // Stop splitting the node if it is a leaf node
+        if (node_iter.is_leaf())
+        {
+            return false;
+        }
+
+        // Find the best split point
+        std::tuple<size_type, scalar_type> best_split_point_tuple = weak_learner_.find_best_split_point_tuple(node_state.statistics, node_state.split_statistics);
+
+        scalar_type best_information_gain = std::get<1>(best_split_point_tuple);
+        // Stop splitting the node if the best information gain is below the minimum information gain
+        if (best_information_gain < training_parameters_.minimum_information_gain)
+        {
+            node_iter.set_leaf();
+            return false;
+        }
+
+        size_type best_split_point_index = std::get<0>(best_split_point_tuple);
+        node_iter->set_split_point(node_state.split_points.get_split_point(best_split_point_index));
+        return true;
+    }
+};
+
+}
@@ -6,90 +6,520 @@
 //
 //
 
-/*
-* This code is adapted from MATLAB by MathWorks.
-* Copyright 1984-2003 The MathWorks, Inc.
-*/
-
 #pragma once
 
 #include <vector>
-#include <map>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#if AIT_MULTI_THREADING
+#include <thread>
+#endif
 
-#include <mat.h>
+#include <zlib.h>
 
+#include "ait.h"
 #include "image_weak_learner.h"
 
 
 namespace ait
 {
 
-template <typename data_type = double, typename label_type = std::size_t>
-std::vector<ait::Image<>> load_images_from_matlab_file(const std::string& filename, const std::string& data_array_name = "data", const std::string& label_array_name = "label")
+/// @brief A reader for numeric arrays in level 5 MAT-files (as written by MATLAB with -v6 or -v7).
+///
+/// Compressed variables are inflated on the fly. Values are converted to the requested type
+/// while streaming so that an array is never held in memory in its stored representation.
+class MatFileReader
 {
-    using ImageType = ait::Image<>;
-
-    /*
-    * Open file to get directory
-    */
-    MATFile* pmat = matOpen(filename.c_str(), "r");
-    if (pmat == nullptr)
-        throw std::runtime_error("Error opening file '" + filename + "'.");
-
-    /* In order to use matGetNextXXX correctly, reopen file to read in headers. */
-    if (matClose(pmat) != 0)
-        throw std::runtime_error("Error closing file '" + filename + "'.");
-    pmat = matOpen(filename.c_str(), "r");
-    if (pmat == nullptr)
-        throw std::runtime_error("Error opening file '" + filename + "'.");
-
-    mxArray* data_pa = matGetVariable(pmat, data_array_name.c_str());
-    if (data_pa == nullptr)
-        throw std::runtime_error("Error reading data array in file '" + filename + "'.");
-
-    mxArray* label_pa = matGetVariable(pmat, label_array_name.c_str());
-    if (label_pa == nullptr)
-        throw std::runtime_error("Error reading label array in file '" + filename + "'.");
-
-    /* Diagnose header pa */
-    mwSize data_num_of_dimensions = mxGetNumberOfDimensions(data_pa);
-    mwSize label_num_of_dimensions = mxGetNumberOfDimensions(label_pa);
-    if (data_num_of_dimensions != 3 || label_num_of_dimensions != 3)
-        throw std::runtime_error("Can only handle arrays with a dimension of 3.");
-
-    const mwSize* data_dimensions = mxGetDimensions(data_pa);
-    const mwSize* label_dimensions = mxGetDimensions(label_pa);
-
-    int num_of_images = static_cast<int>(data_dimensions[2]);
-    int width = static_cast<int>(data_dimensions[1]);
-    int height = static_cast<int>(data_dimensions[0]);
-    if (label_dimensions[2] != num_of_images || label_dimensions[1] != width || label_dimensions[0] != height)
+public:
+    enum DataType : std::uint32_t
+    {
+        miINT8 = 1, miUINT8 = 2, miINT16 = 3, miUINT16 = 4, miINT32 = 5, miUINT32 = 6,
+        miSINGLE = 7, miDOUBLE = 9, miINT64 = 12, miUINT64 = 13, miMATRIX = 14, miCOMPRESSED = 15
+    };
+
+    struct VariableInfo
+    {
+        std::string name;
+        std::vector<size_type> dimensions;
+        std::streamoff offset;
+        std::streamoff size;
+        bool compressed;
+
+        size_type num_of_elements() const
+        {
+            size_type n = 1;
+            for (size_type dim : dimensions)
+            {
+                n *= dim;
+            }
+            return n;
+        }
+    };
+
+    explicit MatFileReader(const std::string& filename)
+    : filename_(filename)
+    {
+        std::ifstream input(filename_, std::ios::binary);
+        if (!input)
+            throw std::runtime_error("Error opening file '" + filename_ + "'.");
+
+        char header[128];
+        input.read(header, sizeof(header));
+        if (!input)
+            throw std::runtime_error("File '" + filename_ + "' is not a MAT-file.");
+        if (std::strncmp(header, "MATLAB 7.3", 10) == 0)
+            throw std::runtime_error("HDF5-based MAT-files (-v7.3) are not supported: '" + filename_ + "'.");
+        if (header[126] == 'M' && header[127] == 'I')
+            throw std::runtime_error("MAT-files with swapped byte order are not supported: '" + filename_ + "'.");
+        if (header[126] != 'I' || header[127] != 'M')
+            throw std::runtime_error("File '" + filename_ + "' is not a level 5 MAT-file.");
+
+        std::streamoff offset = sizeof(header);
+        while (true)
+        {
+            input.clear();
+            input.seekg(offset);
+            std::uint32_t tag[2];
+            input.read(reinterpret_cast<char*>(tag), sizeof(tag));
+            if (!input)
+            {
+                break;
+            }
+            std::uint32_t type = tag[0];
+            std::streamoff size = tag[1];
+            if (type == miMATRIX || type == miCOMPRESSED)
+            {
+                VariableInfo variable;
+                variable.offset = offset;
+                variable.size = size;
+                variable.compressed = (type == miCOMPRESSED);
+                ElementStream stream(input, offset + sizeof(tag), variable.compressed ? size : 0);
+                if (!variable.compressed || read_tag(stream).type == miMATRIX)
+                {
+                    read_matrix_header(stream, variable);
+                    variables_.push_back(std::move(variable));
+                }
+            }
+            // Compressed elements are not padded to 64 bit.
+            offset += sizeof(tag) + (type == miCOMPRESSED ? size : padded_size(size));
+        }
+    }
+
+    const std::vector<VariableInfo>& get_variables() const
+    {
+        return variables_;
+    }
+
+    const VariableInfo& get_variable(const std::string& name) const
+    {
+        for (const VariableInfo& variable : variables_)
+        {
+            if (variable.name == name)
+            {
+                return variable;
+            }
+        }
+        throw std::runtime_error("Error reading array '" + name + "' in file '" + filename_ + "'.");
+    }
+
+    /// @brief Stream the values of the real part of a numeric variable.
+    /// @param func Called with each value (converted to T) in MATLAB's column-major order.
+    ///
+    /// Opens its own file handle so that different variables can be read concurrently.
+    template <typename T, typename TFunc>
+    void read_values(const VariableInfo& variable, TFunc func) const
+    {
+        ValueReader value_reader(*this, variable);
+        std::vector<T> buffer(std::min<size_type>(variable.num_of_elements(), (1 << 16) / sizeof(T)));
+        size_type n;
+        while ((n = value_reader.read(buffer.data(), buffer.size())) > 0)
+        {
+            for (size_type i = 0; i < n; ++i)
+            {
+                func(buffer[i]);
+            }
+        }
+    }
+
+private:
+    struct Tag
+    {
+        std::uint32_t type;
+        size_type size;
+        // Data of small data elements (at most 4 bytes) is packed into the tag.
+        bool is_small;
+        char small_data[4];
+    };
+
+    /// @brief Reads the raw bytes of a data element and inflates them if they are compressed.
+    class ElementStream
+    {
+    public:
+        ElementStream(std::ifstream& input, std::streamoff offset, std::streamoff compressed_size)
+        : input_(input), compressed_(compressed_size > 0), remaining_input_size_(compressed_size)
+        {
+            input_.clear();
+            input_.seekg(offset);
+            if (compressed_)
+            {
+                std::memset(&zstream_, 0, sizeof(zstream_));
+                if (inflateInit(&zstream_) != Z_OK)
+                    throw std::runtime_error("Unable to initialize zlib.");
+                input_buffer_.resize(1 << 16);
+            }
+        }
+
+        ~ElementStream()
+        {
+            if (compressed_)
+            {
+                inflateEnd(&zstream_);
+            }
+        }
+
+        ElementStream(const ElementStream&) = delete;
+        ElementStream& operator=(const ElementStream&) = delete;
+
+        void read(char* buffer, std::size_t size)
+        {
+            if (!compressed_)
+            {
+                input_.read(buffer, size);
+                if (!input_)
+                    throw std::runtime_error("Unexpected end of MAT-file.");
+                return;
+            }
+            zstream_.next_out = reinterpret_cast<Bytef*>(buffer);
+            zstream_.avail_out = static_cast<uInt>(size);
+            while (zstream_.avail_out > 0)
+            {
+                // Once all input is consumed, inflate can still flush buffered output.
+                if (zstream_.avail_in == 0 && remaining_input_size_ > 0)
+                {
+                    std::streamoff n = std::min<std::streamoff>(input_buffer_.size(), remaining_input_size_);
+                    input_.read(reinterpret_cast<char*>(input_buffer_.data()), n);
+                    if (!input_)
+                        throw std::runtime_error("Unexpected end of MAT-file.");
+                    remaining_input_size_ -= n;
+                    zstream_.next_in = input_buffer_.data();
+                    zstream_.avail_in = static_cast<uInt>(n);
+                }
+                int ret = inflate(&zstream_, Z_NO_FLUSH);
+                if (ret == Z_STREAM_END && zstream_.avail_out > 0)
+                    throw std::runtime_error("Unexpected end of compressed data in MAT-file.");
+                // Z_BUF_ERROR: No progress was possible, i.e. inflate needs more input.
+                if (ret == Z_BUF_ERROR && zstream_.avail_in == 0 && remaining_input_size_ == 0)
+                    throw std::runtime_error("Unexpected end of compressed data in MAT-file.");
+                if (ret != Z_OK && ret != Z_STREAM_END)
+                    throw std::runtime_error("Corrupt compressed data in MAT-file.");
+            }
+        }
+
+        void skip(std::size_t size)
+        {
+            if (!compressed_)
+            {
+                input_.seekg(size, std::ios::cur);
+                return;
+            }
+            char buffer[4096];
+            while (size > 0)
+            {
+                std::size_t n = std::min(size, sizeof(buffer));
+                read(buffer, n);
+                size -= n;
+            }
+        }
+
+    private:
+        std::ifstream& input_;
+        bool compressed_;
+        std::streamoff remaining_input_size_;
+        z_stream zstream_;
+        std::vector<unsigned char> input_buffer_;
+    };
+
+    static std::streamoff padded_size(std::streamoff size)
+    {
+        return (size + 7) & ~static_cast<std::streamoff>(7);
+    }
+
+    static size_type get_element_size(std::uint32_t type)
+    {
+        switch (type)
+        {
+            case miINT8: case miUINT8: return 1;
+            case miINT16: case miUINT16: return 2;
+            case miINT32: case miUINT32: case miSINGLE: return 4;
+            case miDOUBLE: case miINT64: case miUINT64: return 8;
+            default: throw std::runtime_error("Unsupported data type in MAT-file: " + std::to_string(type));
+        }
+    }
+
+    static Tag read_tag(ElementStream& stream)
+    {
+        std::uint32_t raw_tag[2];
+        stream.read(reinterpret_cast<char*>(raw_tag), sizeof(raw_tag));
+        Tag tag;
+        tag.is_small = (raw_tag[0] >> 16) != 0;
+        if (tag.is_small)
+        {
+            tag.type = raw_tag[0] & 0xffff;
+            tag.size = raw_tag[0] >> 16;
+            std::memcpy(tag.small_data, &raw_tag[1], sizeof(tag.small_data));
+        }
+        else
+        {
+            tag.type = raw_tag[0];
+            tag.size = raw_tag[1];
+        }
+        return tag;
+    }
+
+    /// @brief Read the data of a (non-numeric) sub-element including its padding.
+    static std::vector<char> read_element_data(ElementStream& stream, const Tag& tag)
+    {
+        if (tag.is_small)
+        {
+            return std::vector<char>(tag.small_data, tag.small_data + tag.size);
+        }
+        std::vector<char> data(padded_size(tag.size));
+        stream.read(data.data(), data.size());
+        data.resize(tag.size);
+        return data;
+    }
+
+    /// @brief Parse array flags, dimensions and name of a miMATRIX element.
+    void read_matrix_header(ElementStream& stream, VariableInfo& variable) const
+    {
+        // Array flags: The class is stored in the lowest byte.
+        Tag flags_tag = read_tag(stream);
+        std::vector<char> flags = read_element_data(stream, flags_tag);
+        if (flags.size() < 4)
+            throw std::runtime_error("Invalid array flags in MAT-file '" + filename_ + "'.");
+        std::uint32_t array_class = static_cast<std::uint8_t>(flags[0]);
+        // Numeric classes are mxDOUBLE_CLASS (6) to mxUINT64_CLASS (15).
+        bool is_numeric = array_class >= 6 && array_class <= 15;
+
+        Tag dimensions_tag = read_tag(stream);
+        std::vector<char> dimensions = read_element_data(stream, dimensions_tag);
+        variable.dimensions.resize(dimensions.size() / sizeof(std::int32_t));
+        for (size_type i = 0; i < static_cast<size_type>(variable.dimensions.size()); ++i)
+        {
+            std::int32_t dim;
+            std::memcpy(&dim, dimensions.data() + i * sizeof(dim), sizeof(dim));
+            variable.dimensions[i] = dim;
+        }
+
+        Tag name_tag = read_tag(stream);
+        std::vector<char> name = read_element_data(stream, name_tag);
+        variable.name.assign(name.begin(), name.end());
+        if (!is_numeric)
+        {
+            // Mark non-numeric arrays so that they are not found by name.
+            variable.name.insert(variable.name.begin(), '\0');
+        }
+    }
+
+public:
+    /// @brief Reads the values of the real part of a numeric variable in chunks, e.g. to process a large array frame by frame.
+    ///
+    /// Opens its own file handle so that different variables can be read concurrently.
+    class ValueReader
+    {
+    public:
+        ValueReader(const MatFileReader& reader, const VariableInfo& variable)
+        : input_(reader.filename_, std::ios::binary)
+        {
+            if (!input_)
+                throw std::runtime_error("Error opening file '" + reader.filename_ + "'.");
+            stream_.reset(new ElementStream(input_, variable.offset + 2 * sizeof(std::uint32_t), variable.compressed ? variable.size : 0));
+            if (variable.compressed)
+            {
+                read_tag(*stream_);
+            }
+            VariableInfo tmp_variable;
+            reader.read_matrix_header(*stream_, tmp_variable);
+            tag_ = read_tag(*stream_);
+            element_size_ = get_element_size(tag_.type);
+            if (tag_.size != variable.num_of_elements() * element_size_)
+                throw std::runtime_error("Size of array '" + variable.name + "' does not match its dimensions.");
+            remaining_values_ = variable.num_of_elements();
+        }
+
+        /// @brief Read the next values (converted to T) in MATLAB's column-major order.
+        /// @return The number of values that were read (less than num_of_values at the end of the array).
+        template <typename T>
+        size_type read(T* values, size_type num_of_values)
+        {
+            size_type n = std::min(num_of_values, remaining_values_);
+            const char* data;
+            if (tag_.is_small)
+            {
+                // Data of small elements is packed into the tag.
+                data = tag_.small_data + (tag_.size - remaining_values_ * element_size_);
+            }
+            else
+            {
+                buffer_.resize(n * element_size_);
+                stream_->read(buffer_.data(), buffer_.size());
+                data = buffer_.data();
+            }
+            switch (tag_.type)
+            {
+                case miINT8: convert_values<std::int8_t>(data, n, values); break;
+                case miUINT8: convert_values<std::uint8_t>(data, n, values); break;
+                case miINT16: convert_values<std::int16_t>(data, n, values); break;
+                case miUINT16: convert_values<std::uint16_t>(data, n, values); break;
+                case miINT32: convert_values<std::int32_t>(data, n, values); break;
+                case miUINT32: convert_values<std::uint32_t>(data, n, values); break;
+                case miSINGLE: convert_values<float>(data, n, values); break;
+                case miDOUBLE: convert_values<double>(data, n, values); break;
+                case miINT64: convert_values<std::int64_t>(data, n, values); break;
+                case miUINT64: convert_values<std::uint64_t>(data, n, values); break;
+            }
+            remaining_values_ -= n;
+            return n;
+        }
+
+    private:
+        template <typename TStorage, typename T>
+        static void convert_values(const char* data, size_type num_of_values, T* values)
+        {
+            for (size_type i = 0; i < num_of_values; ++i)
+            {
+                TStorage value;
+                std::memcpy(&value, data + i * sizeof(TStorage), sizeof(TStorage));
+                values[i] = static_cast<T>(value);
+            }
+        }
+
+        // The element stream reads from input_, so input_ is declared (and constructed) first.
+        std::ifstream input_;
+        std::unique_ptr<ElementStream> stream_;
+        Tag tag_;
+        size_type element_size_;
+        size_type remaining_values_;
+        std::vector<char> buffer_;
+    };
+
+private:
+    std::string filename_;
+    std::vector<VariableInfo> variables_;
+};
+
+/// @brief Load images from the 3-dimensional data and label arrays (height x width x num_of_images) of a MAT-file.
+///
+/// The arrays are streamed directly into the image storage (concurrently if multi-threading is enabled).
+/// As in data/convert_mat_to_images.m negative labels are mapped to the first background label max(label) + 1.
+template <typename TPixel = pixel_type>
+std::vector<ait::Image<TPixel>> load_images_from_matlab_file(const std::string& filename, const std::string& data_array_name = "data", const std::string& label_array_name = "label",
+                                                             offset_type border = 0, TPixel background_value = 0)
+{
+    using ImageType = ait::Image<TPixel>;
+
+    MatFileReader reader(filename);
+    const MatFileReader::VariableInfo& data_variable = reader.get_variable(data_array_name);
+    const MatFileReader::VariableInfo& label_variable = reader.get_variable(label_array_name);
+
+    if (data_variable.dimensions.size() < 2 || data_variable.dimensions.size() > 3)
+        throw std::runtime_error("Can only handle arrays with a dimension of 2 or 3.");
+    if (data_variable.dimensions != label_variable.dimensions)
         throw std::runtime_error("The label and data array must have the same dimensions");
 
-    // Memory layout of MATLAB arrays: width x height x num_of_images.
+    // Memory layout of MATLAB arrays: height x width x num_of_images.
     // The first dimension changes first, then second, then third.
-    const double* data_ptr = mxGetPr(data_pa);
-    const double* label_ptr = mxGetPr(label_pa);
+    size_type height = data_variable.dimensions[0];
+    size_type width = data_variable.dimensions[1];
+    size_type num_of_images = data_variable.dimensions.size() > 2 ? data_variable.dimensions[2] : 1;
 
     std::vector<ImageType> images;
+    images.reserve(num_of_images);
+    for (size_type i = 0; i < num_of_images; i++)
+    {
+        images.emplace_back(width, height, border, background_value);
+    }
 
-    for (int i = 0; i < num_of_images; i++) {
-        typename ImageType::DataMatrixType data_matrix(width, height);
-        typename ImageType::LabelMatrixType label_matrix(width, height);
-        for (int x = 0; x < width; x++) {
-            for (int y = 0; y < height; y++) {
-                data_matrix(x, y) = static_cast<data_type>(data_ptr[x + y * width + i * width * height]);
-                label_matrix(x, y) = static_cast<label_type>(label_ptr[x + y * width + i * width * height]);
+    auto read_data = [&]()
+    {
+        size_type x = 0, y = 0, i = 0;
+        reader.read_values<TPixel>(data_variable, [&](TPixel value)
+        {
+            images[i].get_pixel(x, y) = value;
+            if (++y == height)
+            {
+                y = 0;
+                if (++x == width)
+                {
+                    x = 0;
+                    ++i;
+                }
+            }
+        });
+    };
+    TPixel max_label = std::numeric_limits<TPixel>::lowest();
+    auto read_labels = [&]()
+    {
+        size_type x = 0, y = 0, i = 0;
+        reader.read_values<TPixel>(label_variable, [&](TPixel value)
+        {
+            images[i].get_label_matrix()(x, y) = value;
+            max_label = std::max(max_label, value);
+            if (++y == height)
+            {
+                y = 0;
+                if (++x == width)
+                {
+                    x = 0;
+                    ++i;
+                }
             }
+        });
+    };
+
+#if AIT_MULTI_THREADING
+    std::exception_ptr data_exception;
+    std::thread data_thread([&]()
+    {
+        try
+        {
+            read_data();
+        }
+        catch (...)
+        {
+            data_exception = std::current_exception();
         }
-        ImageType image(data_matrix, label_matrix);
-        images.push_back(std::move(image));
+    });
+    try
+    {
+        read_labels();
+    }
+    catch (...)
+    {
+        data_thread.join();
+        throw;
     }
-    mxDestroyArray(data_pa);
-    mxDestroyArray(label_pa);
+    data_thread.join();
+    if (data_exception)
+    {
+        std::rethrow_exception(data_exception);
+    }
+#else
+    read_data();
+    read_labels();
+#endif
 
-    if (matClose(pmat) != 0)
-        throw std::runtime_error("Error closing file '" + filename + "'.");
+    const TPixel background_label = max_label + 1;
+    for (ImageType& image : images)
+    {
+        typename ImageType::LabelMatrixType& label_matrix = image.get_label_matrix();
+        label_matrix = label_matrix.unaryExpr([background_label](TPixel label) { return label < 0 ? background_label : label; });
+    }
 
     return images;
 }
@@ -0,0 +1,524 @@
+//
+//  native_forest_io.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include "ait.h"
+
+namespace ait
+{
+
+// A native forest file stores forests of image split points and histogram statistics in host byte order:
+//   NativeForestHeader
+//   NativeTreeHeader[num_of_trees]
+//   for each tree: NativeNodeRecord[num_of_nodes] followed by std::int64_t histograms[num_of_nodes * num_of_classes]
+// All sections are 8 byte aligned, so the file can be read with a few large reads or memory-mapped.
+
+static const char NATIVE_FOREST_MAGIC[8] = {'A', 'I', 'T', 'F', 'N', 'A', 'T', 'V'};
+static const std::uint32_t NATIVE_FOREST_VERSION = 1;
+// Deeper trees do not fit into memory anyway, so a larger depth indicates a corrupt file.
+static const std::uint64_t NATIVE_FOREST_MAX_TREE_DEPTH = 30;
+
+struct NativeForestHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t num_of_classes;
+    std::uint64_t num_of_trees;
+};
+
+struct NativeTreeHeader
+{
+    std::uint64_t depth;
+    std::uint64_t num_of_nodes;
+    // Byte offsets from the start of the file
+    std::uint64_t node_offset;
+    std::uint64_t histogram_offset;
+};
+
+struct NativeNodeRecord
+{
+    enum Flags : std::uint8_t
+    {
+        LEAF = 1,
+        // Nodes below a leaf are never reached and have no statistics
+        HAS_STATISTICS = 2
+    };
+
+    std::int16_t offset_x1;
+    std::int16_t offset_y1;
+    std::int16_t offset_x2;
+    std::int16_t offset_y2;
+    std::uint8_t flags;
+    std::uint8_t padding[7];
+    double threshold;
+
+    bool is_leaf() const
+    {
+        return (flags & LEAF) != 0;
+    }
+
+    bool has_statistics() const
+    {
+        return (flags & HAS_STATISTICS) != 0;
+    }
+};
+
+static_assert(sizeof(NativeForestHeader) == 24, "Unexpected size of NativeForestHeader");
+static_assert(sizeof(NativeTreeHeader) == 32, "Unexpected size of NativeTreeHeader");
+static_assert(sizeof(NativeNodeRecord) == 24, "Unexpected size of NativeNodeRecord");
+
+/// @brief Return whether the tree headers of a forest header fit into a file of the given size.
+inline bool is_valid_native_forest_header(const NativeForestHeader& header, std::uint64_t file_size)
+{
+    return file_size >= sizeof(NativeForestHeader)
+        && header.num_of_trees <= (file_size - sizeof(NativeForestHeader)) / sizeof(NativeTreeHeader);
+}
+
+/// @brief Return whether a tree header describes a complete tree whose sections fit into a file of the given size.
+///        The checks are ordered such that none of the computations can overflow.
+inline bool is_valid_native_tree_header(const NativeTreeHeader& tree_header, std::uint32_t num_of_classes, std::uint64_t file_size)
+{
+    if (tree_header.depth < 1 || tree_header.depth > NATIVE_FOREST_MAX_TREE_DEPTH
+        || tree_header.num_of_nodes != (std::uint64_t(1) << tree_header.depth) - 1)
+    {
+        return false;
+    }
+    if (tree_header.node_offset > file_size
+        || tree_header.num_of_nodes > (file_size - tree_header.node_offset) / sizeof(NativeNodeRecord))
+    {
+        return false;
+    }
+    if (tree_header.histogram_offset > file_size
+        || num_of_classes > (file_size - tree_header.histogram_offset) / sizeof(std::int64_t) / tree_header.num_of_nodes)
+    {
+        return false;
+    }
+    return true;
+}
+
+/// @brief Return whether a node is a leaf. Nodes on the last level are leaves even if a corrupt file says otherwise,
+///        so that evaluation never leaves the tree.
+inline bool is_native_leaf_node(const NativeNodeRecord& record, size_type node_index, size_type tree_depth)
+{
+    return record.is_leaf() || node_index >= (size_type(1) << (tree_depth - 1)) - 1;
+}
+
+/// @brief Return whether a file is a native forest file.
+inline bool is_native_forest_file(const std::string& filename)
+{
+    std::ifstream input(filename, std::ios_base::binary);
+    char magic[sizeof(NATIVE_FOREST_MAGIC)];
+    input.read(magic, sizeof(magic));
+    return input && std::memcmp(magic, NATIVE_FOREST_MAGIC, sizeof(magic)) == 0;
+}
+
+template <typename TForest>
+std::uint32_t compute_native_num_of_classes(const TForest& forest)
+{
+    size_type num_of_classes = -1;
+    for (auto tree_it = forest.cbegin(); tree_it != forest.cend(); ++tree_it)
+    {
+        for (auto node_it = tree_it->cbegin(); node_it != tree_it->cend(); ++node_it)
+        {
+            size_type num_of_bins = node_it->get_statistics().num_of_bins();
+            if (num_of_bins == 0)
+            {
+                continue;
+            }
+            if (num_of_classes >= 0 && num_of_classes != num_of_bins)
+            {
+                throw std::runtime_error("All node histograms need to have the same number of classes.");
+            }
+            num_of_classes = num_of_bins;
+        }
+    }
+    return num_of_classes >= 0 ? num_of_classes : 0;
+}
+
+/// @brief Write a forest to a native forest file. Each tree is written with two bulk writes.
+template <typename TForest>
+void write_native_forest(const std::string& filename, const TForest& forest)
+{
+    std::ofstream output(filename, std::ios_base::binary);
+    if (!output)
+    {
+        throw std::runtime_error("Unable to open native forest file '" + filename + "' for writing.");
+    }
+
+    NativeForestHeader header;
+    std::memcpy(header.magic, NATIVE_FOREST_MAGIC, sizeof(header.magic));
+    header.version = NATIVE_FOREST_VERSION;
+    header.num_of_classes = compute_native_num_of_classes(forest);
+    header.num_of_trees = forest.size();
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<NativeTreeHeader> tree_headers(forest.size());
+    std::uint64_t offset = sizeof(NativeForestHeader) + tree_headers.size() * sizeof(NativeTreeHeader);
+    for (size_type i = 0; i < forest.size(); ++i)
+    {
+        const auto& tree = forest.get_tree(i);
+        tree_headers[i].depth = tree.depth();
+        tree_headers[i].num_of_nodes = tree.size();
+        tree_headers[i].node_offset = offset;
+        offset += tree.size() * sizeof(NativeNodeRecord);
+        tree_headers[i].histogram_offset = offset;
+        offset += tree.size() * header.num_of_classes * sizeof(std::int64_t);
+    }
+    output.write(reinterpret_cast<const char*>(tree_headers.data()), tree_headers.size() * sizeof(NativeTreeHeader));
+
+    std::vector<NativeNodeRecord> node_records;
+    std::vector<std::int64_t> histograms;
+    for (auto tree_it = forest.cbegin(); tree_it != forest.cend(); ++tree_it)
+    {
+        node_records.assign(tree_it->size(), NativeNodeRecord());
+        histograms.assign(tree_it->size() * header.num_of_classes, 0);
+        for (auto node_it = tree_it->cbegin(); node_it != tree_it->cend(); ++node_it)
+        {
+            size_type node_index = node_it.get_node_index();
+            const auto& split_point = node_it->get_split_point();
+            const auto& statistics = node_it->get_statistics();
+            NativeNodeRecord& record = node_records[node_index];
+            std::memset(&record, 0, sizeof(record));
+            record.offset_x1 = static_cast<std::int16_t>(split_point.get_offset_x1());
+            record.offset_y1 = static_cast<std::int16_t>(split_point.get_offset_y1());
+            record.offset_x2 = static_cast<std::int16_t>(split_point.get_offset_x2());
+            record.offset_y2 = static_cast<std::int16_t>(split_point.get_offset_y2());
+            record.threshold = split_point.get_threshold();
+            if (node_it.is_leaf())
+            {
+                record.flags |= NativeNodeRecord::LEAF;
+            }
+            if (statistics.num_of_bins() > 0)
+            {
+                record.flags |= NativeNodeRecord::HAS_STATISTICS;
+                std::copy(statistics.get_histogram().cbegin(), statistics.get_histogram().cend(), histograms.begin() + node_index * header.num_of_classes);
+            }
+        }
+        output.write(reinterpret_cast<const char*>(node_records.data()), node_records.size() * sizeof(NativeNodeRecord));
+        output.write(reinterpret_cast<const char*>(histograms.data()), histograms.size() * sizeof(std::int64_t));
+    }
+    if (!output)
+    {
+        throw std::runtime_error("Unable to write native forest file '" + filename + "'.");
+    }
+}
+
+template <typename TTree>
+void fill_tree_from_native_records(TTree& tree, const NativeNodeRecord* node_records, const std::int64_t* histograms, std::uint32_t num_of_classes)
+{
+    using NodeT = typename TTree::NodeT;
+    using SplitPointT = typename std::decay<decltype(std::declval<NodeT>().get_split_point())>::type;
+    using StatisticsT = typename std::decay<decltype(std::declval<NodeT>().get_statistics())>::type;
+    for (size_type node_index = 0; node_index < tree.size(); ++node_index)
+    {
+        const NativeNodeRecord& record = node_records[node_index];
+        auto& node_entry = tree.get_node(node_index);
+        node_entry.is_leaf = is_native_leaf_node(record, node_index, tree.depth());
+        node_entry.node.set_split_point(SplitPointT(record.offset_x1, record.offset_y1, record.offset_x2, record.offset_y2, record.threshold));
+        if (record.has_statistics())
+        {
+            const std::int64_t* histogram = histograms + node_index * num_of_classes;
+            node_entry.node.set_statistics(StatisticsT(std::vector<size_type>(histogram, histogram + num_of_classes)));
+        }
+    }
+}
+
+/// @brief Read a forest from a native forest file. Each tree is read with two bulk reads.
+template <typename TForest>
+TForest read_native_forest(const std::string& filename)
+{
+    using TreeT = typename TForest::TreeT;
+
+    std::ifstream input(filename, std::ios_base::binary);
+    if (!input)
+    {
+        throw std::runtime_error("Unable to open native forest file '" + filename + "'.");
+    }
+    NativeForestHeader header;
+    input.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!input || std::memcmp(header.magic, NATIVE_FOREST_MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw std::runtime_error("File '" + filename + "' is not a native forest file.");
+    }
+    if (header.version != NATIVE_FOREST_VERSION)
+    {
+        throw std::runtime_error("Unsupported native forest version in '" + filename + "'.");
+    }
+    // The header values are checked against the file size before anything is allocated.
+    input.seekg(0, std::ios_base::end);
+    std::uint64_t file_size = static_cast<std::uint64_t>(input.tellg());
+    input.seekg(sizeof(NativeForestHeader));
+    if (!is_valid_native_forest_header(header, file_size))
+    {
+        throw std::runtime_error("Truncated native forest file '" + filename + "'.");
+    }
+    std::vector<NativeTreeHeader> tree_headers(header.num_of_trees);
+    input.read(reinterpret_cast<char*>(tree_headers.data()), tree_headers.size() * sizeof(NativeTreeHeader));
+    for (const NativeTreeHeader& tree_header : tree_headers)
+    {
+        if (!is_valid_native_tree_header(tree_header, header.num_of_classes, file_size))
+        {
+            throw std::runtime_error("Invalid tree in native forest file '" + filename + "'.");
+        }
+    }
+
+    TForest forest;
+    std::vector<NativeNodeRecord> node_records;
+    std::vector<std::int64_t> histograms;
+    for (const NativeTreeHeader& tree_header : tree_headers)
+    {
+        TreeT tree(tree_header.depth);
+        node_records.resize(tree_header.num_of_nodes);
+        histograms.resize(tree_header.num_of_nodes * header.num_of_classes);
+        input.seekg(tree_header.node_offset);
+        input.read(reinterpret_cast<char*>(node_records.data()), node_records.size() * sizeof(NativeNodeRecord));
+        input.seekg(tree_header.histogram_offset);
+        input.read(reinterpret_cast<char*>(histograms.data()), histograms.size() * sizeof(std::int64_t));
+        if (!input)
+        {
+            throw std::runtime_error("Truncated native forest file '" + filename + "'.");
+        }
+        fill_tree_from_native_records(tree, node_records.data(), histograms.data(), header.num_of_classes);
+        forest.add_tree(tree);
+    }
+    return forest;
+}
+
+/// @brief Copy a native forest file into a POSIX shared memory object (an existing object with the same name is replaced).
+///        Prediction processes can then map the forest with MappedNativeForest and share the same physical pages.
+///
+/// The magic of the header is written last, so MappedNativeForest rejects an object that is still being copied.
+inline void publish_native_forest_to_shared_memory(const std::string& filename, const std::string& shared_memory_name)
+{
+    if (!is_native_forest_file(filename))
+    {
+        throw std::runtime_error("File '" + filename + "' is not a native forest file.");
+    }
+    try
+    {
+        boost::interprocess::file_mapping file_mapping(filename.c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region file_region(file_mapping, boost::interprocess::read_only);
+        boost::interprocess::shared_memory_object::remove(shared_memory_name.c_str());
+        boost::interprocess::shared_memory_object shared_memory(boost::interprocess::create_only, shared_memory_name.c_str(), boost::interprocess::read_write);
+        shared_memory.truncate(file_region.get_size());
+        boost::interprocess::mapped_region shared_region(shared_memory, boost::interprocess::read_write);
+        char* shared_data = static_cast<char*>(shared_region.get_address());
+        const char* file_data = static_cast<const char*>(file_region.get_address());
+        const std::size_t magic_size = sizeof(NATIVE_FOREST_MAGIC);
+        std::memcpy(shared_data + magic_size, file_data + magic_size, file_region.get_size() - magic_size);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(shared_data, file_data, magic_size);
+    }
+    catch (const boost::interprocess::interprocess_exception& err)
+    {
+        throw std::runtime_error("Cannot publish native forest file '" + filename + "' to shared memory '" + shared_memory_name + "': " + err.what());
+    }
+}
+
+/// @brief Remove a shared memory object created by publish_native_forest_to_shared_memory.
+///        Processes that have mapped the forest keep their mapping.
+inline bool remove_shared_native_forest(const std::string& shared_memory_name)
+{
+    return boost::interprocess::shared_memory_object::remove(shared_memory_name.c_str());
+}
+
+enum class NativeForestSource
+{
+    FILE,
+    SHARED_MEMORY,
+};
+
+/// @brief A read-only memory-mapped native forest that can be evaluated without deserialization.
+///
+/// The forest is mapped either from a native forest file or from a POSIX shared memory object.
+/// Processes that map the same file or shared memory object share a single copy of the forest.
+template <typename TSplitPoint>
+class MappedNativeForest
+{
+public:
+    using SplitPointT = TSplitPoint;
+
+    explicit MappedNativeForest(const std::string& filename, NativeForestSource source = NativeForestSource::FILE)
+    {
+        try
+        {
+            if (source == NativeForestSource::SHARED_MEMORY)
+            {
+                boost::interprocess::shared_memory_object shared_memory(boost::interprocess::open_only, filename.c_str(), boost::interprocess::read_only);
+                mapped_region_ = boost::interprocess::mapped_region(shared_memory, boost::interprocess::read_only);
+            }
+            else
+            {
+                boost::interprocess::file_mapping file_mapping(filename.c_str(), boost::interprocess::read_only);
+                mapped_region_ = boost::interprocess::mapped_region(file_mapping, boost::interprocess::read_only);
+            }
+        }
+        catch (const boost::interprocess::interprocess_exception& err)
+        {
+            throw std::runtime_error("Cannot map native forest '" + filename + "': " + err.what());
+        }
+        data_ = static_cast<const char*>(mapped_region_.get_address());
+        std::size_t size = mapped_region_.get_size();
+        if (size < sizeof(NativeForestHeader))
+        {
+            throw std::runtime_error("File '" + filename + "' is not a native forest file.");
+        }
+        header_ = reinterpret_cast<const NativeForestHeader*>(data_);
+        if (std::memcmp(header_->magic, NATIVE_FOREST_MAGIC, sizeof(header_->magic)) != 0)
+        {
+            if (source == NativeForestSource::SHARED_MEMORY && std::all_of(header_->magic, header_->magic + sizeof(header_->magic), [] (char c) { return c == 0; }))
+            {
+                throw std::runtime_error("Shared native forest '" + filename + "' is still being published.");
+            }
+            throw std::runtime_error("File '" + filename + "' is not a native forest file.");
+        }
+        // The rest of a shared forest is complete once its magic is visible (see publish_native_forest_to_shared_memory).
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header_->version != NATIVE_FOREST_VERSION)
+        {
+            throw std::runtime_error("Unsupported native forest version in '" + filename + "'.");
+        }
+        if (!is_valid_native_forest_header(*header_, size))
+        {
+            throw std::runtime_error("Truncated native forest file '" + filename + "'.");
+        }
+        tree_headers_ = reinterpret_cast<const NativeTreeHeader*>(data_ + sizeof(NativeForestHeader));
+        for (size_type i = 0; i < num_of_trees(); ++i)
+        {
+            if (!is_valid_native_tree_header(tree_headers_[i], header_->num_of_classes, size))
+            {
+                throw std::runtime_error("Invalid tree in native forest file '" + filename + "'.");
+            }
+        }
+    }
+
+    MappedNativeForest(const MappedNativeForest&) = delete;
+    MappedNativeForest& operator=(const MappedNativeForest&) = delete;
+
+    size_type num_of_trees() const
+    {
+        return header_->num_of_trees;
+    }
+
+    size_type num_of_classes() const
+    {
+        return header_->num_of_classes;
+    }
+
+    size_type tree_depth(size_type tree_index) const
+    {
+        return tree_headers_[tree_index].depth;
+    }
+
+    size_type num_of_nodes(size_type tree_index) const
+    {
+        return tree_headers_[tree_index].num_of_nodes;
+    }
+
+    const NativeNodeRecord& get_node(size_type tree_index, size_type node_index) const
+    {
+        return reinterpret_cast<const NativeNodeRecord*>(data_ + tree_headers_[tree_index].node_offset)[node_index];
+    }
+
+    /// @brief Return whether a node is a leaf (see is_native_leaf_node).
+    bool is_leaf(size_type tree_index, size_type node_index) const
+    {
+        return is_native_leaf_node(get_node(tree_index, node_index), node_index, tree_depth(tree_index));
+    }
+
+    /// @brief Return the class counts of a node (num_of_classes() entries).
+    const std::int64_t* get_histogram(size_type tree_index, size_type node_index) const
+    {
+        return reinterpret_cast<const std::int64_t*>(data_ + tree_headers_[tree_index].histogram_offset) + node_index * header_->num_of_classes;
+    }
+
+    /// @brief Evaluate a sample on a tree and return the index of the leaf node.
+    template <typename TSample>
+    size_type evaluate(size_type tree_index, const TSample& sample) const
+    {
+        const NativeNodeRecord* node_records = reinterpret_cast<const NativeNodeRecord*>(data_ + tree_headers_[tree_index].node_offset);
+        size_type tree_depth = tree_headers_[tree_index].depth;
+        size_type node_index = 0;
+        while (!is_native_leaf_node(node_records[node_index], node_index, tree_depth))
+        {
+            const NativeNodeRecord& record = node_records[node_index];
+            SplitPointT split_point(record.offset_x1, record.offset_y1, record.offset_x2, record.offset_y2, record.threshold);
+            if (split_point.evaluate(sample) == Direction::LEFT)
+            {
+                node_index = 2 * node_index + 1;
+            }
+            else
+            {
+                node_index = 2 * node_index + 2;
+            }
+        }
+        return node_index;
+    }
+
+    /// @brief Copy the mapped forest into the in-memory forest representation.
+    template <typename TForest>
+    TForest to_forest() const
+    {
+        using TreeT = typename TForest::TreeT;
+        TForest forest;
+        for (size_type i = 0; i < num_of_trees(); ++i)
+        {
+            TreeT tree(tree_depth(i));
+            fill_tree_from_native_records(tree, &get_node(i, 0), get_histogram(i, 0), header_->num_of_classes);
+            forest.add_tree(tree);
+        }
+        return forest;
+    }
+
+    /// @brief Return the largest absolute pixel offset used by the split points (see compute_max_split_point_offset).
+    ///        The offsets have the type of the node records, so this header does not depend on the image types.
+    std::int16_t compute_max_split_point_offset() const
+    {
+        std::int16_t max_offset = 0;
+        for (size_type i = 0; i < num_of_trees(); ++i)
+        {
+            for (size_type node_index = 0; node_index < num_of_nodes(i); ++node_index)
+            {
+                const NativeNodeRecord& record = get_node(i, node_index);
+                if (record.is_leaf() || !record.has_statistics())
+                {
+                    continue;
+                }
+                max_offset = std::max<std::int16_t>({
+                    max_offset,
+                    static_cast<std::int16_t>(std::abs(record.offset_x1)),
+                    static_cast<std::int16_t>(std::abs(record.offset_y1)),
+                    static_cast<std::int16_t>(std::abs(record.offset_x2)),
+                    static_cast<std::int16_t>(std::abs(record.offset_y2))
+                });
+            }
+        }
+        return max_offset;
+    }
+
+private:
+    boost::interprocess::mapped_region mapped_region_;
+    const char* data_;
+    const NativeForestHeader* header_;
+    const NativeTreeHeader* tree_headers_;
+};
+
+}
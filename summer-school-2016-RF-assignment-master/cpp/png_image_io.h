@@ -0,0 +1,321 @@
+//
+//  png_image_io.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <csetjmp>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+#include "ait.h"
+
+namespace ait
+{
+
+/// @brief A reader for 8 and 16 bit grayscale PNG images.
+///
+/// The rows are decoded directly into the caller's storage. Each reader has its own
+/// libpng state so that images can be decoded concurrently from worker threads.
+class PngImageReader
+{
+public:
+    explicit PngImageReader(const std::string& filename)
+    : filename_(filename), file_(nullptr), png_ptr_(nullptr), info_ptr_(nullptr), width_(0), height_(0), bit_depth_(0), num_of_passes_(1)
+    {
+        error_message_[0] = '\0';
+        file_ = std::fopen(filename_.c_str(), "rb");
+        if (file_ == nullptr)
+            throw std::runtime_error("Error opening file '" + filename_ + "'.");
+        png_byte signature[8];
+        if (std::fread(signature, 1, sizeof(signature), file_) != sizeof(signature) || png_sig_cmp(signature, 0, sizeof(signature)) != 0)
+        {
+            std::fclose(file_);
+            throw std::runtime_error("File '" + filename_ + "' is not a PNG image.");
+        }
+        png_ptr_ = png_create_read_struct(PNG_LIBPNG_VER_STRING, this, &PngImageReader::error_fn, &PngImageReader::warning_fn);
+        if (png_ptr_ != nullptr)
+        {
+            info_ptr_ = png_create_info_struct(png_ptr_);
+        }
+        if (png_ptr_ == nullptr || info_ptr_ == nullptr)
+        {
+            png_destroy_read_struct(&png_ptr_, &info_ptr_, nullptr);
+            std::fclose(file_);
+            throw std::runtime_error("Unable to initialize libpng.");
+        }
+        // The destructor is not called if the constructor throws.
+        try
+        {
+            read_info();
+        }
+        catch (...)
+        {
+            png_destroy_read_struct(&png_ptr_, &info_ptr_, nullptr);
+            std::fclose(file_);
+            throw;
+        }
+    }
+
+    ~PngImageReader()
+    {
+        png_destroy_read_struct(&png_ptr_, &info_ptr_, nullptr);
+        std::fclose(file_);
+    }
+
+    PngImageReader(const PngImageReader&) = delete;
+    PngImageReader& operator=(const PngImageReader&) = delete;
+
+    size_type width() const
+    {
+        return width_;
+    }
+
+    size_type height() const
+    {
+        return height_;
+    }
+
+    /// @brief Decode all rows. Row y is written to first_row + y * row_stride.
+    ///
+    /// 16 bit images are decoded in place if TPixel has 16 bits, otherwise each row is converted
+    /// from a row buffer. Values are converted with a static_cast like in CImg.
+    template <typename TPixel>
+    void read_rows(TPixel* first_row, size_type row_stride)
+    {
+        bool in_place = bit_depth_ == 8 * sizeof(TPixel) && num_of_passes_ == 1;
+        // The row buffer is allocated before setjmp so that no destructor is skipped by longjmp.
+        // Interlaced images have to be decoded completely before they can be converted.
+        size_type buffer_rows = num_of_passes_ > 1 ? height_ : 1;
+        row_buffer_.resize(in_place ? 0 : buffer_rows * row_bytes_);
+        row_pointers_.resize(num_of_passes_ > 1 ? height_ : 0);
+        for (size_type y = 0; y < static_cast<size_type>(row_pointers_.size()); ++y)
+        {
+            row_pointers_[y] = row_buffer_.data() + y * row_bytes_;
+        }
+        if (setjmp(png_jmpbuf(png_ptr_)))
+        {
+            throw std::runtime_error("Error decoding PNG image '" + filename_ + "': " + error_message_);
+        }
+        if (num_of_passes_ > 1)
+        {
+            png_read_image(png_ptr_, row_pointers_.data());
+            for (size_type y = 0; y < height_; ++y)
+            {
+                convert_row(row_pointers_[y], first_row + y * row_stride);
+            }
+        }
+        else
+        {
+            for (size_type y = 0; y < height_; ++y)
+            {
+                if (in_place)
+                {
+                    png_read_row(png_ptr_, reinterpret_cast<png_bytep>(first_row + y * row_stride), nullptr);
+                }
+                else
+                {
+                    png_read_row(png_ptr_, row_buffer_.data(), nullptr);
+                    convert_row(row_buffer_.data(), first_row + y * row_stride);
+                }
+            }
+        }
+        png_read_end(png_ptr_, nullptr);
+    }
+
+private:
+    static void error_fn(png_structp png_ptr, png_const_charp message)
+    {
+        PngImageReader* reader = static_cast<PngImageReader*>(png_get_error_ptr(png_ptr));
+        std::strncpy(reader->error_message_, message, sizeof(reader->error_message_) - 1);
+        reader->error_message_[sizeof(reader->error_message_) - 1] = '\0';
+        png_longjmp(png_ptr, 1);
+    }
+
+    static void warning_fn(png_structp, png_const_charp)
+    {
+    }
+
+    void read_info()
+    {
+        if (setjmp(png_jmpbuf(png_ptr_)))
+        {
+            throw std::runtime_error("Error reading PNG header of '" + filename_ + "': " + error_message_);
+        }
+        png_init_io(png_ptr_, file_);
+        png_set_sig_bytes(png_ptr_, 8);
+        png_read_info(png_ptr_, info_ptr_);
+        int color_type = png_get_color_type(png_ptr_, info_ptr_);
+        if ((color_type & PNG_COLOR_MASK_COLOR) != 0)
+        {
+            throw std::runtime_error("Images need to be grayscale: '" + filename_ + "'.");
+        }
+        bit_depth_ = png_get_bit_depth(png_ptr_, info_ptr_);
+        if (bit_depth_ < 8)
+        {
+            png_set_expand_gray_1_2_4_to_8(png_ptr_);
+            bit_depth_ = 8;
+        }
+        if ((color_type & PNG_COLOR_MASK_ALPHA) != 0)
+        {
+            png_set_strip_alpha(png_ptr_);
+        }
+        // PNG stores 16 bit samples in network byte order.
+        const std::uint16_t endian_test = 1;
+        if (bit_depth_ == 16 && *reinterpret_cast<const std::uint8_t*>(&endian_test) == 1)
+        {
+            png_set_swap(png_ptr_);
+        }
+        num_of_passes_ = png_set_interlace_handling(png_ptr_);
+        png_read_update_info(png_ptr_, info_ptr_);
+        width_ = png_get_image_width(png_ptr_, info_ptr_);
+        height_ = png_get_image_height(png_ptr_, info_ptr_);
+        row_bytes_ = png_get_rowbytes(png_ptr_, info_ptr_);
+    }
+
+    template <typename TPixel>
+    void convert_row(const png_byte* row, TPixel* output) const
+    {
+        if (bit_depth_ == 16)
+        {
+            const std::uint16_t* row16 = reinterpret_cast<const std::uint16_t*>(row);
+            for (size_type x = 0; x < width_; ++x)
+            {
+                output[x] = static_cast<TPixel>(row16[x]);
+            }
+        }
+        else
+        {
+            for (size_type x = 0; x < width_; ++x)
+            {
+                output[x] = static_cast<TPixel>(row[x]);
+            }
+        }
+    }
+
+    std::string filename_;
+    std::FILE* file_;
+    png_structp png_ptr_;
+    png_infop info_ptr_;
+    size_type width_;
+    size_type height_;
+    int bit_depth_;
+    int num_of_passes_;
+    size_type row_bytes_;
+    std::vector<png_byte> row_buffer_;
+    std::vector<png_bytep> row_pointers_;
+    char error_message_[256];
+};
+
+/// @brief A writer for 8 and 16 bit grayscale PNG images (e.g. label images).
+class PngImageWriter
+{
+public:
+    PngImageWriter(const std::string& filename, size_type width, size_type height, int bit_depth)
+    : filename_(filename), file_(nullptr), png_ptr_(nullptr), info_ptr_(nullptr), width_(width), height_(height), bit_depth_(bit_depth)
+    {
+        error_message_[0] = '\0';
+        if (bit_depth_ != 8 && bit_depth_ != 16)
+        {
+            throw std::runtime_error("Only 8 and 16 bit PNG images can be written.");
+        }
+        file_ = std::fopen(filename_.c_str(), "wb");
+        if (file_ == nullptr)
+            throw std::runtime_error("Error opening file '" + filename_ + "' for writing.");
+        png_ptr_ = png_create_write_struct(PNG_LIBPNG_VER_STRING, this, &PngImageWriter::error_fn, &PngImageWriter::warning_fn);
+        if (png_ptr_ != nullptr)
+        {
+            info_ptr_ = png_create_info_struct(png_ptr_);
+        }
+        if (png_ptr_ == nullptr || info_ptr_ == nullptr)
+        {
+            png_destroy_write_struct(&png_ptr_, &info_ptr_);
+            std::fclose(file_);
+            throw std::runtime_error("Unable to initialize libpng.");
+        }
+    }
+
+    ~PngImageWriter()
+    {
+        png_destroy_write_struct(&png_ptr_, &info_ptr_);
+        std::fclose(file_);
+    }
+
+    PngImageWriter(const PngImageWriter&) = delete;
+    PngImageWriter& operator=(const PngImageWriter&) = delete;
+
+    /// @brief Encode all rows. Row y is read from first_row + y * row_stride. Values are converted with a static_cast.
+    template <typename TPixel>
+    void write_rows(const TPixel* first_row, size_type row_stride)
+    {
+        // The row buffer is allocated before setjmp so that no destructor is skipped by longjmp.
+        row_buffer_.resize(width_ * bit_depth_ / 8);
+        if (setjmp(png_jmpbuf(png_ptr_)))
+        {
+            throw std::runtime_error("Error encoding PNG image '" + filename_ + "': " + error_message_);
+        }
+        png_init_io(png_ptr_, file_);
+        png_set_IHDR(png_ptr_, info_ptr_, width_, height_, bit_depth_, PNG_COLOR_TYPE_GRAY,
+                     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png_ptr_, info_ptr_);
+        for (size_type y = 0; y < height_; ++y)
+        {
+            convert_row(first_row + y * row_stride);
+            png_write_row(png_ptr_, row_buffer_.data());
+        }
+        png_write_end(png_ptr_, nullptr);
+    }
+
+private:
+    static void error_fn(png_structp png_ptr, png_const_charp message)
+    {
+        PngImageWriter* writer = static_cast<PngImageWriter*>(png_get_error_ptr(png_ptr));
+        std::strncpy(writer->error_message_, message, sizeof(writer->error_message_) - 1);
+        writer->error_message_[sizeof(writer->error_message_) - 1] = '\0';
+        png_longjmp(png_ptr, 1);
+    }
+
+    static void warning_fn(png_structp, png_const_charp)
+    {
+    }
+
+    /// @brief PNG stores 16 bit samples in network byte order.
+    template <typename TPixel>
+    void convert_row(const TPixel* row)
+    {
+        if (bit_depth_ == 16)
+        {
+            for (size_type x = 0; x < width_; ++x)
+            {
+                std::uint16_t value = static_cast<std::uint16_t>(row[x]);
+                row_buffer_[2 * x] = static_cast<png_byte>(value >> 8);
+                row_buffer_[2 * x + 1] = static_cast<png_byte>(value & 0xff);
+            }
+        }
+        else
+        {
+            for (size_type x = 0; x < width_; ++x)
+            {
+                row_buffer_[x] = static_cast<png_byte>(row[x]);
+            }
+        }
+    }
+
+    std::string filename_;
+    std::FILE* file_;
+    png_structp png_ptr_;
+    png_infop info_ptr_;
+    size_type width_;
+    size_type height_;
+    int bit_depth_;
+    std::vector<png_byte> row_buffer_;
+    char error_message_[256];
+};
+
+}
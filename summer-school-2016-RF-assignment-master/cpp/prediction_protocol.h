@@ -0,0 +1,246 @@
+//
+//  prediction_protocol.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ait.h"
+
+namespace ait
+{
+
+// Protocol of the prediction server (all values in host byte order):
+// Each message is a uint32 length followed by that many bytes.
+//   Request:  PredictionRequestHeader followed by width * height pixel_type depth values (row by row).
+//   Response: PredictionResponseHeader followed by
+//             - width * height label_type labels (row by row) and,
+//               if PREDICTION_FLAG_POSTERIORS is set, width * height * num_of_classes float posteriors, or
+//             - an error message if the status is not PREDICTION_STATUS_OK.
+
+static const std::uint32_t PREDICTION_REQUEST_MAGIC = 0x51544941;  // "AITQ"
+static const std::uint32_t PREDICTION_RESPONSE_MAGIC = 0x52544941;  // "AITR"
+static const std::uint32_t PREDICTION_FLAG_POSTERIORS = 1;
+static const std::uint32_t PREDICTION_STATUS_OK = 0;
+static const std::uint32_t PREDICTION_STATUS_ERROR = 1;
+// Upper bound of the message size to reject corrupt length prefixes.
+static const std::uint32_t PREDICTION_MAX_MESSAGE_SIZE = 1u << 30;
+// Upper bound of the width and the height of a frame.
+static const std::uint32_t PREDICTION_MAX_FRAME_DIMENSION = 1u << 14;
+
+struct PredictionRequestHeader
+{
+    std::uint32_t magic;
+    std::uint32_t flags;
+    std::uint32_t width;
+    std::uint32_t height;
+};
+
+struct PredictionResponseHeader
+{
+    std::uint32_t magic;
+    std::uint32_t status;
+    std::uint32_t flags;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t num_of_classes;
+};
+
+/// @brief Read exactly size bytes from a file descriptor.
+/// @return False if the end of the stream was reached before the first byte.
+inline bool read_fully(int fd, char* data, std::size_t size)
+{
+    std::size_t offset = 0;
+    while (offset < size)
+    {
+        ssize_t n = ::read(fd, data + offset, size - offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            throw std::runtime_error(std::string("Reading message failed: ") + std::strerror(errno));
+        }
+        if (n == 0)
+        {
+            if (offset == 0)
+            {
+                return false;
+            }
+            throw std::runtime_error("Truncated message.");
+        }
+        offset += n;
+    }
+    return true;
+}
+
+/// @brief Write exactly size bytes to a file descriptor.
+inline void write_fully(int fd, const char* data, std::size_t size)
+{
+    std::size_t offset = 0;
+    while (offset < size)
+    {
+        ssize_t n = ::write(fd, data + offset, size - offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            throw std::runtime_error(std::string("Writing message failed: ") + std::strerror(errno));
+        }
+        offset += n;
+    }
+}
+
+/// @brief Read a length-prefixed message.
+/// @return False if the stream was closed.
+inline bool read_message(int fd, std::vector<char>& message)
+{
+    std::uint32_t size;
+    if (!read_fully(fd, reinterpret_cast<char*>(&size), sizeof(size)))
+    {
+        return false;
+    }
+    if (size > PREDICTION_MAX_MESSAGE_SIZE)
+    {
+        throw std::runtime_error("Message is too large.");
+    }
+    message.resize(size);
+    if (size > 0 && !read_fully(fd, message.data(), size))
+    {
+        throw std::runtime_error("Truncated message.");
+    }
+    return true;
+}
+
+/// @brief Write a length-prefixed message.
+inline void write_message(int fd, const std::vector<char>& message)
+{
+    std::vector<char> buffer(sizeof(std::uint32_t) + message.size());
+    std::uint32_t size = message.size();
+    std::memcpy(buffer.data(), &size, sizeof(size));
+    std::copy(message.cbegin(), message.cend(), buffer.begin() + sizeof(size));
+    write_fully(fd, buffer.data(), buffer.size());
+}
+
+inline std::vector<char> encode_prediction_request(std::uint32_t flags, std::uint32_t width, std::uint32_t height, const pixel_type* pixels)
+{
+    PredictionRequestHeader header = {PREDICTION_REQUEST_MAGIC, flags, width, height};
+    std::size_t data_size = static_cast<std::size_t>(width) * height * sizeof(pixel_type);
+    std::vector<char> message(sizeof(header) + data_size);
+    std::memcpy(message.data(), &header, sizeof(header));
+    std::memcpy(message.data() + sizeof(header), pixels, data_size);
+    return message;
+}
+
+/// @brief Check that a frame is not empty and that its response (with posteriors if requested) fits into a message.
+inline void check_prediction_frame_size(std::uint32_t width, std::uint32_t height, std::uint32_t num_of_classes, bool with_posteriors)
+{
+    if (width == 0 || height == 0)
+    {
+        throw std::runtime_error("The frame must not be empty.");
+    }
+    if (width > PREDICTION_MAX_FRAME_DIMENSION || height > PREDICTION_MAX_FRAME_DIMENSION)
+    {
+        throw std::runtime_error("The frame is too large.");
+    }
+    // Both dimensions are at most 2^14, so none of these products overflows.
+    std::uint64_t num_of_pixels = static_cast<std::uint64_t>(width) * height;
+    std::uint64_t pixel_size = std::max(sizeof(pixel_type), sizeof(label_type)) + (with_posteriors ? static_cast<std::uint64_t>(num_of_classes) * sizeof(float) : 0);
+    if (num_of_pixels * pixel_size > PREDICTION_MAX_MESSAGE_SIZE - sizeof(PredictionResponseHeader))
+    {
+        throw std::runtime_error("The prediction of the frame is too large.");
+    }
+}
+
+/// @brief Decode a request and check its frame size for a forest with the given number of classes.
+///        The pixels point into the message.
+inline const pixel_type* decode_prediction_request(const std::vector<char>& message, std::uint32_t num_of_classes, PredictionRequestHeader& header)
+{
+    if (message.size() < sizeof(header))
+    {
+        throw std::runtime_error("Truncated prediction request.");
+    }
+    std::memcpy(&header, message.data(), sizeof(header));
+    if (header.magic != PREDICTION_REQUEST_MAGIC)
+    {
+        throw std::runtime_error("Invalid prediction request.");
+    }
+    check_prediction_frame_size(header.width, header.height, num_of_classes, (header.flags & PREDICTION_FLAG_POSTERIORS) != 0);
+    if (message.size() != sizeof(header) + static_cast<std::size_t>(header.width) * header.height * sizeof(pixel_type))
+    {
+        throw std::runtime_error("Prediction request size does not match the frame size.");
+    }
+    return reinterpret_cast<const pixel_type*>(message.data() + sizeof(header));
+}
+
+inline std::vector<char> encode_prediction_response(std::uint32_t width, std::uint32_t height, std::uint32_t num_of_classes,
+                                                    const label_type* labels, const float* posteriors)
+{
+    PredictionResponseHeader header = {PREDICTION_RESPONSE_MAGIC, PREDICTION_STATUS_OK, posteriors != nullptr ? PREDICTION_FLAG_POSTERIORS : 0, width, height, num_of_classes};
+    std::size_t num_of_pixels = static_cast<std::size_t>(width) * height;
+    std::size_t labels_size = num_of_pixels * sizeof(label_type);
+    std::size_t posteriors_size = posteriors != nullptr ? num_of_pixels * num_of_classes * sizeof(float) : 0;
+    std::vector<char> message(sizeof(header) + labels_size + posteriors_size);
+    std::memcpy(message.data(), &header, sizeof(header));
+    std::memcpy(message.data() + sizeof(header), labels, labels_size);
+    if (posteriors != nullptr)
+    {
+        std::memcpy(message.data() + sizeof(header) + labels_size, posteriors, posteriors_size);
+    }
+    return message;
+}
+
+inline std::vector<char> encode_prediction_error(const std::string& error_message)
+{
+    PredictionResponseHeader header = {PREDICTION_RESPONSE_MAGIC, PREDICTION_STATUS_ERROR, 0, 0, 0, 0};
+    std::vector<char> message(sizeof(header) + error_message.size());
+    std::memcpy(message.data(), &header, sizeof(header));
+    std::copy(error_message.cbegin(), error_message.cend(), message.begin() + sizeof(header));
+    return message;
+}
+
+/// @brief Decode a response. Errors reported by the server are thrown as std::runtime_error.
+/// @return Pointer to the labels within the message. The posteriors (if any) follow the labels.
+inline const label_type* decode_prediction_response(const std::vector<char>& message, PredictionResponseHeader& header)
+{
+    if (message.size() < sizeof(header))
+    {
+        throw std::runtime_error("Truncated prediction response.");
+    }
+    std::memcpy(&header, message.data(), sizeof(header));
+    if (header.magic != PREDICTION_RESPONSE_MAGIC)
+    {
+        throw std::runtime_error("Invalid prediction response.");
+    }
+    if (header.status != PREDICTION_STATUS_OK)
+    {
+        throw std::runtime_error("Prediction failed: " + std::string(message.data() + sizeof(header), message.size() - sizeof(header)));
+    }
+    check_prediction_frame_size(header.width, header.height, header.num_of_classes, (header.flags & PREDICTION_FLAG_POSTERIORS) != 0);
+    std::size_t num_of_pixels = static_cast<std::size_t>(header.width) * header.height;
+    std::size_t expected_size = sizeof(header) + num_of_pixels * sizeof(label_type);
+    if (header.flags & PREDICTION_FLAG_POSTERIORS)
+    {
+        expected_size += num_of_pixels * header.num_of_classes * sizeof(float);
+    }
+    if (message.size() != expected_size)
+    {
+        throw std::runtime_error("Prediction response size does not match the frame size.");
+    }
+    return reinterpret_cast<const label_type*>(message.data() + sizeof(header));
+}
+
+}
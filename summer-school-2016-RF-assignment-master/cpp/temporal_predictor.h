@@ -0,0 +1,216 @@
+//
+//  temporal_predictor.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "ait.h"
+#include "image_weak_learner.h"
+#include "dense_predictor.h"
+#include "foreground_mask.h"
+
+namespace ait
+{
+
+/// @brief Predicts the frames of a depth stream and re-uses the prediction of the previous frame.
+///
+/// The features of a pixel only probe the depth within image_border() pixels around it. So if no depth in this
+/// neighbourhood changed by more than the depth tolerance since it was last evaluated, the label and posteriors of
+/// the previous frame are carried over. All other pixels are evaluated again (see DenseForestPredictor::update).
+/// With a depth tolerance of 0, the predictions are identical to predicting every frame on its own.
+///
+/// A changed depth becomes the new reference depth of its pixel, so slow drifts are detected once they exceed the
+/// tolerance. The first frame, frames of a different size and key frames are predicted completely.
+template <typename TForest, typename TPixel = pixel_type>
+class TemporalDensePredictor
+{
+public:
+    using DensePredictorT = DenseForestPredictor<TForest>;
+
+    /// @param depth_tolerance Largest depth change of a pixel that is ignored.
+    /// @param keyframe_interval Predict every n-th frame completely (0 to only predict the first frame completely).
+    explicit TemporalDensePredictor(const DensePredictorT& predictor, TPixel depth_tolerance = 0, size_type keyframe_interval = 0)
+    : predictor_(predictor), depth_tolerance_(depth_tolerance), keyframe_interval_(keyframe_interval),
+      has_previous_frame_(false), num_of_frames_since_keyframe_(0), num_of_changed_pixels_(0)
+    {
+        if (depth_tolerance_ < 0)
+        {
+            throw std::runtime_error("The depth tolerance must not be negative.");
+        }
+        if (keyframe_interval_ < 0)
+        {
+            throw std::runtime_error("The key frame interval must not be negative.");
+        }
+    }
+
+    /// @brief Forget the previous frame, i.e. the next frame is predicted completely.
+    void reset()
+    {
+        has_previous_frame_ = false;
+    }
+
+    TPixel depth_tolerance() const
+    {
+        return depth_tolerance_;
+    }
+
+    size_type keyframe_interval() const
+    {
+        return keyframe_interval_;
+    }
+
+    /// @brief Number of pixels of the last frame whose depth changed by more than the tolerance.
+    size_type num_of_changed_pixels() const
+    {
+        return num_of_changed_pixels_;
+    }
+
+    /// @brief Predict the next frame of the stream. The prediction has to be resized before (to request posteriors).
+    ///        Afterwards, prediction.num_of_evaluated_pixels is the number of pixels that were evaluated again.
+    void predict(const Image<TPixel>& image, DensePrediction& prediction)
+    {
+        const size_type width = image.width();
+        const size_type height = image.height();
+        if (prediction.width != width || prediction.height != height || prediction.num_of_classes != predictor_.num_of_classes())
+        {
+            throw std::runtime_error("The prediction does not match the image and the forest.");
+        }
+        bool keyframe = !has_previous_frame_
+            || previous_prediction_.width != width || previous_prediction_.height != height
+            || previous_prediction_.has_posteriors() != prediction.has_posteriors()
+            || (keyframe_interval_ > 0 && num_of_frames_since_keyframe_ >= keyframe_interval_);
+        if (keyframe)
+        {
+            previous_prediction_.resize(width, height, predictor_.num_of_classes(), prediction.has_posteriors());
+            predictor_.predict(image, previous_prediction_);
+            reference_depths_.resize(width * height);
+            for (offset_type y = 0; y < height; ++y)
+            {
+                for (offset_type x = 0; x < width; ++x)
+                {
+                    reference_depths_[y * width + x] = image.get_pixel(x, y);
+                }
+            }
+            num_of_changed_pixels_ = width * height;
+            num_of_frames_since_keyframe_ = 0;
+        }
+        else
+        {
+            compute_changed_pixels(image);
+            dilate_changed_pixels(width, height, predictor_.image_border());
+            update_mask_.compute(dirty_flags_, width, height);
+            predictor_.update(image, update_mask_, previous_prediction_);
+        }
+        has_previous_frame_ = true;
+        ++num_of_frames_since_keyframe_;
+        prediction = previous_prediction_;
+    }
+
+private:
+    /// @brief Flag the pixels whose depth differs from the reference depth by more than the tolerance and update their reference depth.
+    void compute_changed_pixels(const Image<TPixel>& image)
+    {
+        const size_type width = image.width();
+        changed_flags_.assign(width * image.height(), 0);
+        num_of_changed_pixels_ = 0;
+        for (offset_type y = 0; y < image.height(); ++y)
+        {
+            for (offset_type x = 0; x < width; ++x)
+            {
+                const size_type index = y * width + x;
+                const TPixel depth = image.get_pixel(x, y);
+                if (std::abs(depth - reference_depths_[index]) > depth_tolerance_)
+                {
+                    changed_flags_[index] = 1;
+                    reference_depths_[index] = depth;
+                    ++num_of_changed_pixels_;
+                }
+            }
+        }
+    }
+
+    /// @brief Flag all pixels within a square of the given radius around a changed pixel.
+    ///        The square is separated into a horizontal pass and a vertical sliding window over the rows.
+    void dilate_changed_pixels(size_type width, size_type height, offset_type radius)
+    {
+        // Horizontal pass: Number of changed pixels in [x - radius, x + radius] of each row.
+        row_dilated_flags_.assign(width * height, 0);
+        for (size_type y = 0; y < height; ++y)
+        {
+            const std::uint8_t* row_flags = &changed_flags_[y * width];
+            std::uint8_t* dilated_row_flags = &row_dilated_flags_[y * width];
+            size_type count = 0;
+            for (size_type x = 0; x < std::min<size_type>(radius, width); ++x)
+            {
+                count += row_flags[x];
+            }
+            for (size_type x = 0; x < width; ++x)
+            {
+                if (x + radius < width)
+                {
+                    count += row_flags[x + radius];
+                }
+                if (x - radius - 1 >= 0)
+                {
+                    count -= row_flags[x - radius - 1];
+                }
+                dilated_row_flags[x] = count > 0 ? 1 : 0;
+            }
+        }
+        // Vertical pass: Number of horizontally dilated pixels in [y - radius, y + radius] of each column.
+        dirty_flags_.assign(width * height, 0);
+        column_counts_.assign(width, 0);
+        for (size_type y = 0; y < std::min<size_type>(radius, height); ++y)
+        {
+            add_row(y, width, 1);
+        }
+        for (size_type y = 0; y < height; ++y)
+        {
+            if (y + radius < height)
+            {
+                add_row(y + radius, width, 1);
+            }
+            if (y - radius - 1 >= 0)
+            {
+                add_row(y - radius - 1, width, -1);
+            }
+            for (size_type x = 0; x < width; ++x)
+            {
+                dirty_flags_[y * width + x] = column_counts_[x] > 0 ? 1 : 0;
+            }
+        }
+    }
+
+    void add_row(size_type y, size_type width, size_type sign)
+    {
+        const std::uint8_t* row_flags = &row_dilated_flags_[y * width];
+        for (size_type x = 0; x < width; ++x)
+        {
+            column_counts_[x] += sign * row_flags[x];
+        }
+    }
+
+    const DensePredictorT& predictor_;
+    TPixel depth_tolerance_;
+    size_type keyframe_interval_;
+    bool has_previous_frame_;
+    size_type num_of_frames_since_keyframe_;
+    size_type num_of_changed_pixels_;
+    DensePrediction previous_prediction_;
+    // Depth of each pixel when it last changed by more than the tolerance.
+    std::vector<TPixel> reference_depths_;
+    // Scratch memory for the pixels that are evaluated again.
+    std::vector<std::uint8_t> changed_flags_;
+    std::vector<std::uint8_t> row_dilated_flags_;
+    std::vector<std::uint8_t> dirty_flags_;
+    std::vector<size_type> column_counts_;
+    ForegroundMask update_mask_;
+};
+
+}
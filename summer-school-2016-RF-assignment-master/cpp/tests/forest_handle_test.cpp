@@ -0,0 +1,79 @@
+//
+//  forest_handle_test.cpp
+//  DistRandomForest
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "ait.h"
+#include "logger.h"
+#include "forest_handle.h"
+
+namespace
+{
+
+// The handle does not depend on the forest type, so a vector stands in for a forest.
+using TestForestT = std::vector<int>;
+using HandleT = ait::ForestHandle<TestForestT>;
+
+int num_of_failures = 0;
+
+void check(bool condition, const char* message)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED: " << message << std::endl;
+        ++num_of_failures;
+    }
+}
+
+/// @brief Reloading twice while a reader still holds the first snapshot must not block.
+void test_reload_while_reader_holds_snapshot()
+{
+    HandleT handle;
+    handle.publish(std::make_shared<const TestForestT>(1, 1));
+    HandleT::SnapshotT snapshot = handle.get();
+    handle.reload([] () { return TestForestT(1, 2); });
+    handle.reload([] () { return TestForestT(1, 3); });
+    check(handle.wait_for_reload(), "reload succeeds");
+    check(handle.get()->front() == 3, "last reload is published");
+    check((*snapshot)[0] == 1, "reader keeps its snapshot");
+    std::weak_ptr<const TestForestT> first_forest = snapshot;
+    check(!handle.release_unused_forests(), "snapshot in use is not released");
+    snapshot.reset();
+    check(handle.release_unused_forests(), "unused forests are released");
+    check(first_forest.expired(), "released forest is destroyed");
+}
+
+/// @brief A failed reload keeps the current forest and does not affect the next reload.
+void test_failed_reload()
+{
+    HandleT handle;
+    handle.publish(std::make_shared<const TestForestT>(1, 1));
+    handle.reload([] () -> TestForestT { throw std::runtime_error("bad file"); });
+    check(!handle.wait_for_reload(), "failed reload is reported");
+    check(handle.get()->front() == 1, "current forest is kept");
+    check(handle.generation() == 1, "no forest is published");
+    handle.reload([] () { return TestForestT(1, 2); });
+    check(handle.wait_for_reload(), "next reload succeeds");
+    check(handle.get()->front() == 2, "next forest is published");
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    test_reload_while_reader_holds_snapshot();
+    test_failed_reload();
+    if (num_of_failures > 0)
+    {
+        return 1;
+    }
+    std::cout << "All forest handle tests passed." << std::endl;
+    return 0;
+}
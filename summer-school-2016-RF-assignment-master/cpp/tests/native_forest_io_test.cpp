@@ -0,0 +1,240 @@
+//
+//  native_forest_io_test.cpp
+//  DistRandomForest
+//
+
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+#include "ait.h"
+#include "forest.h"
+#include "histogram_statistics.h"
+#include "native_forest_io.h"
+
+namespace
+{
+
+/// @brief A split point on integer samples with the same fields as an image split point.
+class TestSplitPoint
+{
+public:
+    TestSplitPoint()
+    : offset_x1_(0), offset_y1_(0), offset_x2_(0), offset_y2_(0), threshold_(0)
+    {}
+
+    TestSplitPoint(std::int16_t offset_x1, std::int16_t offset_y1, std::int16_t offset_x2, std::int16_t offset_y2, ait::scalar_type threshold)
+    : offset_x1_(offset_x1), offset_y1_(offset_y1), offset_x2_(offset_x2), offset_y2_(offset_y2), threshold_(threshold)
+    {}
+
+    ait::Direction evaluate(int sample) const
+    {
+        return sample < threshold_ ? ait::Direction::LEFT : ait::Direction::RIGHT;
+    }
+
+    std::int16_t get_offset_x1() const { return offset_x1_; }
+    std::int16_t get_offset_y1() const { return offset_y1_; }
+    std::int16_t get_offset_x2() const { return offset_x2_; }
+    std::int16_t get_offset_y2() const { return offset_y2_; }
+    ait::scalar_type get_threshold() const { return threshold_; }
+
+private:
+    std::int16_t offset_x1_;
+    std::int16_t offset_y1_;
+    std::int16_t offset_x2_;
+    std::int16_t offset_y2_;
+    ait::scalar_type threshold_;
+};
+
+using ForestT = ait::Forest<TestSplitPoint, ait::HistogramStatistics>;
+using TreeT = ForestT::TreeT;
+using MappedForestT = ait::MappedNativeForest<TestSplitPoint>;
+
+const std::string filename = "native_forest_io_test.native";
+const ait::size_type num_of_classes = 3;
+
+int num_of_failures = 0;
+
+void check(bool condition, const char* message)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED: " << message << std::endl;
+        ++num_of_failures;
+    }
+}
+
+bool throws_runtime_error(const std::function<void()>& func)
+{
+    try
+    {
+        func();
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+/// @brief A tree of depth 3 whose root splits at 0 and whose left child is a leaf.
+ForestT create_forest()
+{
+    TreeT tree(3);
+    for (ait::size_type node_index = 0; node_index < tree.size(); ++node_index)
+    {
+        auto& node_entry = tree.get_node(node_index);
+        node_entry.node.set_split_point(TestSplitPoint(node_index, -node_index, 2 * node_index, 3, 10 * node_index - 25));
+        node_entry.node.set_statistics(ait::HistogramStatistics(std::vector<ait::size_type>({node_index, 1, 2})));
+    }
+    tree.get_node(1).is_leaf = true;
+    ForestT forest;
+    forest.add_tree(tree);
+    forest.add_tree(TreeT(1));
+    return forest;
+}
+
+void write_file(const std::string& data)
+{
+    std::ofstream output(filename, std::ios_base::binary | std::ios_base::trunc);
+    output.write(data.data(), data.size());
+}
+
+std::string read_file()
+{
+    std::ifstream input(filename, std::ios_base::binary);
+    return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+ait::NativeTreeHeader& get_tree_header(std::string& data, ait::size_type tree_index)
+{
+    return reinterpret_cast<ait::NativeTreeHeader*>(&data[sizeof(ait::NativeForestHeader)])[tree_index];
+}
+
+/// @brief Both readers need to reject a corrupt file with a runtime error.
+void check_rejected(const std::string& data, const char* message)
+{
+    write_file(data);
+    check(throws_runtime_error([] () { ait::read_native_forest<ForestT>(filename); }), message);
+    check(throws_runtime_error([] () { MappedForestT mapped_forest(filename); }), message);
+}
+
+/// @brief Writing and reading a forest keeps all nodes, and the mapped forest evaluates like the tree.
+void test_round_trip()
+{
+    ForestT forest = create_forest();
+    ait::write_native_forest(filename, forest);
+    ForestT read_forest = ait::read_native_forest<ForestT>(filename);
+    MappedForestT mapped_forest(filename);
+    check(read_forest.size() == forest.size() && mapped_forest.num_of_trees() == forest.size(), "number of trees is kept");
+    check(mapped_forest.num_of_classes() == num_of_classes, "number of classes is kept");
+    for (ait::size_type i = 0; i < forest.size(); ++i)
+    {
+        const TreeT& tree = forest.get_tree(i);
+        const TreeT& read_tree = read_forest.get_tree(i);
+        check(read_tree.depth() == tree.depth() && mapped_forest.tree_depth(i) == tree.depth(), "tree depth is kept");
+        for (ait::size_type node_index = 0; node_index < tree.size(); ++node_index)
+        {
+            const auto& node_entry = tree.get_node(node_index);
+            const auto& read_node_entry = read_tree.get_node(node_index);
+            check(read_node_entry.is_leaf == node_entry.is_leaf, "leaf flag is kept");
+            check(mapped_forest.is_leaf(i, node_index) == node_entry.is_leaf, "mapped leaf flag is kept");
+            check(read_node_entry.node.get_split_point().get_threshold() == node_entry.node.get_split_point().get_threshold()
+                  && read_node_entry.node.get_split_point().get_offset_y1() == node_entry.node.get_split_point().get_offset_y1(),
+                  "split point is kept");
+            check(read_node_entry.node.get_statistics().get_histogram() == node_entry.node.get_statistics().get_histogram(), "histogram is kept");
+            check(mapped_forest.get_histogram(i, node_index)[0] == node_index, "mapped histogram is kept");
+        }
+        for (int sample = -40; sample <= 40; sample += 5)
+        {
+            check(mapped_forest.evaluate(i, sample) == tree.evaluate_to_iterator(sample).get_node_index(), "mapped forest evaluates like the tree");
+        }
+    }
+}
+
+/// @brief Header values that do not fit the file are rejected before anything is allocated.
+void test_corrupt_headers()
+{
+    ait::write_native_forest(filename, create_forest());
+    const std::string data = read_file();
+
+    check_rejected(data.substr(0, data.size() - 1), "truncated file is rejected");
+    check_rejected(data.substr(0, sizeof(ait::NativeForestHeader) + sizeof(ait::NativeTreeHeader)), "truncated tree headers are rejected");
+
+    std::string corrupt_data = data;
+    reinterpret_cast<ait::NativeForestHeader*>(&corrupt_data[0])->num_of_trees = std::uint64_t(1) << 62;
+    check_rejected(corrupt_data, "huge number of trees is rejected");
+
+    corrupt_data = data;
+    reinterpret_cast<ait::NativeForestHeader*>(&corrupt_data[0])->num_of_classes = 0xffffffff;
+    check_rejected(corrupt_data, "huge number of classes is rejected");
+
+    corrupt_data = data;
+    get_tree_header(corrupt_data, 0).depth = 62;
+    get_tree_header(corrupt_data, 0).num_of_nodes = (std::uint64_t(1) << 62) - 1;
+    check_rejected(corrupt_data, "huge tree depth is rejected");
+
+    corrupt_data = data;
+    get_tree_header(corrupt_data, 0).depth = 0;
+    get_tree_header(corrupt_data, 0).num_of_nodes = 0;
+    check_rejected(corrupt_data, "empty tree is rejected");
+
+    corrupt_data = data;
+    get_tree_header(corrupt_data, 0).num_of_nodes = 3;
+    check_rejected(corrupt_data, "number of nodes that does not match the depth is rejected");
+
+    corrupt_data = data;
+    get_tree_header(corrupt_data, 1).histogram_offset = std::uint64_t(-8);
+    check_rejected(corrupt_data, "overflowing histogram offset is rejected");
+
+    corrupt_data = data;
+    get_tree_header(corrupt_data, 1).node_offset = data.size() - sizeof(ait::NativeNodeRecord) + 1;
+    check_rejected(corrupt_data, "node records behind the end of the file are rejected");
+}
+
+/// @brief Nodes on the last level are leaves even if their records say otherwise.
+void test_non_leaf_last_level()
+{
+    ait::write_native_forest(filename, create_forest());
+    std::string data = read_file();
+    const ait::NativeTreeHeader tree_header = get_tree_header(data, 0);
+    ait::NativeNodeRecord* node_records = reinterpret_cast<ait::NativeNodeRecord*>(&data[tree_header.node_offset]);
+    for (ait::size_type node_index = 0; node_index < static_cast<ait::size_type>(tree_header.num_of_nodes); ++node_index)
+    {
+        node_records[node_index].flags &= ~ait::NativeNodeRecord::LEAF;
+    }
+    write_file(data);
+
+    MappedForestT mapped_forest(filename);
+    for (int sample = -40; sample <= 40; sample += 5)
+    {
+        check(mapped_forest.evaluate(0, sample) < mapped_forest.num_of_nodes(0), "mapped evaluation stays within the tree");
+    }
+    ForestT read_forest = ait::read_native_forest<ForestT>(filename);
+    const TreeT& read_tree = read_forest.get_tree(0);
+    for (ait::size_type node_index = 3; node_index < read_tree.size(); ++node_index)
+    {
+        check(read_tree.get_node(node_index).is_leaf, "last level nodes are leaves");
+    }
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    test_round_trip();
+    test_corrupt_headers();
+    test_non_leaf_last_level();
+    std::remove(filename.c_str());
+    if (num_of_failures > 0)
+    {
+        return 1;
+    }
+    std::cout << "All native forest io tests passed." << std::endl;
+    return 0;
+}
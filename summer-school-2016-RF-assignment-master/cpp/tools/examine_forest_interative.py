@@ -5,3 +5,41 @@ def read_forest(forest_json_file):
         obj = json.load(fp)
         return obj['forest']
 
+def is_compact_forest(forest):
+    return forest.get('format') == 'compact'
+
+def get_tree_nodes(tree):
+    """Return a dict from node index (level-order position in the full tree) to node for both forest formats.
+
+    Each node has the keys 'is_leaf', 'left', 'right' (node indices or None), 'split_point' and 'statistics'
+    (None if they were omitted).
+    """
+    nodes = {}
+    if 'nodes' in tree:
+        compact_nodes = tree['nodes']
+        for node in compact_nodes:
+            is_leaf = node.get('leaf', False)
+            nodes[node['index']] = {
+                'is_leaf': is_leaf,
+                'left': None if is_leaf else compact_nodes[node['left']]['index'],
+                'right': None if is_leaf else compact_nodes[node['right']]['index'],
+                'split_point': node.get('split_point'),
+                'statistics': node.get('statistics'),
+            }
+    else:
+        node_entries = tree['node_entries']
+        stack = [0]
+        while stack:
+            index = stack.pop()
+            entry = node_entries[index]
+            is_leaf = entry['is_leaf']
+            nodes[index] = {
+                'is_leaf': is_leaf,
+                'left': None if is_leaf else 2 * index + 1,
+                'right': None if is_leaf else 2 * index + 2,
+                'split_point': entry['node']['split_point'],
+                'statistics': entry['node']['statistics'],
+            }
+            if not is_leaf:
+                stack.extend([2 * index + 1, 2 * index + 2])
+    return nodes
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <ostream>
+
 #include "ait.h"
 #include "mpl_utils.h"
 
@@ -51,14 +53,34 @@ private:
 
 struct LevelTrainingParameters : public TrainingParameters
 {
+    LevelTrainingParameters()
+    {}
+
+    explicit LevelTrainingParameters(const TrainingParameters& parameters)
+    : TrainingParameters(parameters)
+    {}
+
+    // Number of image batches that each sample bag is split into. Only one batch is kept in memory at a time.
+    int_type num_of_sample_bag_batches = 1;
     // Number of nodes that are trained in one batch (otherwise memory will grow very quickly with deeper levels)
     int_type level_part_size = 256;
+    // Checkpoint files (<prefix>.json or <prefix>.bin). Finished trees are written to the forest files after each tree,
+    // the partially trained tree is written to the tree files after each level. Empty prefixes disable checkpointing.
     std::string temporary_json_forest_file_prefix;
     std::string temporary_binary_forest_file_prefix;
     std::string temporary_json_tree_file_prefix;
     std::string temporary_binary_tree_file_prefix;
 };
 
+/// @brief Write the parameters that determine the trained trees (e.g. to check that a checkpoint can be resumed).
+inline std::ostream& operator<<(std::ostream& stream, const LevelTrainingParameters& parameters)
+{
+    return stream << "tree_depth=" << parameters.tree_depth
+        << " minimum_num_of_samples=" << parameters.minimum_num_of_samples
+        << " minimum_information_gain=" << parameters.minimum_information_gain
+        << " num_of_sample_bag_batches=" << parameters.num_of_sample_bag_batches;
+}
+
 // TODO: Is this ever needed?
 struct DistributedTrainingParameters : public LevelTrainingParameters
 {
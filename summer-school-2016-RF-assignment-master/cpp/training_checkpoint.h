@@ -0,0 +1,240 @@
+//
+//  training_checkpoint.h
+//  DistRandomForest
+//
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#if AIT_MULTI_THREADING
+#include <future>
+#endif
+
+#include <cereal/archives/json.hpp>
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include "ait.h"
+#include "logger.h"
+
+namespace ait
+{
+
+/// @brief The state of a tree that is trained level by level.
+///
+/// Together with the random engine state this is sufficient to continue training the tree.
+template <typename TTree, typename TSampleBagBatch>
+struct TreeTrainingCheckpoint
+{
+    // Index of the tree within the forest
+    size_type tree_index = 0;
+    // Depth of the next level to train
+    size_type current_depth = 1;
+    // Indices of the nodes on the next level that still have to be trained
+    std::vector<size_type> current_level_nodes;
+    TTree tree;
+    std::vector<TSampleBagBatch> sample_bag_batches;
+    std::vector<std::uint64_t> batch_seeds;
+    std::string rnd_engine_state;
+    // Description of the training and weak learner parameters the tree is trained with
+    std::string parameters;
+
+private:
+    friend class cereal::access;
+
+    template <typename Archive>
+    void serialize(Archive& archive, const unsigned int version, typename disable_if_boost_archive<Archive>::type* = nullptr)
+    {
+        archive(cereal::make_nvp("tree_index", tree_index));
+        archive(cereal::make_nvp("current_depth", current_depth));
+        archive(cereal::make_nvp("current_level_nodes", current_level_nodes));
+        archive(cereal::make_nvp("tree", tree));
+        archive(cereal::make_nvp("sample_bag_batches", sample_bag_batches));
+        archive(cereal::make_nvp("batch_seeds", batch_seeds));
+        archive(cereal::make_nvp("rnd_engine_state", rnd_engine_state));
+        archive(cereal::make_nvp("parameters", parameters));
+    }
+};
+
+/// @brief The trees of a forest that have been trained completely.
+template <typename TForest>
+struct ForestTrainingCheckpoint
+{
+    TForest forest;
+    // State of the random engine after the last tree was trained
+    std::string rnd_engine_state;
+    // Description of the training and weak learner parameters the trees were trained with
+    std::string parameters;
+
+private:
+    friend class cereal::access;
+
+    template <typename Archive>
+    void serialize(Archive& archive, const unsigned int version, typename disable_if_boost_archive<Archive>::type* = nullptr)
+    {
+        archive(cereal::make_nvp("forest", forest));
+        archive(cereal::make_nvp("rnd_engine_state", rnd_engine_state));
+        archive(cereal::make_nvp("parameters", parameters));
+    }
+};
+
+template <typename TRandomEngine>
+std::string save_rnd_engine_state(const TRandomEngine& rnd_engine)
+{
+    std::ostringstream stream;
+    stream << rnd_engine;
+    return stream.str();
+}
+
+template <typename TRandomEngine>
+void restore_rnd_engine_state(TRandomEngine& rnd_engine, const std::string& state)
+{
+    std::istringstream stream(state);
+    stream >> rnd_engine;
+    if (!stream)
+    {
+        throw std::runtime_error("Invalid random engine state in checkpoint.");
+    }
+}
+
+/// @brief Write a checkpoint to a binary and/or a JSON file. Empty filenames are skipped.
+///
+/// The checkpoint is first written to a temporary file that is then renamed, so that a crash
+/// during writing does not destroy the previous checkpoint.
+template <typename TCheckpoint>
+void write_checkpoint(const TCheckpoint& checkpoint, const std::string& binary_filename, const std::string& json_filename)
+{
+    if (!binary_filename.empty())
+    {
+        const std::string tmp_filename = binary_filename + ".tmp";
+        std::ofstream ofile(tmp_filename, std::ios_base::binary);
+        {
+            cereal::BinaryOutputArchive oarchive(ofile);
+            oarchive(cereal::make_nvp("checkpoint", checkpoint));
+        }
+        // Check the stream only after the buffered data has been written, otherwise a full disk goes unnoticed.
+        ofile.close();
+        if (!ofile)
+        {
+            throw std::runtime_error("Unable to write checkpoint file '" + tmp_filename + "'.");
+        }
+        if (std::rename(tmp_filename.c_str(), binary_filename.c_str()) != 0)
+        {
+            throw std::runtime_error("Unable to rename checkpoint file '" + tmp_filename + "'.");
+        }
+    }
+    if (!json_filename.empty())
+    {
+        const std::string tmp_filename = json_filename + ".tmp";
+        std::ofstream ofile(tmp_filename);
+        {
+            // The JSON archive is completed when it is destroyed.
+            cereal::JSONOutputArchive oarchive(ofile);
+            oarchive(cereal::make_nvp("checkpoint", checkpoint));
+        }
+        ofile.close();
+        if (!ofile)
+        {
+            throw std::runtime_error("Unable to write checkpoint file '" + tmp_filename + "'.");
+        }
+        if (std::rename(tmp_filename.c_str(), json_filename.c_str()) != 0)
+        {
+            throw std::runtime_error("Unable to rename checkpoint file '" + tmp_filename + "'.");
+        }
+    }
+}
+
+/// @brief Read a checkpoint from the binary file or, if no binary filename is given, from the JSON file.
+/// @return False if the checkpoint file does not exist.
+template <typename TCheckpoint>
+bool read_checkpoint(TCheckpoint& checkpoint, const std::string& binary_filename, const std::string& json_filename)
+{
+    if (!binary_filename.empty())
+    {
+        std::ifstream ifile(binary_filename, std::ios_base::binary);
+        if (!ifile)
+        {
+            return false;
+        }
+        cereal::BinaryInputArchive iarchive(ifile);
+        iarchive(cereal::make_nvp("checkpoint", checkpoint));
+        return true;
+    }
+    else if (!json_filename.empty())
+    {
+        std::ifstream ifile(json_filename);
+        if (!ifile)
+        {
+            return false;
+        }
+        cereal::JSONInputArchive iarchive(ifile);
+        iarchive(cereal::make_nvp("checkpoint", checkpoint));
+        return true;
+    }
+    return false;
+}
+
+/// @brief Writes checkpoints in the background so that training is not blocked by disk I/O.
+///
+/// At most one checkpoint is written at a time. A new checkpoint waits for the previous one to finish.
+/// Errors during writing are reported by the next call to write() or wait().
+class AsyncCheckpointWriter
+{
+public:
+    AsyncCheckpointWriter()
+    {}
+
+    AsyncCheckpointWriter(const AsyncCheckpointWriter&) = delete;
+    AsyncCheckpointWriter& operator=(const AsyncCheckpointWriter&) = delete;
+
+    ~AsyncCheckpointWriter()
+    {
+        try
+        {
+            wait();
+        }
+        catch (const std::exception& err)
+        {
+            log_error() << "Writing checkpoint failed: " << err.what();
+        }
+    }
+
+    template <typename TCheckpoint>
+    void write(std::shared_ptr<const TCheckpoint> checkpoint, const std::string& binary_filename, const std::string& json_filename)
+    {
+        wait();
+#if AIT_MULTI_THREADING
+        pending_write_ = std::async(std::launch::async, [checkpoint, binary_filename, json_filename] ()
+        {
+            write_checkpoint(*checkpoint, binary_filename, json_filename);
+        });
+#else
+        write_checkpoint(*checkpoint, binary_filename, json_filename);
+#endif
+    }
+
+    void wait()
+    {
+#if AIT_MULTI_THREADING
+        if (pending_write_.valid())
+        {
+            pending_write_.get();
+        }
+#endif
+    }
+
+private:
+#if AIT_MULTI_THREADING
+    std::future<void> pending_write_;
+#endif
+};
+
+}
@@ -307,6 +307,27 @@ public:
         return node_entries_.size();
     }
 
+    /// @brief Return a copy of the upper levels of the tree.
+    ///        The nodes on the last level become leafs and keep the statistics they were trained with.
+    /// @param depth The depth of the returned tree.
+    Tree get_truncated_tree(size_type depth) const
+    {
+        if (depth >= depth_)
+        {
+            return *this;
+        }
+        Tree tree(depth);
+        for (size_type i = 0; i < tree.size(); i++)
+        {
+            tree.node_entries_[i].node = node_entries_[i].node;
+            if (node_entries_[i].is_leaf)
+            {
+                tree.node_entries_[i].is_leaf = true;
+            }
+        }
+        return tree;
+    }
+
     /// @brief evaluate a collection of data-points on the tree.
     /// @param data The collection of data-points
     /// @param leaf_node_indices A vector for storing the results. For each